@@ -0,0 +1,24 @@
+#pragma once
+
+#include "kernels.h"
+
+/* Lance l'animation de zoom : frames images de mandelbrot, chacune agrandie
+ * d'un facteur constant par rapport à la précédente, vers un point de la
+ * vallée des hippocampes
+ *
+ * Une image reprend le nombre d'itérations des pixels d'une image précédente
+ * qui tombent (à un demi-pixel près) sur un de ses pixels, et ne calcule que
+ * les autres. Les images terminées passent, dans l'ordre, par une étape
+ * d'écriture qui les convertit en couleurs et les écrit dans output (flux
+ * PPM) si ce n'est pas NULL. Les autres pixels sont calculés avec le noyau
+ * kernel, ou avec celui que choisit kernel_select pour chaque image
+ * (KERNEL_AUTO).
+ *
+ * L'animation est calculée deux fois : image par image, puis avec plusieurs
+ * images en cours en même temps dans un seul ordonnanceur, et le nombre
+ * d'images par seconde de chacune est affiché (seulement image par image,
+ * sans ordonnanceur, avec serial)
+ *
+ * Renvoie le temps d'exécution de la seconde, -1 en cas d'échec */
+double benchmark_animation(int serial, int nthreads, int qlen, int frames,
+                           const char *output, enum mandel_kernel kernel);
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "sched.h"
+
+/* Graphe de tâches */
+struct dag;
+
+/* Tâche du graphe */
+struct dag_node;
+
+/* Appelé une seule fois, quand toutes les tâches du graphe ont terminé */
+typedef void (*dag_done)(void *arg, struct scheduler *s);
+
+/* Crée un graphe vide
+ *
+ * Renvoie NULL en cas d'échec d'allocation */
+struct dag *dag_new(void);
+
+/* Ajoute la tâche (f, closure) au graphe, sans dépendance
+ *
+ * Renvoie NULL en cas d'échec d'allocation */
+struct dag_node *dag_add(struct dag *, taskfunc f, void *closure);
+
+/* La tâche after ne pourra démarrer qu'une fois before terminée
+ *
+ * Renvoie -1 en cas d'échec d'allocation */
+int dag_edge(struct dag_node *before, struct dag_node *after);
+
+/* Lance les tâches du graphe sur l'ordonnanceur (s). Une tâche devient
+ * exécutable quand sa dernière dépendance termine, elle est alors ajoutée
+ * par le thread qui a exécuté cette dépendance.
+ *
+ * Ne bloque pas : done (peut être NULL) est appelé par la dernière tâche.
+ * Le graphe ne doit pas être modifié ou libéré avant. Les tâches annulées
+ * (voir sched_token_new) ne sont pas exécutées, mais done est quand même
+ * appelé et peut le savoir avec sched_token_cancelled(sched_token_current()).
+ *
+ * Renvoie -1 si le graphe est vide ou a un cycle, sans rien lancer */
+int dag_submit(struct dag *, dag_done done, void *arg, struct scheduler *s);
+
+/* Libère le graphe */
+void dag_free(struct dag *);
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "sched.h"
+
+#include <stddef.h>
+
+/* Vol de tâches entre plusieurs processus de la même machine
+ *
+ * Chaque processus fait tourner son propre ordonnanceur. Les tâches
+ * distribuées sont des descripteurs de taille fixe (un type et quelques
+ * entiers, par exemple un intervalle à trier ou un rectangle de pixels),
+ * gardés dans une file par processus : ses threads prennent les plus
+ * récents, et un processus inactif demande à un autre, choisi au hasard, de
+ * lui envoyer la moitié de ses plus anciens par une socket Unix. Les données
+ * sont en mémoire partagée (distrib_shared), seuls les descripteurs sont
+ * copiés.
+ *
+ * La terminaison se fait par recouvrement de crédit : le premier processus
+ * détient tout le crédit au départ, un processus qui donne des tâches donne
+ * aussi la moitié de son crédit, et un processus inactif rend le sien au
+ * premier. Quand le premier processus, inactif, a tout récupéré, plus aucune
+ * tâche n'existe nulle part et il arrête les autres. Seuls des messages sont
+ * échangés pour cela, les sockets pourraient relier plusieurs machines. */
+struct distrib;
+
+/* Descripteur de tâche distribuée, copié d'un processus à l'autre */
+struct distrib_task {
+    /* Index de la fonction à appeler, dans celles passées à distrib_run */
+    int kind;
+
+    int args[4];
+};
+
+/* Exécute la tâche t, arg est celui passé à distrib_run */
+typedef void (*distrib_func)(const struct distrib_task *t, void *arg,
+                             struct distrib *d, struct scheduler *s);
+
+/* Alloue size octets, initialisés à 0, partagés avec les processus créés
+ * ensuite par distrib_run (memfd)
+ *
+ * Renvoie NULL en cas d'échec */
+void *distrib_shared(size_t size);
+
+/* Libère la mémoire allouée par distrib_shared */
+void distrib_shared_free(void *ptr, size_t size);
+
+/* Lance nprocs processus de nthreads threads chacun (plus un qui attend la
+ * terminaison) et exécute la tâche root dans le premier, le processus
+ * appelant. Les autres sont créés avec fork : arg et les données partagées
+ * doivent être prêts avant l'appel.
+ *
+ * Revient quand toutes les tâches sont terminées dans tous les processus, et
+ * affiche ce que chacun a exécuté, donné et volé. Si un processus part avant
+ * la terminaison, tous s'arrêtent sans finir les tâches perdues.
+ *
+ * Renvoie 0, -1 en cas d'échec */
+int distrib_run(int nprocs, int nthreads, int qlen,
+                const distrib_func *funcs, int nfuncs, void *arg,
+                const struct distrib_task *root);
+
+/* Ajoute une tâche distribuée, depuis une tâche distribuée
+ *
+ * Renvoie -1 en cas d'échec */
+int distrib_spawn(struct distrib *d, const struct distrib_task *t,
+                  struct scheduler *s);
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "sched.h"
+
+#include <stddef.h>
+
+/* Fibers : tâches exécutées sur leur propre petite pile, qui peuvent
+ * s'interrompre pour attendre (sched_join_wait, sched_wait_fd) et rendre leur
+ * thread à d'autres tâches, puis reprendre plus tard sur n'importe quel thread
+ *
+ * L'ordonnanceur crée un struct fibers, exécute chaque tâche dans une fiber
+ * avec fiber_run, et relance avec fiber_run celles qui attendaient quand
+ * resume est appelée. Les piles sont réutilisées, d'abord par le thread qui
+ * les a libérées. */
+struct fibers;
+struct fiber;
+
+/* État d'une fiber quand fiber_run rend la main */
+enum fiber_state {
+    /* La tâche est terminée, la fiber est libérée */
+    FIBER_DONE,
+
+    /* La tâche était annulée et n'a pas été exécutée, la fiber est libérée */
+    FIBER_CANCELLED,
+
+    /* La tâche attend, resume sera appelée quand elle pourra reprendre */
+    FIBER_WAITING,
+};
+
+/* Renvoie 1 si les fibers sont demandées (variable SCHED_FIBERS) */
+int fibers_enabled(void);
+
+/* Crée les fibers d'un ordonnanceur de nthreads threads
+ *
+ * resume(fiber, arg) peut être appelée par n'importe quel thread, y compris
+ * celui qui surveille les descripteurs, et ne doit pas perdre la fiber
+ *
+ * Renvoie NULL en cas d'échec */
+struct fibers *fibers_new(int nthreads,
+                          void (*resume)(struct fiber *, void *), void *arg);
+
+/* Libère les fibers, une fois qu'aucune n'attend plus */
+void fibers_free(struct fibers *);
+
+/* Crée, avec une pile du thread th, une fiber qui exécutera f(closure, s)
+ * avec le jeton token, ou cancel(closure, s) si le jeton est annulé. origin
+ * est gardé pour l'ordonnanceur
+ *
+ * Renvoie NULL si aucune pile n'a pu être allouée */
+struct fiber *fiber_new(struct fibers *, int th, taskfunc f, taskfunc cancel,
+                        void *closure, struct sched_token *token,
+                        struct scheduler *s, int origin);
+
+/* Exécute ou reprend la fiber sur le thread th, jusqu'à ce qu'elle se
+ * termine ou attende */
+enum fiber_state fiber_run(struct fiber *, int th);
+
+/* Renvoie l'origin donné à fiber_new */
+int fiber_origin(struct fiber *);
+
+/* Arrête la fiber courante et la passe tout de suite à resume, pour que
+ * l'ordonnanceur exécute autre chose avant de la reprendre, ou qu'un autre
+ * thread la prenne
+ *
+ * Renvoie 0 sans rien faire hors d'une fiber, 1 une fois reprise */
+int fiber_yield(void);
+
+/* Renvoie la mémoire occupée par les piles allouées, libres ou non */
+size_t fibers_memory(struct fibers *);
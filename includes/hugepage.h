@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stddef.h>
+
+/* Allocation de grands tableaux sur des pages de 2 Mio (transparent huge
+ * pages), pour réduire les défauts de TLB
+ *
+ * Activée par la variable SCHED_HUGEPAGES. La mémoire est alors réservée avec
+ * mmap, alignée sur 2 Mio et marquée MADV_HUGEPAGE. Le noyau reste libre de
+ * ne pas fournir de grandes pages (désactivées, mémoire fragmentée) : la
+ * mémoire est alors en pages normales, sans autre différence. Les petits
+ * tableaux, et tous sans SCHED_HUGEPAGES, passent par malloc. */
+
+/* Renvoie 1 si les grandes pages sont demandées (variable SCHED_HUGEPAGES) */
+int huge_enabled(void);
+
+/* Alloue size octets, non initialisés
+ *
+ * Renvoie NULL en cas d'échec */
+void *huge_alloc(size_t size);
+
+/* Libère un tableau alloué par huge_alloc */
+void huge_free(void *ptr);
+
+/* Touche la première grande page du tableau, pour qu'elle soit placée près
+ * du thread appelant (première écriture), sans changer son contenu */
+void huge_touch(void *ptr, size_t size);
+
+/* Renvoie le nombre d'octets du tableau effectivement en grandes pages,
+ * d'après /proc/self/smaps (0 si inconnu) */
+size_t huge_backed(void *ptr, size_t size);
+
+/* Affiche, si les grandes pages sont demandées, que backed octets sur size
+ * des tableaux name sont en grandes pages */
+void huge_report(const char *name, size_t backed, size_t size);
@@ -0,0 +1,40 @@
+#pragma once
+
+/* Noyaux de calcul de mandelbrot sur une ligne de pixels, vectorisés avec les
+ * extensions de GCC : 4 pixels à la fois en float, 2 en double (SSE2) */
+
+/* Précision du calcul */
+enum mandel_kernel {
+    /* Choisi d'après l'écart entre deux pixels, avec kernel_select */
+    KERNEL_AUTO,
+
+    /* Tout en float, le plus rapide */
+    KERNEL_FLOAT,
+
+    /* En float, puis en double pour les pixels proches du bord de
+     * l'ensemble (ceux qui s'échappent après un nombre minimum
+     * d'itérations) */
+    KERNEL_MIXED,
+
+    /* Tout en double, donne la même image que le calcul scalaire */
+    KERNEL_DOUBLE,
+};
+
+/* Renvoie le noyau correspondant au nom (auto, float, mixed, double), -1 si
+ * le nom est inconnu */
+int kernel_parse(const char *name);
+
+/* Renvoie le nom du noyau */
+const char *kernel_name(enum mandel_kernel kernel);
+
+/* Choisit le noyau le moins précis qui suffit pour des pixels espacés de
+ * spacing, sur des coordonnées d'au plus magnitude en valeur absolue : plus
+ * l'écart entre deux pixels est grand devant la précision des float à cette
+ * magnitude, moins les erreurs d'arrondi changent de pixels */
+enum mandel_kernel kernel_select(double spacing, double magnitude);
+
+/* Calcule, avec le noyau kernel (pas KERNEL_AUTO), le nombre d'itérations
+ * (au plus iterations) avant que re[i] + i im s'échappe, pour les n pixels
+ * de la ligne */
+void kernel_row(enum mandel_kernel kernel, const double *re, double im, int n,
+                int iterations, int *counts);
@@ -1,6 +1,59 @@
 #pragma once
 
+#include "kernels.h"
+
+#include <complex.h>
+
+/* Options du benchmark mandelbrot */
+struct mandelbrot_options {
+    /* Grossissement d'une vue profonde calculée par perturbation (jusqu'à
+     * environ 1e28), 0 pour la vue d'ensemble calculée en double */
+    double zoom;
+
+    /* Nombre d'images d'une animation de zoom, 0 pour une seule image */
+    int frames;
+
+    /* Fichier où écrire les images de l'animation (flux PPM), NULL pour ne
+     * pas les écrire */
+    const char *output;
+
+    /* 1 pour calculer la vue d'ensemble par passes de plus en plus fines,
+     * utilisables dès que la précédente est terminée */
+    int progressive;
+
+    /* Noyau de la vue d'ensemble (aussi par passes) et de l'animation,
+     * KERNEL_AUTO pour le choisir d'après l'écart entre deux pixels */
+    enum mandel_kernel kernel;
+
+    /* 1 pour comparer la vue d'ensemble à l'image de référence calculée en
+     * double, et accepter au plus budget % de pixels différents. Un noyau
+     * choisi automatiquement qui dépasse le budget est remplacé par le
+     * suivant plus précis, sinon le programme échoue */
+    int verify;
+    double budget;
+
+    /* Nombre de lignes de la vue d'ensemble calculées, autour du centre,
+     * 0 pour toutes (essais courts de tune_run) */
+    int rows;
+};
+
+/* Nombre maximum d'itérations d'un pixel */
+#define MANDEL_ITERATIONS 1000
+
+/* Renvoie le nombre d'itérations avant que c s'échappe, au plus
+ * MANDEL_ITERATIONS */
+int mandel(double complex c);
+
+/* Renvoie la couleur (0xRRGGBB) d'un nombre d'itérations */
+unsigned int torgb(int n);
+
 /* Lance le benchmark avec mandelbrot (TP10)
  *
  * Renvoie le temps d'exécution */
-double benchmark_mandelbrot(int, int, int);
+double benchmark_mandelbrot(int, int, int, const struct mandelbrot_options *);
+
+/* Lance le benchmark avec mandelbrot sur la vue d'ensemble, répartie entre
+ * nprocs processus de nthreads threads qui se volent des rectangles de pixels
+ *
+ * Renvoie le temps d'exécution */
+double benchmark_mandelbrot_distributed(int nprocs, int nthreads, int qlen);
@@ -0,0 +1,23 @@
+#pragma once
+
+/* Lance le micro-benchmark de l'ordonnanceur `name` pour 1, 2, 4, ...
+ * jusqu'à nthreads threads, et affiche le coût par tâche pour chacun
+ *
+ * Benchmarks disponibles :
+ * - spawn    : arbre binaire de tâches vides
+ * - fib      : calcul naïf de fib(n), une tâche par appel
+ * - uts      : arbre déséquilibré (unbalanced tree search)
+ * - fanout   : un seul producteur crée toutes les tâches
+ * - pingpong : latence d'un vol, une tâche attendant qu'on vole sa fille
+ * - reduce   : parallel_for puis parallel_reduce sur un tableau
+ * - all      : tous les benchmarks ci-dessus
+ *
+ * et les benchmarks d'une fonctionnalité, lancés une seule fois avec
+ * nthreads threads :
+ * - prio     : latence des tâches de haute priorité sous charge
+ * - search   : recherche parallèle, sans puis avec annulation
+ * - wait     : tâches qui attendent des tubes et la fin des autres
+ * - submit   : tâches créées en continu par des threads extérieurs
+ *
+ * Renvoie le temps d'exécution total, -1 si le benchmark n'existe pas */
+double benchmark_micro(const char *name, int nthreads, int qlen);
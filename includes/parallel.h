@@ -0,0 +1,59 @@
+#pragma once
+
+#include "sched.h"
+
+#include <stddef.h>
+
+/* Grain à passer pour utiliser le partitionneur automatique : l'intervalle
+ * est découpé en quelques morceaux par thread, et un morceau volé par un
+ * autre thread peut être redécoupé */
+#define PARALLEL_AUTO 0
+
+/* Corps d'une boucle sur [begin, end[ */
+typedef void (*range_body)(int begin, int end, void *arg, struct scheduler *s);
+
+/* Corps d'une boucle sur [x0, x1[ x [y0, y1[ */
+typedef void (*range2d_body)(int x0, int y0, int x1, int y1, void *arg,
+                             struct scheduler *s);
+
+/* Appelé une seule fois, quand tout l'intervalle a été traité */
+typedef void (*range_done)(void *arg, struct scheduler *s);
+
+/* Accumule [begin, end[ dans acc */
+typedef void (*reduce_body)(int begin, int end, void *acc, void *arg);
+
+/* Combine other dans acc */
+typedef void (*reduce_join)(void *acc, const void *other, void *arg);
+
+/* Appelé une seule fois avec le résultat de la réduction */
+typedef void (*reduce_done)(void *result, void *arg, struct scheduler *s);
+
+/* Exécute body sur [begin, end[ découpé récursivement en tâches de l'
+ * ordonnanceur (s), jusqu'à des morceaux d'au plus grain éléments
+ * (PARALLEL_AUTO pour le partitionneur automatique).
+ *
+ * Ne bloque pas : done (peut être NULL) est appelé par la dernière tâche.
+ * Si l'ordonnanceur est plein, les morceaux sont exécutés sur place.
+ * Les morceaux annulés (voir sched_token_new) ne sont pas traités, mais done
+ * est quand même appelé et peut le savoir avec
+ * sched_token_cancelled(sched_token_current()).
+ *
+ * Renvoie -1 en cas d'échec d'allocation */
+int parallel_for(int begin, int end, int grain, range_body body,
+                 range_done done, void *arg, struct scheduler *s);
+
+/* Comme parallel_for, sur un rectangle coupé selon sa plus grande dimension
+ * jusqu'à des morceaux d'au plus grain_x x grain_y éléments */
+int parallel_for_2d(int x0, int y0, int x1, int y1, int grain_x, int grain_y,
+                    range2d_body body, range_done done, void *arg,
+                    struct scheduler *s);
+
+/* Réduit [begin, end[ avec un accumulateur de acc_size octets par thread,
+ * initialisé à identity. Les accumulateurs sont combinés par join une fois
+ * l'intervalle traité, puis le résultat est passé à done, appelé comme
+ * celui de parallel_for.
+ *
+ * Renvoie -1 si acc_size est nul ou en cas d'échec d'allocation */
+int parallel_reduce(int begin, int end, int grain, size_t acc_size,
+                    const void *identity, reduce_body body, reduce_join join,
+                    reduce_done done, void *arg, struct scheduler *s);
@@ -0,0 +1,43 @@
+#pragma once
+
+/* Compteurs matériels d'un thread, via perf_event_open
+ *
+ * Les compteurs sont attribués à la phase courante du thread, et une phase
+ * non disponible (perf interdit, événement non supporté) est simplement
+ * affichée comme telle. Toutes les fonctions acceptent NULL et ne font alors
+ * rien, pour ne rien coûter quand les compteurs sont désactivés. */
+struct perf;
+
+/* Phases d'un thread de l'ordonnanceur */
+enum perf_phase {
+    /* Exécution d'une tâche */
+    PERF_EXECUTE,
+
+    /* Recherche d'une tâche, dans son deque ou chez les autres */
+    PERF_STEAL,
+
+    /* Attente d'une tâche */
+    PERF_IDLE,
+
+    PERF_NPHASES
+};
+
+/* Renvoie 1 si les compteurs sont demandés (variable SCHED_PERF) */
+int perf_enabled(void);
+
+/* Ouvre les compteurs du thread courant, qui commence dans la phase phase
+ *
+ * Renvoie NULL si aucun compteur n'a pu être ouvert */
+struct perf *perf_open(enum perf_phase phase);
+
+/* Change la phase du thread courant */
+void perf_phase(struct perf *, enum perf_phase phase);
+
+/* Arrête les compteurs, à appeler par le thread qui les a ouverts */
+void perf_stop(struct perf *);
+
+/* Affiche la somme des compteurs de n threads, par phase */
+void perf_report(struct perf **, int n);
+
+/* Libère les compteurs */
+void perf_free(struct perf *);
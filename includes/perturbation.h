@@ -0,0 +1,43 @@
+#pragma once
+
+/* Calcul de l'ensemble de Mandelbrot par perturbation, pour les grands
+ * zooms où l'écart entre deux pixels est plus petit que la précision d'un
+ * double
+ *
+ * Une seule orbite de référence Z(n), celle du centre de la vue, est
+ * calculée en double-double (environ 32 chiffres). Chaque pixel c = C + dc
+ * itère ensuite en double l'écart d(n) = z(n) - Z(n) :
+ *
+ *   d(n + 1) = 2 Z(n) d(n) + d(n)^2 + dc
+ *
+ * Quand |z| devient plus petit que |d|, ou que l'orbite de référence s'arrête
+ * (le centre s'échappe), l'écart perd sa précision relative : le pixel est
+ * rebasé, d(n) = z(n) et la référence repart de Z(0) = 0, ce qui évite les
+ * glitchs (zones de pixels faux) sans seconde référence. */
+struct perturbation;
+
+/* Centre de la vue, en double-double (hi + lo) */
+struct dd_complex {
+    double re_hi, re_lo;
+    double im_hi, im_lo;
+};
+
+/* Calcule l'orbite de référence de center, sur au plus iterations
+ * itérations
+ *
+ * Renvoie NULL en cas d'échec d'allocation */
+struct perturbation *perturbation_new(struct dd_complex center,
+                                      int iterations);
+
+/* Libère l'orbite */
+void perturbation_free(struct perturbation *);
+
+/* Renvoie le nombre d'itérations de l'orbite de référence avant qu'elle ne
+ * s'échappe (ou le maximum) */
+int perturbation_length(struct perturbation *);
+
+/* Renvoie le nombre d'itérations avant que le point center + (dx, dy) ne
+ * s'échappe, au plus iterations, et ajoute à *rebases le nombre de
+ * rebasages */
+int perturbation_iterate(struct perturbation *, double dx, double dy,
+                         long *rebases);
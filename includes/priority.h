@@ -0,0 +1,9 @@
+#pragma once
+
+/* Lance le benchmark de latence des priorités : une tâche crée des tâches
+ * sondes à intervalle régulier pendant que des tâches de fond occupent tous
+ * les threads, d'abord en priorité normale puis en haute priorité, et affiche
+ * la distribution du délai entre la création et le début de chaque sonde
+ *
+ * Nécessite au moins 2 threads, renvoie le temps d'exécution total */
+double benchmark_priority(int nthreads, int qlen);
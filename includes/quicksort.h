@@ -1,6 +1,147 @@
 #pragma once
 
-/* Lance le benchmark avec quicksort (fournis)
+#include "sched.h"
+#include "tune.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+
+/* Types de clés disponibles pour le benchmark */
+enum sort_type {
+    SORT_INT32,
+    SORT_UINT64,
+    SORT_FLOAT,
+    SORT_DOUBLE,
+    SORT_KV,
+};
+
+/* Renvoie le type correspondant au nom (int32, uint64, float, double, kv),
+ * -1 si le nom est inconnu */
+int sort_type_parse(const char *);
+
+/* Nombre de clés triées par défaut par le benchmark */
+#define QUICKSORT_N (10 * 1024 * 1024)
+
+/* Lance le benchmark avec quicksort (fournis) sur n clés du type donné (0
+ * pour QUICKSORT_N)
  *
  * Renvoie le temps d'exécution */
-double benchmark_quicksort(int, int, int);
+double benchmark_quicksort(int, int, int, enum sort_type, int n);
+
+/* Lance le benchmark avec quicksort sur des clés int32, réparti entre nprocs
+ * processus de nthreads threads qui se volent des intervalles à trier
+ *
+ * Renvoie le temps d'exécution */
+double benchmark_quicksort_distributed(int nprocs, int nthreads, int qlen);
+
+/* Taille par défaut en dessous de laquelle le tri est fait en série, réglée
+ * ensuite dans tuning.cutoff */
+#define QUICKSORT_CUTOFF 128
+
+/* Génère une famille de tri pour des éléments de type `type`, ordonnés par
+ * `less(a, b)` (vrai si a < b). La comparaison est une macro ou une fonction
+ * inline : elle est dépliée dans la boucle de partition, contrairement à un
+ * pointeur de fonction à la `qsort`.
+ *
+ * Définit, pour le suffixe `name` :
+ * - partition_name(type *a, int lo, int hi)
+ * - quicksort_serial_name(type *a, int lo, int hi)
+ * - new_args_name(type *a, int lo, int hi) : arguments de la tâche
+ * - quicksort_name(void *closure, struct scheduler *s) : tâche à passer à
+ *   sched_init ou sched_spawn, qui trie a[lo..hi] (bornes incluses). Une
+ *   moitié qui ne rentre pas dans l'ordonnanceur est triée sur place */
+#define QUICKSORT_DEFINE(name, type, less)                                     \
+    static int partition_##name(type *a, int lo, int hi)                       \
+    {                                                                          \
+        type pivot = a[lo];                                                    \
+        int i = lo - 1;                                                        \
+        int j = hi + 1;                                                        \
+        type t;                                                                \
+        while(1) {                                                             \
+            do {                                                               \
+                i++;                                                           \
+            } while(less(a[i], pivot));                                        \
+                                                                               \
+            do {                                                               \
+                j--;                                                           \
+            } while(less(pivot, a[j]));                                        \
+                                                                               \
+            if(i >= j) {                                                       \
+                return j;                                                      \
+            }                                                                  \
+                                                                               \
+            t = a[i];                                                          \
+            a[i] = a[j];                                                       \
+            a[j] = t;                                                          \
+        }                                                                      \
+    }                                                                          \
+                                                                               \
+    struct quicksort_args_##name {                                             \
+        type *a;                                                               \
+        int lo, hi;                                                            \
+    };                                                                         \
+                                                                               \
+    static struct quicksort_args_##name *new_args_##name(type *a, int lo,      \
+                                                         int hi)               \
+    {                                                                          \
+        struct quicksort_args_##name *args =                                   \
+            malloc(sizeof(struct quicksort_args_##name));                      \
+        if(args == NULL) {                                                     \
+            return NULL;                                                       \
+        }                                                                      \
+                                                                               \
+        args->a = a;                                                           \
+        args->lo = lo;                                                         \
+        args->hi = hi;                                                         \
+        return args;                                                           \
+    }                                                                          \
+                                                                               \
+    static void quicksort_serial_##name(type *a, int lo, int hi)               \
+    {                                                                          \
+        int p;                                                                 \
+                                                                               \
+        if(lo >= hi) {                                                         \
+            return;                                                            \
+        }                                                                      \
+                                                                               \
+        p = partition_##name(a, lo, hi);                                       \
+        quicksort_serial_##name(a, lo, p);                                     \
+        quicksort_serial_##name(a, p + 1, hi);                                 \
+    }                                                                          \
+                                                                               \
+    static void quicksort_##name(void *closure, struct scheduler *s)           \
+    {                                                                          \
+        struct quicksort_args_##name *args =                                   \
+            (struct quicksort_args_##name *)closure;                           \
+        type *a = args->a;                                                     \
+        int lo = args->lo;                                                     \
+        int hi = args->hi;                                                     \
+        int p;                                                                 \
+        int rc;                                                                \
+        struct quicksort_args_##name *halves[2];                               \
+                                                                               \
+        free(closure);                                                         \
+                                                                               \
+        if(lo >= hi) {                                                         \
+            return;                                                            \
+        }                                                                      \
+                                                                               \
+        if(hi - lo <= tuning.cutoff) {                                         \
+            quicksort_serial_##name(a, lo, hi);                                \
+            return;                                                            \
+        }                                                                      \
+                                                                               \
+        p = partition_##name(a, lo, hi);                                       \
+        halves[0] = new_args_##name(a, lo, p);                                 \
+        halves[1] = new_args_##name(a, p + 1, hi);                             \
+                                                                               \
+        for(int h = 0; h < 2; ++h) {                                           \
+            if((rc = sched_spawn(quicksort_##name, halves[h], s)) < 0 &&       \
+               errno == EAGAIN) {                                              \
+                quicksort_##name(halves[h], s);                                \
+                rc = 0;                                                        \
+            }                                                                  \
+            assert(rc >= 0);                                                   \
+        }                                                                      \
+    }
@@ -0,0 +1,33 @@
+#pragma once
+
+/* Compteur des tâches en cours d'un ordonnanceur, réparti par thread
+ *
+ * Chaque thread compte les tâches qu'il crée dans sa propre case, qui ne
+ * touche le compteur global que lorsqu'elle passe de 0 à 1 ou de 1 à 0.
+ * Le compteur global est donc nul exactement quand plus aucune tâche n'est
+ * en attente ou en cours d'exécution, à condition que :
+ * - une case ne soit incrémentée que par son thread (ou par le thread qui
+ *   lance l'ordonnanceur, via la case -1 qui est le compteur global)
+ * - une tâche soit comptée avant d'être visible des autres threads
+ * - une tâche ne soit décomptée qu'une fois terminée, dans la case où
+ *   elle a été comptée */
+struct quiescence;
+
+/* Crée un compteur avec nleaves cases
+ *
+ * Renvoie NULL en cas d'échec d'allocation */
+struct quiescence *quiescence_new(int nleaves);
+
+/* Libère le compteur */
+void quiescence_free(struct quiescence *);
+
+/* Compte une nouvelle tâche dans la case leaf (-1 pour le compteur global) */
+void quiescence_arrive(struct quiescence *, int leaf);
+
+/* Décompte une tâche terminée de la case leaf
+ *
+ * Renvoie 1 si c'était la dernière tâche en cours, 0 sinon */
+int quiescence_depart(struct quiescence *, int leaf);
+
+/* Renvoie 1 si plus aucune tâche n'est en cours */
+int quiescence_done(struct quiescence *);
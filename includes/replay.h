@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdint.h>
+
+/* Enregistrement et rejeu des décisions d'un ordonnanceur
+ *
+ * Chaque tâche reçoit un identifiant qui ne dépend que de sa place dans
+ * l'arbre des tâches (celui de sa mère et son rang parmi ses sœurs) : il est
+ * le même d'une exécution à l'autre tant que le programme crée les mêmes
+ * tâches. Avec SCHED_RECORD=préfixe, chaque thread note les tâches qu'il
+ * exécute, d'où il les a prises et ses mises en sommeil, et les journaux sont
+ * écrits à la fin dans préfixe.<exécution>.<thread>, l'exécution comptant les
+ * appels à sched_init du processus. Avec SCHED_REPLAY=préfixe, ces journaux
+ * sont relus pour redonner chaque tâche au thread qui l'avait exécutée, dans
+ * le même ordre.
+ *
+ * Les fonctions d'enregistrement acceptent NULL et ne font alors rien. */
+struct record;
+struct replay;
+
+/* Origine d'une tâche dans le journal, en plus de l'index du thread à qui
+ * elle a été prise (le sien pour une tâche de son deque) */
+enum {
+    /* Prise dans la file d'injection */
+    RECORD_INJECT = -1,
+
+    /* Pas une tâche : le thread s'est endormi */
+    RECORD_SLEEP = -2,
+};
+
+/* Renvoie l'identifiant de la rank-ième fille (à partir de 1) de la tâche
+ * parent, 0 pour les tâches créées hors des tâches. Jamais 0 */
+uint64_t record_task_id(uint64_t parent, uint64_t rank);
+
+/* Renvoie 1 si l'enregistrement est demandé (variable SCHED_RECORD) */
+int record_enabled(void);
+
+/* Crée les journaux vides de nthreads threads pour l'exécution run
+ *
+ * Renvoie NULL en cas d'échec */
+struct record *record_new(int nthreads, int run);
+
+/* Ajoute au journal du thread th, qui est le seul à y écrire, l'exécution
+ * de la tâche id prise chez from, ou une mise en sommeil */
+void record_add(struct record *, int th, uint64_t id, int from);
+
+/* Écrit les journaux dans leurs fichiers, chacun précédé d'un en-tête
+ * commun à cet enregistrement, et supprime ceux des threads en trop d'un
+ * enregistrement précédent avec le même préfixe
+ *
+ * Renvoie -1 en cas d'échec */
+int record_write(struct record *);
+
+/* Libère les journaux */
+void record_free(struct record *);
+
+/* Renvoie 1 si le rejeu est demandé (variable SCHED_REPLAY) */
+int replay_enabled(void);
+
+/* Lit les journaux de l'exécution run, qui doivent venir d'une exécution
+ * avec nthreads threads et tous du même enregistrement (d'après leurs
+ * en-têtes)
+ *
+ * Renvoie NULL en cas d'échec */
+struct replay *replay_load(int nthreads, int run);
+
+/* Renvoie le nombre de tâches exécutées par le thread th dans le journal */
+int replay_length(struct replay *, int th);
+
+/* Cherche la tâche id dans les journaux et range dans th le thread qui doit
+ * l'exécuter. Peut être appelée par plusieurs threads à la fois
+ *
+ * Renvoie la position de la tâche dans le journal de ce thread, -1 si elle
+ * n'est dans aucun journal ou a déjà été placée (le programme a changé) */
+int replay_place(struct replay *, uint64_t id, int *th);
+
+/* Libère les journaux */
+void replay_free(struct replay *);
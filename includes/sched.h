@@ -1,17 +1,59 @@
 #pragma once
 
-#include <unistd.h>
-
 struct scheduler;
 
 typedef void (*taskfunc)(void *, struct scheduler *);
 
-/* Renvoie le nombre de coeurs disponible. */
-static inline int
-sched_default_threads(void)
-{
-    return sysconf(_SC_NPROCESSORS_ONLN);
-}
+/* Niveaux de priorité d'une tâche */
+enum sched_priority {
+    /* Tâche sensible à la latence, passe avant toutes les autres */
+    SCHED_PRIO_HIGH,
+
+    /* Priorité par défaut */
+    SCHED_PRIO_NORMAL,
+
+    /* Tâche de fond, exécutée quand il n'y a rien d'autre */
+    SCHED_PRIO_LOW,
+
+    SCHED_NPRIO
+};
+
+/* Jeton d'annulation d'un sous-arbre de tâches */
+struct sched_token;
+
+/* Compteur de tâches à attendre */
+struct sched_join;
+
+/* Aucun thread préféré */
+#define SCHED_ANY_WORKER -1
+
+/* Options d'une tâche, ce sont des indications que l'ordonnanceur peut
+ * ignorer */
+struct sched_attr {
+    /* Priorité de la tâche */
+    enum sched_priority priority;
+
+    /* Thread, dans [0, sched_nthreads(s)[, près duquel lancer la tâche
+     * (par exemple celui qui a ses données en cache), ou SCHED_ANY_WORKER */
+    int worker;
+
+    /* Jeton d'annulation de la tâche, NULL pour celui de la tâche qui la
+     * crée */
+    struct sched_token *token;
+
+    /* Appelée à la place de f, avec la même closure, si la tâche est annulée
+     * avant d'avoir démarré (voir sched_token_new), NULL si rien n'est à
+     * libérer. Contrairement aux autres options, elle n'est jamais ignorée */
+    taskfunc cancel;
+};
+
+/* Options par défaut, équivalentes à sched_spawn */
+#define SCHED_ATTR_DEFAULT {SCHED_PRIO_NORMAL, SCHED_ANY_WORKER, NULL, NULL}
+
+/* Renvoie le nombre de coeurs disponible : ceux sur lesquels le processus
+ * peut tourner (sched_getaffinity), limité par le quota CPU de son cgroup
+ * (cpu.max en v2, cpu.cfs_quota_us en v1) */
+int sched_default_threads(void);
 
 /* Lance l'ordonnanceur
  * - nthreads : nombre de threads créer par l'ordonnanceur.
@@ -33,3 +75,83 @@ int sched_init(int nthreads, int qlen, taskfunc f, void *closure);
  * l'ordonanceur
  */
 int sched_spawn(taskfunc f, void *closure, struct scheduler *s);
+
+/* Comme sched_spawn, avec les options attr (NULL pour celles par défaut)
+ *
+ * L'ordonnanceur work-stealing exécute les tâches de plus haute priorité en
+ * premier, chez lui comme chez les autres, et place une tâche avec un thread
+ * préféré dans le deque de ce thread (d'où elle peut toujours être volée).
+ * Sans thread préféré, une tâche créée hors de ses threads passe par une file
+ * d'injection commune, sauf en haute priorité.
+ * Les autres ordonnanceurs ignorent ce qu'ils ne savent pas gérer */
+int sched_spawn_attr(taskfunc f, void *closure, const struct sched_attr *attr,
+                     struct scheduler *s);
+
+/* Renvoie le nombre de threads de l'ordonnanceur (s) */
+int sched_nthreads(struct scheduler *s);
+
+/* Renvoie le nom de l'ordonnanceur compilé (cible du makefile) */
+const char *sched_name(void);
+
+/* Renvoie l'index, dans [0, sched_nthreads(s)[, du thread courant au sein de
+ * l'ordonnanceur (s), -1 si le thread courant n'en fait pas partie */
+int sched_self(struct scheduler *s);
+
+/* Crée un jeton d'annulation, annulé en même temps que parent (peut être
+ * NULL)
+ *
+ * Une tâche créée avec un jeton le transmet à toutes les tâches qu'elle crée
+ * (sauf jeton explicite), ce qui forme un sous-arbre. Une fois le jeton
+ * annulé, les tâches de ce sous-arbre ne sont plus ajoutées par sched_spawn,
+ * et celles en attente sont retirées sans être exécutées. Une tâche en cours
+ * n'est pas interrompue, mais peut tester sched_token_cancelled.
+ *
+ * Une tâche ainsi écartée n'est pas perdue pour autant : la fonction cancel
+ * de ses options est appelée à sa place, avec le jeton de la tâche comme
+ * jeton courant, pour libérer sa closure (sans cancel, la closure n'est
+ * jamais vue). parallel_for, parallel_reduce et les graphes de tâches s'en
+ * servent pour se terminer quand même : leur fonction de fin est appelée et
+ * peut tester sched_token_cancelled(sched_token_current()).
+ *
+ * Renvoie NULL en cas d'échec d'allocation */
+struct sched_token *sched_token_new(struct sched_token *parent);
+
+/* Annule le jeton et ceux qui en dépendent */
+void sched_token_cancel(struct sched_token *token);
+
+/* Renvoie 1 si le jeton ou un de ses parents est annulé, 0 sinon (et pour
+ * NULL) */
+int sched_token_cancelled(const struct sched_token *token);
+
+/* Renvoie le jeton de la tâche en cours d'exécution, NULL si aucun */
+struct sched_token *sched_token_current(void);
+
+/* Libère le jeton, une fois que plus aucune tâche ne l'utilise */
+void sched_token_free(struct sched_token *token);
+
+/* Compteur de tâches à attendre, pour qu'une tâche attende ses filles
+ *
+ * Avec les fibers (ordonnanceur work-stealing et variable SCHED_FIBERS), une
+ * tâche qui attend rend son thread à d'autres tâches et reprend plus tard,
+ * peut-être sur un autre thread. Sinon elle bloque son thread : les tâches
+ * attendues doivent alors pouvoir s'exécuter sur d'autres threads.
+ *
+ * Renvoie NULL en cas d'échec d'allocation */
+struct sched_join *sched_join_new(int count);
+
+/* Signale qu'une des tâches attendues est terminée */
+void sched_join_done(struct sched_join *join);
+
+/* Attend que sched_join_done ait été appelée count fois */
+void sched_join_wait(struct sched_join *join);
+
+/* Libère le compteur, une fois que plus personne ne l'attend */
+void sched_join_free(struct sched_join *join);
+
+/* Attend que le descripteur fd (tube, socket, eventfd...) soit prêt pour
+ * events (POLLIN, POLLOUT), en rendant le thread à d'autres tâches avec les
+ * fibers. Un fichier ordinaire est toujours prêt. Un même descripteur ne peut
+ * être attendu que par une tâche à la fois.
+ *
+ * Renvoie les événements reçus (comme poll), -1 en cas d'erreur */
+int sched_wait_fd(int fd, int events);
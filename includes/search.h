@@ -0,0 +1,10 @@
+#pragma once
+
+/* Lance le benchmark de recherche parallèle : trouver l'unique candidat dont
+ * l'empreinte vaut une valeur donnée, en découpant l'espace en un arbre de
+ * tâches. Il est lancé sans puis avec annulation de l'arbre dès que la
+ * réponse est trouvée, et affiche le temps jusqu'à la réponse, le temps
+ * total et le nombre de candidats évalués
+ *
+ * Renvoie le temps d'exécution total */
+double benchmark_search(int nthreads, int qlen);
@@ -0,0 +1,10 @@
+#pragma once
+
+/* Lance le benchmark de soumission : 1, 2, 4... producteurs, des threads qui
+ * ne font pas partie de l'ordonnanceur, créent en continu des tâches
+ * indépendantes pendant qu'il tourne, et affiche le débit ainsi que la part
+ * des tâches exécutées par le thread le plus chargé
+ *
+ * Nécessite au moins 2 threads, une tâche attendant les producteurs, renvoie
+ * le temps d'exécution total */
+double benchmark_submit(int nthreads, int qlen);
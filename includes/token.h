@@ -0,0 +1,25 @@
+#pragma once
+
+#include "sched.h"
+
+/* Fonctions communes aux ordonnanceurs pour gérer les jetons d'annulation */
+
+/* Jeton d'une nouvelle tâche : celui de attr s'il y en a un, sinon celui de
+ * la tâche courante */
+struct sched_token *sched_token_inherit(const struct sched_attr *attr);
+
+/* Exécute f(closure, s) avec token comme jeton courant, ou cancel (peut être
+ * NULL) à sa place si le jeton est annulé
+ *
+ * Renvoie 0 si f n'a pas été exécutée, 1 sinon */
+int sched_token_run(taskfunc f, taskfunc cancel, void *closure,
+                    struct sched_token *token, struct scheduler *s);
+
+/* Appelle cancel(closure, s) (si cancel n'est pas NULL) avec token comme
+ * jeton courant, pour une tâche annulée qui ne sera pas exécutée */
+void sched_token_drop(taskfunc cancel, void *closure,
+                      struct sched_token *token, struct scheduler *s);
+
+/* Remplace le jeton courant du thread par token et renvoie l'ancien, pour
+ * une tâche qui change de thread en cours d'exécution (fibers) */
+struct sched_token *sched_token_swap(struct sched_token *token);
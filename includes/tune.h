@@ -0,0 +1,36 @@
+#pragma once
+
+/* Réglage de la granularité des tâches et de la taille des files
+ *
+ * Les réglages par défaut sont ceux d'origine. tune_run en cherche de
+ * meilleurs par quelques essais courts de quicksort et de mandelbrot, et les
+ * garde dans un fichier local (variable SCHED_TUNE_FILE, ordonnanceur.tune
+ * par défaut), par modèle de CPU, nombre de cœurs, ordonnanceur et nombre de
+ * threads. tune_load les y retrouve lors des exécutions suivantes. */
+struct tuning {
+    /* Taille en dessous de laquelle quicksort trie en série */
+    int cutoff;
+
+    /* Côté des morceaux de pixels de mandelbrot */
+    int chunk;
+
+    /* Diviseurs de la taille des files par défaut (qlen) : un morceau à
+     * trier par tâche pour quicksort, un pixel par tâche pour mandelbrot */
+    int quicksort_qlen;
+    int mandelbrot_qlen;
+};
+
+/* Réglages en cours */
+extern struct tuning tuning;
+
+/* Charge les réglages enregistrés pour nthreads threads (0 pour un par
+ * cœur) sur cette machine avec cet ordonnanceur
+ *
+ * Renvoie 1 s'ils ont été trouvés, 0 sinon */
+int tune_load(int nthreads);
+
+/* Cherche les meilleurs réglages pour nthreads threads (0 pour un par cœur),
+ * les enregistre et les garde dans tuning
+ *
+ * Renvoie -1 en cas d'échec */
+int tune_run(int nthreads);
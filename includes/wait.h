@@ -0,0 +1,13 @@
+#pragma once
+
+/* Lance le benchmark des attentes : des tâches attendent chacune une donnée
+ * sur un tube, écrite par un autre thread à intervalle régulier, pendant que
+ * des tâches de calcul occupent tous les threads et qu'une dernière tâche
+ * attend la fin de toutes les autres avec sched_join_wait
+ *
+ * Avec les fibers (SCHED_FIBERS=1), les tâches qui attendent rendent leur
+ * thread au calcul. Affiche le temps total, comparé à celui sans attente, et
+ * le délai entre l'écriture d'une donnée et sa lecture
+ *
+ * Nécessite au moins 2 threads, renvoie le temps d'exécution total */
+double benchmark_wait(int nthreads, int qlen);
@@ -0,0 +1,8 @@
+#pragma once
+
+/* Lance le benchmark avec l'alignement de Smith-Waterman, calculé par
+ * blocs sous forme de graphe de tâches (chaque bloc dépend de ceux au dessus
+ * et à gauche)
+ *
+ * Renvoie le temps d'exécution */
+double benchmark_wavefront(int, int, int);
@@ -0,0 +1,517 @@
+#include "../includes/animation.h"
+#include "../includes/hugepage.h"
+#include "../includes/kernels.h"
+#include "../includes/mandelbrot.h"
+#include "../includes/parallel.h"
+#include "../includes/sched.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* Taille des images */
+#define WIDTH 1920
+#define HEIGHT 1080
+#define CHUNK_SIZE 8
+
+/* Pixels calculés à la fois par le noyau */
+#define ROW_BLOCK 64
+
+/* Grossissement d'une image à la suivante */
+#define RATIO 1.05
+
+/* Images calculées en même temps par le pipeline. L'image k reprend les
+ * pixels de l'image k - INFLIGHT, la dernière qui est sûre d'être terminée
+ * quand elle commence (la première image pour les INFLIGHT premières) */
+#define INFLIGHT 3
+
+/* Images gardées en mémoire : une image libère sa place une fois écrite et
+ * reprise par l'image suivante qui en dépend */
+#define SLOTS (2 * INFLIGHT)
+
+/* Écart maximum, en pixels, entre la position d'un pixel et celle du pixel
+ * d'une image précédente repris à sa place. En dessous d'un demi-pixel, un
+ * pixel d'une image précédente est repris au plus une fois */
+#define REUSE_TOLERANCE 0.5
+
+/* Point vers lequel l'animation zoome */
+#define CENTER_RE -0.7436438870371587
+#define CENTER_IM 0.13182590420531198
+
+enum frame_state {
+    FRAME_PENDING,
+    FRAME_RUNNING,
+    FRAME_DONE,
+    FRAME_WRITTEN,
+};
+
+struct animation;
+
+struct frame {
+    struct animation *anim;
+    int index;
+
+    /* Nombre d'itérations de chaque pixel */
+    unsigned short *counts;
+
+    /* Position de chaque colonne et de chaque ligne : celle du pixel repris
+     * s'il y en a un, la position exacte sinon */
+    double re[WIDTH];
+    double im[HEIGHT];
+
+    /* Colonne et ligne de source reprises à la place de chaque colonne et de
+     * chaque ligne, -1 si aucune */
+    int colsrc[WIDTH];
+    int rowsrc[HEIGHT];
+
+    /* Image reprise, NULL si aucune */
+    struct frame *src;
+
+    /* Noyau de calcul des pixels qui ne sont pas repris */
+    enum mandel_kernel kernel;
+
+    /* Pixels repris */
+    atomic_long reused;
+};
+
+struct animation {
+    struct frame slots[SLOTS];
+    int frames;
+
+    /* Images en cours en même temps, la source de l'image k est
+     * k - inflight */
+    int inflight;
+
+    pthread_mutex_t mutex;
+    enum frame_state *state;
+
+    /* Noyau demandé, KERNEL_AUTO pour le choisir pour chaque image */
+    enum mandel_kernel kernel;
+
+    /* Prochaine image à lancer et à écrire */
+    int next_start;
+    int next_write;
+
+    /* Nombre de premières images toutes terminées */
+    int done;
+
+    /* 1 si une tâche d'écriture est en cours */
+    int writing;
+
+    /* Image convertie en couleurs par l'écriture, et sa destination */
+    unsigned char *rgb;
+    FILE *out;
+
+    long reused;
+};
+
+static double
+now(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+/* Ajoute une tâche, en réessayant tant que l'ordonnanceur est plein */
+static void
+spawn(taskfunc f, void *closure, struct scheduler *s)
+{
+    int rc;
+
+    while((rc = sched_spawn(f, closure, s)) < 0) {
+        if(errno != EAGAIN) {
+            break;
+        }
+    }
+    assert(rc >= 0);
+}
+
+/* Place les n pixels d'une ligne ou d'une colonne, centrée sur center à
+ * scale pixels par unité : chacun reprend la position de src (croissantes)
+ * la plus proche si elle est à moins de REUSE_TOLERANCE pixels */
+static void
+reproject(double center, int n, double scale, const double *src,
+          double *pos, int *map)
+{
+    int j = 0;
+
+    for(int i = 0; i < n; ++i) {
+        double ideal = center + (i - n / 2) / scale;
+
+        while(src && j + 1 < n &&
+              fabs(src[j + 1] - ideal) <= fabs(src[j] - ideal)) {
+            j++;
+        }
+
+        if(src && fabs(src[j] - ideal) * scale < REUSE_TOLERANCE) {
+            pos[i] = src[j];
+            map[i] = j;
+        } else {
+            pos[i] = ideal;
+            map[i] = -1;
+        }
+    }
+}
+
+/* Prépare l'image k, qui reprend les pixels de src (peut être NULL) */
+static void
+frame_prepare(struct frame *f, int k, struct frame *src)
+{
+    double scale = WIDTH / 4.0 * pow(RATIO, k);
+
+    // Précision choisie d'après l'écart entre deux pixels de l'image, qui
+    // diminue à chaque image
+    f->kernel = f->anim->kernel;
+    if(f->kernel == KERNEL_AUTO) {
+        f->kernel = kernel_select(1 / scale,
+                                  fabs(CENTER_RE) + WIDTH / 2 / scale);
+    }
+    f->index = k;
+    f->src = src;
+    atomic_store(&f->reused, 0);
+    reproject(CENTER_RE, WIDTH, scale, src ? src->re : NULL, f->re,
+              f->colsrc);
+    reproject(CENTER_IM, HEIGHT, scale, src ? src->im : NULL, f->im,
+              f->rowsrc);
+}
+
+void
+frame_tile(int start_x, int start_y, int end_x, int end_y, void *arg,
+           struct scheduler *s)
+{
+    struct frame *f = (struct frame *)arg;
+    long reused = 0;
+    double re[ROW_BLOCK];
+    int xs[ROW_BLOCK], counts[ROW_BLOCK];
+
+    (void)s;
+
+    for(int y = start_y; y < end_y; y++) {
+        int sy = f->rowsrc[y];
+
+        // Les pixels à calculer sont rassemblés par blocs pour le noyau
+        for(int x = start_x; x < end_x;) {
+            int n = 0;
+
+            for(; x < end_x && n < ROW_BLOCK; x++) {
+                int sx = f->colsrc[x];
+
+                if(sx >= 0 && sy >= 0) {
+                    f->counts[y * WIDTH + x] =
+                        f->src->counts[sy * WIDTH + sx];
+                    reused++;
+                } else {
+                    xs[n] = x;
+                    re[n++] = f->re[x];
+                }
+            }
+            kernel_row(f->kernel, re, f->im[y], n, MANDEL_ITERATIONS, counts);
+
+            for(int i = 0; i < n; i++) {
+                f->counts[y * WIDTH + xs[i]] = counts[i];
+            }
+        }
+    }
+
+    atomic_fetch_add_explicit(&f->reused, reused, memory_order_relaxed);
+}
+
+/* Convertit l'image en couleurs et l'écrit si une destination est donnée */
+static void
+frame_write(struct animation *a, struct frame *f)
+{
+    for(int i = 0; i < WIDTH * HEIGHT; ++i) {
+        unsigned int rgb = torgb(f->counts[i]);
+
+        a->rgb[3 * i] = rgb >> 16;
+        a->rgb[3 * i + 1] = rgb >> 8;
+        a->rgb[3 * i + 2] = rgb;
+    }
+
+    if(a->out) {
+        fprintf(a->out, "P6\n%d %d\n255\n", WIDTH, HEIGHT);
+        if(fwrite(a->rgb, 3, WIDTH * HEIGHT, a->out) != WIDTH * HEIGHT) {
+            perror("Frame write");
+        }
+    }
+
+    a->reused += atomic_load(&f->reused);
+}
+
+void frame_root(void *closure, struct scheduler *s);
+void frame_writer(void *closure, struct scheduler *s);
+
+/* Lance les images dont la source est terminée et dont la place est libre,
+ * et l'écriture si la prochaine image à écrire est terminée
+ *
+ * Appelée avec le mutex, les tâches sont créées après l'avoir relâché pour
+ * ne pas le garder si l'ordonnanceur est plein */
+static int
+advance(struct animation *a, struct frame **start, int *write)
+{
+    int n = 0;
+
+    while(a->next_start < a->frames) {
+        int k = a->next_start;
+        // Les premières images reprennent la première
+        int source = k == 0 ? -1 : k < a->inflight ? 0 : k - a->inflight;
+
+        // Les images qui reprennent l'ancien occupant de la place sont
+        // avant la source et doivent aussi être terminées
+        if(source >= a->done) {
+            break;
+        }
+        if(k >= SLOTS && a->state[k - SLOTS] < FRAME_WRITTEN) {
+            break;
+        }
+
+        frame_prepare(&a->slots[k % SLOTS], k,
+                      source >= 0 ? &a->slots[source % SLOTS] : NULL);
+        a->state[k] = FRAME_RUNNING;
+        start[n++] = &a->slots[k % SLOTS];
+        a->next_start++;
+    }
+
+    *write = !a->writing && a->next_write < a->frames &&
+             a->state[a->next_write] == FRAME_DONE;
+    if(*write) {
+        a->writing = 1;
+    }
+
+    return n;
+}
+
+/* Appelle advance et crée les tâches qu'elle demande */
+static void
+advance_spawn(struct animation *a, struct scheduler *s)
+{
+    struct frame *start[SLOTS];
+    int n, write;
+
+    pthread_mutex_lock(&a->mutex);
+    n = advance(a, start, &write);
+    pthread_mutex_unlock(&a->mutex);
+
+    for(int i = 0; i < n; ++i) {
+        spawn(frame_root, start[i], s);
+    }
+    if(write) {
+        spawn(frame_writer, a, s);
+    }
+}
+
+void
+frame_done(void *arg, struct scheduler *s)
+{
+    struct frame *f = (struct frame *)arg;
+    struct animation *a = f->anim;
+
+    pthread_mutex_lock(&a->mutex);
+    a->state[f->index] = FRAME_DONE;
+    while(a->done < a->frames && a->state[a->done] >= FRAME_DONE) {
+        a->done++;
+    }
+    pthread_mutex_unlock(&a->mutex);
+
+    advance_spawn(a, s);
+}
+
+/* Image du pipeline, frame_done fait avancer le pipeline */
+void
+frame_root(void *closure, struct scheduler *s)
+{
+    int rc = parallel_for_2d(0, 0, WIDTH, HEIGHT, CHUNK_SIZE, CHUNK_SIZE,
+                             frame_tile, frame_done, closure, s);
+    assert(rc >= 0);
+}
+
+/* Image calculée seule */
+void
+frame_alone_root(void *closure, struct scheduler *s)
+{
+    int rc = parallel_for_2d(0, 0, WIDTH, HEIGHT, CHUNK_SIZE, CHUNK_SIZE,
+                             frame_tile, NULL, closure, s);
+    assert(rc >= 0);
+}
+
+/* Écrit, dans l'ordre, toutes les images terminées qui suivent la dernière
+ * écrite */
+void
+frame_writer(void *closure, struct scheduler *s)
+{
+    struct animation *a = (struct animation *)closure;
+
+    pthread_mutex_lock(&a->mutex);
+    while(a->next_write < a->frames &&
+          a->state[a->next_write] == FRAME_DONE) {
+        int k = a->next_write;
+
+        // Personne d'autre n'écrit, ni ne réutilise la place de l'image
+        pthread_mutex_unlock(&a->mutex);
+        frame_write(a, &a->slots[k % SLOTS]);
+        pthread_mutex_lock(&a->mutex);
+
+        a->state[k] = FRAME_WRITTEN;
+        a->next_write++;
+    }
+    a->writing = 0;
+    pthread_mutex_unlock(&a->mutex);
+
+    advance_spawn(a, s);
+}
+
+void
+animation_root(void *closure, struct scheduler *s)
+{
+    advance_spawn((struct animation *)closure, s);
+}
+
+/* Calcule et écrit les images une par une, chacune reprenant la précédente
+ *
+ * Renvoie le temps d'exécution */
+static double
+run_one_by_one(struct animation *a, int serial, int nthreads, int qlen)
+{
+    double begin = now();
+    int rc;
+
+    for(int k = 0; k < a->frames; ++k) {
+        struct frame *f = &a->slots[k % 2];
+
+        frame_prepare(f, k, k > 0 ? &a->slots[(k - 1) % 2] : NULL);
+
+        if(serial) {
+            frame_tile(0, 0, WIDTH, HEIGHT, f, NULL);
+        } else {
+            rc = sched_init(nthreads, qlen, frame_alone_root, f);
+            assert(rc >= 0);
+        }
+
+        frame_write(a, f);
+    }
+
+    return now() - begin;
+}
+
+/* Calcule les images avec a->inflight images en cours en même temps, dans un
+ * seul ordonnanceur
+ *
+ * Renvoie le temps d'exécution */
+static double
+run_pipeline(struct animation *a, int nthreads, int qlen)
+{
+    double begin = now();
+    int rc;
+
+    a->next_start = a->next_write = a->done = a->writing = 0;
+    for(int k = 0; k < a->frames; ++k) {
+        a->state[k] = FRAME_PENDING;
+    }
+
+    rc = sched_init(nthreads, qlen, animation_root, a);
+    assert(rc >= 0);
+    assert(a->next_write == a->frames);
+
+    return now() - begin;
+}
+
+/* Ouvre la destination des images, stdout n'est pas utilisée pour ne pas
+ * mélanger les images et les résultats */
+static int
+open_output(struct animation *a, const char *output)
+{
+    if(a->out) {
+        fclose(a->out);
+        a->out = NULL;
+    }
+    if(output && !(a->out = fopen(output, "wb"))) {
+        perror(output);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void
+print_run(const char *name, struct animation *a, double delay)
+{
+    printf(" %-12s : %6.2f images/s, %5.1f %% des pixels repris\n", name,
+           a->frames / delay,
+           100.0 * a->reused / ((double)a->frames * WIDTH * HEIGHT));
+}
+
+double
+benchmark_animation(int serial, int nthreads, int qlen, int frames,
+                    const char *output, enum mandel_kernel kernel)
+{
+    struct animation a = {0};
+    size_t size = WIDTH * HEIGHT * sizeof(unsigned short);
+    double delay = -1;
+
+    // Chaque image découpée jusqu'à un pixel, comme pour une seule image
+    if(qlen <= 0) {
+        qlen = INFLIGHT * WIDTH * HEIGHT;
+    }
+
+    a.frames = frames;
+    a.kernel = kernel;
+    a.state = malloc(frames * sizeof(enum frame_state));
+    a.rgb = malloc(3 * WIDTH * HEIGHT);
+    if(!a.state || !a.rgb || pthread_mutex_init(&a.mutex, NULL) != 0) {
+        perror("Animation allocation");
+        free(a.state);
+        free(a.rgb);
+        return -1;
+    }
+
+    for(int i = 0; i < SLOTS; ++i) {
+        a.slots[i].anim = &a;
+        if(!(a.slots[i].counts = huge_alloc(size))) {
+            perror("Frame allocation");
+            goto out;
+        }
+    }
+
+    printf("Animation de %d images %dx%d, grossies de %.2f à chaque image\n",
+           frames, WIDTH, HEIGHT, RATIO);
+    printf("Noyau %s\n", kernel == KERNEL_AUTO ? "choisi pour chaque image"
+                                                : kernel_name(kernel));
+
+    if(open_output(&a, output) < 0) {
+        goto out;
+    }
+    a.inflight = 1;
+    a.reused = 0;
+    delay = run_one_by_one(&a, serial, nthreads, qlen);
+    print_run("une par une", &a, delay);
+
+    if(!serial) {
+        if(open_output(&a, output) < 0) {
+            delay = -1;
+            goto out;
+        }
+        a.inflight = INFLIGHT;
+        a.reused = 0;
+        delay = run_pipeline(&a, nthreads, qlen);
+        print_run("pipeline", &a, delay);
+    }
+
+out:
+    if(a.out) {
+        fclose(a.out);
+    }
+    for(int i = 0; i < SLOTS; ++i) {
+        huge_free(a.slots[i].counts);
+    }
+    pthread_mutex_destroy(&a.mutex);
+    free(a.state);
+    free(a.rgb);
+    return delay;
+}
@@ -0,0 +1,201 @@
+#define _GNU_SOURCE
+
+#include "../includes/sched.h"
+
+#include <limits.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Racines possibles des hiérarchies cgroup v2 (unifiée) et v1 (contrôleur
+ * cpu) */
+static const char *cgroup2_roots[] = {"/sys/fs/cgroup",
+                                      "/sys/fs/cgroup/unified"};
+static const char *cgroup1_roots[] = {"/sys/fs/cgroup/cpu",
+                                      "/sys/fs/cgroup/cpu,cpuacct"};
+
+#define NROOTS(roots) (int)(sizeof(roots) / sizeof(roots[0]))
+
+/* Nombre de cœurs sur lesquels le processus a le droit de tourner */
+static int
+affinity_cpus(void)
+{
+    int ncpus = sysconf(_SC_NPROCESSORS_CONF);
+    int count = -1;
+    cpu_set_t *set;
+    size_t size;
+
+    // Taille dynamique, pour les machines de plus de CPU_SETSIZE cœurs
+    for(; ncpus > 0 && count < 0; ncpus *= 2) {
+        if(!(set = CPU_ALLOC(ncpus))) {
+            break;
+        }
+        size = CPU_ALLOC_SIZE(ncpus);
+
+        if(sched_getaffinity(0, size, set) == 0) {
+            count = CPU_COUNT_S(size, set);
+        }
+        CPU_FREE(set);
+    }
+
+    return count;
+}
+
+/* Chemin du cgroup du processus pour le contrôleur controller ("" pour la
+ * hiérarchie unifiée), lu dans /proc/self/cgroup */
+static int
+cgroup_path(const char *controller, char *path, size_t size)
+{
+    char line[4096];
+    int found = 0;
+    FILE *f;
+
+    if(!(f = fopen("/proc/self/cgroup", "r"))) {
+        return 0;
+    }
+
+    // Lignes de la forme "id:contrôleur,contrôleur:/chemin"
+    while(!found && fgets(line, sizeof(line), f)) {
+        char *list = strchr(line, ':'), *cgroup;
+
+        if(!list || !(cgroup = strchr(++list, ':'))) {
+            continue;
+        }
+        *cgroup++ = '\0';
+        cgroup[strcspn(cgroup, "\n")] = '\0';
+
+        if(*controller == '\0') {
+            found = *list == '\0';
+        } else {
+            for(char *c = strtok(list, ","); c && !found;
+                c = strtok(NULL, ",")) {
+                found = strcmp(c, controller) == 0;
+            }
+        }
+
+        if(found) {
+            snprintf(path, size, "%s", cgroup);
+        }
+    }
+
+    fclose(f);
+    return found;
+}
+
+/* Ouvre le fichier name du dossier dir
+ *
+ * Renvoie NULL s'il n'existe pas ou si son chemin est trop long, ce qui
+ * revient à ne pas avoir de limite */
+static FILE *
+open_in(const char *dir, const char *name)
+{
+    char file[PATH_MAX];
+
+    if(snprintf(file, sizeof(file), "%s/%s", dir, name) >=
+       (int)sizeof(file)) {
+        return NULL;
+    }
+
+    return fopen(file, "r");
+}
+
+/* Lit le quota et la période dans dir, renvoie le nombre de cœurs qu'ils
+ * permettent (arrondi au supérieur), -1 si pas de limite */
+static int
+quota_cpus(const char *dir, int v2)
+{
+    char quota[32];
+    long long q = -1, period = 0;
+    FILE *f;
+
+    if(v2) {
+        // cpu.max : "quota période" ou "max période"
+        if(!(f = open_in(dir, "cpu.max"))) {
+            return -1;
+        }
+        if(fscanf(f, "%31s %lld", quota, &period) == 2 &&
+           strcmp(quota, "max") != 0) {
+            sscanf(quota, "%lld", &q);
+        }
+        fclose(f);
+    } else {
+        if(!(f = open_in(dir, "cpu.cfs_quota_us"))) {
+            return -1;
+        }
+        if(fscanf(f, "%lld", &q) != 1) {
+            q = -1;
+        }
+        fclose(f);
+
+        if(!(f = open_in(dir, "cpu.cfs_period_us"))) {
+            return -1;
+        }
+        if(fscanf(f, "%lld", &period) != 1) {
+            period = 0;
+        }
+        fclose(f);
+    }
+
+    if(q <= 0 || period <= 0) {
+        return -1;
+    }
+
+    return (q + period - 1) / period;
+}
+
+/* Plus petite limite de cœurs imposée par le cgroup du processus ou un de
+ * ses parents, -1 si aucune */
+static int
+cgroup_cpus(void)
+{
+    char path[PATH_MAX], dir[PATH_MAX];
+    int best = -1;
+
+    for(int v2 = 1; v2 >= 0; --v2) {
+        const char **roots = v2 ? cgroup2_roots : cgroup1_roots;
+        int nroots = v2 ? NROOTS(cgroup2_roots) : NROOTS(cgroup1_roots);
+
+        if(!cgroup_path(v2 ? "" : "cpu", path, sizeof(path))) {
+            continue;
+        }
+
+        // Remonte jusqu'à la racine : dans un conteneur le chemin peut ne
+        // pas exister, sa hiérarchie étant montée à la racine
+        for(char *end = path + strlen(path); end; end = strrchr(path, '/')) {
+            *end = '\0';
+
+            for(int r = 0; r < nroots; ++r) {
+                int cpus;
+
+                // Chemin trop long : pas de limite
+                if(snprintf(dir, sizeof(dir), "%s%s", roots[r], path) >=
+                   (int)sizeof(dir)) {
+                    continue;
+                }
+                if((cpus = quota_cpus(dir, v2)) > 0 &&
+                   (best < 0 || cpus < best)) {
+                    best = cpus;
+                }
+            }
+        }
+    }
+
+    return best;
+}
+
+int
+sched_default_threads(void)
+{
+    int cpus = affinity_cpus();
+    int quota = cgroup_cpus();
+
+    if(cpus <= 0) {
+        cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if(quota > 0 && quota < cpus) {
+        cpus = quota;
+    }
+
+    return cpus > 0 ? cpus : 1;
+}
@@ -0,0 +1,246 @@
+#include "../includes/dag.h"
+#include "../includes/sched.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+struct dag_node {
+    /* Tâche */
+    taskfunc f;
+    void *closure;
+
+    /* Graphe contenant la tâche */
+    struct dag *dag;
+
+    /* Nombre de dépendances */
+    int npred;
+
+    /* Dépendances pas encore terminées */
+    atomic_int pending;
+
+    /* Tâches dépendant de celle-ci */
+    struct dag_node **succ;
+    int nsucc;
+    int capsucc;
+
+    /* Tâche suivante parmi celles prêtes que l'ordonnanceur plein n'a pas
+     * acceptées et que dag_run exécute lui-même */
+    struct dag_node *next;
+};
+
+struct dag {
+    /* Tâches du graphe */
+    struct dag_node **nodes;
+    int nnodes;
+    int capnodes;
+
+    /* Tâches pas encore terminées */
+    atomic_int remaining;
+
+    /* Fin du graphe */
+    dag_done done;
+    void *arg;
+};
+
+/* Exécute une tâche du graphe puis libère celles qui en dépendaient */
+void dag_run(void *, struct scheduler *);
+
+/* Options des tâches du graphe : dag_run sert aussi pour une tâche annulée,
+ * qu'il parcourt sans l'exécuter */
+static const struct sched_attr dag_attr = {SCHED_PRIO_NORMAL,
+                                           SCHED_ANY_WORKER, NULL, dag_run};
+
+struct dag *
+dag_new(void)
+{
+    struct dag *dag;
+
+    if(!(dag = malloc(sizeof(struct dag)))) {
+        perror("DAG");
+        return NULL;
+    }
+
+    dag->nodes = NULL;
+    dag->nnodes = 0;
+    dag->capnodes = 0;
+
+    return dag;
+}
+
+struct dag_node *
+dag_add(struct dag *dag, taskfunc f, void *closure)
+{
+    struct dag_node *node;
+
+    if(dag->nnodes == dag->capnodes) {
+        int cap = dag->capnodes ? 2 * dag->capnodes : 64;
+        struct dag_node **nodes;
+
+        if(!(nodes = realloc(dag->nodes, cap * sizeof(struct dag_node *)))) {
+            perror("DAG nodes");
+            return NULL;
+        }
+        dag->nodes = nodes;
+        dag->capnodes = cap;
+    }
+
+    if(!(node = malloc(sizeof(struct dag_node)))) {
+        perror("DAG node");
+        return NULL;
+    }
+
+    node->f = f;
+    node->closure = closure;
+    node->dag = dag;
+    node->npred = 0;
+    node->succ = NULL;
+    node->nsucc = 0;
+    node->capsucc = 0;
+
+    dag->nodes[dag->nnodes++] = node;
+
+    return node;
+}
+
+int
+dag_edge(struct dag_node *before, struct dag_node *after)
+{
+    if(before->nsucc == before->capsucc) {
+        int cap = before->capsucc ? 2 * before->capsucc : 4;
+        struct dag_node **succ;
+
+        if(!(succ = realloc(before->succ, cap * sizeof(struct dag_node *)))) {
+            perror("DAG edge");
+            return -1;
+        }
+        before->succ = succ;
+        before->capsucc = cap;
+    }
+
+    before->succ[before->nsucc++] = after;
+    after->npred++;
+
+    return 0;
+}
+
+void
+dag_run(void *closure, struct scheduler *s)
+{
+    struct dag_node *ready = (struct dag_node *)closure;
+
+    ready->next = NULL;
+
+    // Les tâches prêtes que l'ordonnanceur plein refuse, ou annulées, sont
+    // traitées ici l'une après l'autre, et non par récursion : la pile,
+    // parfois celle d'une fiber, ne grandit pas avec la plus longue chaîne de
+    // dépendances
+    while(ready) {
+        struct dag_node *node = ready;
+        struct dag *dag = node->dag;
+        int cancelled = sched_token_cancelled(sched_token_current());
+
+        // Une tâche annulée ne s'exécute pas, mais libère quand même les
+        // suivantes, qui le sont aussi, pour que done soit appelé
+        ready = node->next;
+        if(!cancelled) {
+            node->f(node->closure, s);
+        }
+
+        // La dernière dépendance terminée rend la tâche exécutable, elle est
+        // ajoutée au thread courant pour profiter de ce qui est en cache
+        for(int i = 0; i < node->nsucc; ++i) {
+            struct dag_node *succ = node->succ[i];
+
+            if(atomic_fetch_sub(&succ->pending, 1) == 1 &&
+               (cancelled ||
+                sched_spawn_attr(dag_run, succ, &dag_attr, s) < 0)) {
+                succ->next = ready;
+                ready = succ;
+            }
+        }
+
+        // Toutes les tâches ont terminé, ready est vide et done peut libérer
+        // le graphe
+        if(atomic_fetch_sub(&dag->remaining, 1) == 1 && dag->done) {
+            dag->done(dag->arg, s);
+        }
+    }
+}
+
+int
+dag_submit(struct dag *dag, dag_done done, void *arg, struct scheduler *s)
+{
+    if(dag->nnodes == 0) {
+        return -1;
+    }
+
+    dag->done = done;
+    dag->arg = arg;
+    atomic_init(&dag->remaining, dag->nnodes);
+
+    for(int i = 0; i < dag->nnodes; ++i) {
+        atomic_init(&dag->nodes[i]->pending, dag->nodes[i]->npred);
+    }
+
+    // Les tâches sans dépendance peuvent démarrer. On les récupère avant
+    // d'en lancer une, done pouvant libérer le graphe dès la dernière
+    int nroots = 0;
+    struct dag_node **roots;
+    if(!(roots = malloc(dag->nnodes * sizeof(struct dag_node *)))) {
+        perror("DAG roots");
+        return -1;
+    }
+    for(int i = 0; i < dag->nnodes; ++i) {
+        if(dag->nodes[i]->npred == 0) {
+            roots[nroots++] = dag->nodes[i];
+        }
+    }
+
+    // Un cycle ne démarrerait jamais et done ne serait pas appelé : on
+    // parcourt le graphe en série, roots servant de file, avant de lancer
+    // quoi que ce soit
+    int nvisited = nroots;
+    for(int i = 0; i < nvisited; ++i) {
+        for(int j = 0; j < roots[i]->nsucc; ++j) {
+            struct dag_node *succ = roots[i]->succ[j];
+
+            if(atomic_fetch_sub(&succ->pending, 1) == 1) {
+                roots[nvisited++] = succ;
+            }
+        }
+    }
+
+    for(int i = 0; i < dag->nnodes; ++i) {
+        atomic_store(&dag->nodes[i]->pending, dag->nodes[i]->npred);
+    }
+
+    if(nvisited < dag->nnodes) {
+        fprintf(stderr, "DAG has a cycle\n");
+        free(roots);
+        return -1;
+    }
+
+    // Une racine que l'ordonnanceur plein refuse s'exécute sur place
+    for(int i = 0; i < nroots; ++i) {
+        if(sched_spawn_attr(dag_run, roots[i], &dag_attr, s) < 0) {
+            dag_run(roots[i], s);
+        }
+    }
+
+    free(roots);
+
+    return 0;
+}
+
+void
+dag_free(struct dag *dag)
+{
+    for(int i = 0; i < dag->nnodes; ++i) {
+        free(dag->nodes[i]->succ);
+        free(dag->nodes[i]);
+    }
+
+    free(dag->nodes);
+    free(dag);
+}
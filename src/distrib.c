@@ -0,0 +1,638 @@
+#define _GNU_SOURCE
+
+#include "../includes/distrib.h"
+#include "../includes/sched.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Nombre maximum de processus */
+#define MAX_PROCS 64
+
+/* Descripteurs envoyés au plus en réponse à une demande de vol */
+#define STEAL_MAX 16
+
+/* Attente après un refus avant de redemander, en ms, doublée à chaque refus
+ * jusqu'à STEAL_BACKOFF_MAX */
+#define STEAL_BACKOFF 1
+#define STEAL_BACKOFF_MAX 32
+
+/* Crédit total, divisé à chaque don de tâches */
+#define CREDIT_TOTAL (1LL << 62)
+
+/* Taille initiale de la file de descripteurs */
+#define QUEUE_SIZE 1024
+
+enum message_type {
+    /* Demande de vol */
+    MSG_STEAL,
+
+    /* Réponse avec des tâches et du crédit */
+    MSG_WORK,
+
+    /* Réponse sans tâche */
+    MSG_NONE,
+
+    /* Crédit rendu au premier processus */
+    MSG_CREDIT,
+
+    /* Terminaison, envoyée par le premier processus puis relayée par chacun
+     * avant de fermer ses sockets */
+    MSG_STOP,
+
+    /* Échec : un processus est parti avant la terminaison, tous s'arrêtent */
+    MSG_ABORT,
+};
+
+/* Message entre deux processus, seuls les count premiers descripteurs sont
+ * envoyés */
+struct message {
+    int type;
+    int count;
+    long long credit;
+    struct distrib_task tasks[STEAL_MAX];
+};
+
+/* Statistiques d'un processus, en mémoire partagée */
+struct distrib_stats {
+    atomic_long executed;
+    long received;
+    long given;
+    long requests;
+    long refused;
+};
+
+struct distrib {
+    int rank;
+    int nprocs;
+
+    const distrib_func *funcs;
+    int nfuncs;
+    void *arg;
+
+    /* Sockets vers chacun des autres processus, -1 pour soi-même */
+    int peers[MAX_PROCS];
+
+    /* Réveille le thread de communication quand le processus devient
+     * inactif */
+    int wake;
+
+    /* Signalé à la terminaison, attendu par la tâche initiale */
+    int done;
+
+    /* File des descripteurs, circulaire, protégée par mutex */
+    pthread_mutex_t mutex;
+    struct distrib_task *tasks;
+    int head;
+    int count;
+    int capacity;
+
+    /* Tâches lancées dans l'ordonnanceur local et pas encore terminées : le
+     * processus est inactif à 0 */
+    atomic_long pending;
+
+    /* Crédit détenu, seulement utilisé par le thread de communication */
+    long long credit;
+
+    /* Exécution ratée, lu après la fin du thread de communication */
+    int failed;
+
+    /* Tâche racine, seulement dans le premier processus */
+    const struct distrib_task *root;
+
+    struct scheduler *sched;
+    pthread_t comm;
+    struct distrib_stats *stats;
+};
+
+void *
+distrib_shared(size_t size)
+{
+    void *ptr;
+    int fd;
+
+    if((fd = memfd_create("distrib", MFD_CLOEXEC)) < 0) {
+        perror("memfd_create");
+        return NULL;
+    }
+    if(ftruncate(fd, size) < 0) {
+        perror("ftruncate");
+        close(fd);
+        return NULL;
+    }
+
+    ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(ptr == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+
+    return ptr;
+}
+
+void
+distrib_shared_free(void *ptr, size_t size)
+{
+    if(ptr) {
+        munmap(ptr, size);
+    }
+}
+
+static void
+notify(int fd)
+{
+    uint64_t one = 1;
+
+    if(write(fd, &one, sizeof(one)) < 0) {
+        perror("eventfd write");
+    }
+}
+
+/* Envoie le message, sans échouer si le destinataire est déjà parti */
+static void
+send_message(struct distrib *d, int to, struct message *m)
+{
+    size_t size = offsetof(struct message, tasks) +
+                  m->count * sizeof(struct distrib_task);
+
+    if(send(d->peers[to], m, size, MSG_NOSIGNAL) < 0 && errno != EPIPE) {
+        perror("distrib send");
+    }
+}
+
+/* Ajoute t à la fin de la file, appelée avec le mutex */
+static int
+queue_push(struct distrib *d, const struct distrib_task *t)
+{
+    if(d->count == d->capacity) {
+        struct distrib_task *tasks;
+        int capacity = 2 * d->capacity;
+
+        if(!(tasks = malloc(capacity * sizeof(struct distrib_task)))) {
+            return -1;
+        }
+        for(int i = 0; i < d->count; ++i) {
+            tasks[i] = d->tasks[(d->head + i) % d->capacity];
+        }
+        free(d->tasks);
+        d->tasks = tasks;
+        d->head = 0;
+        d->capacity = capacity;
+    }
+
+    d->tasks[(d->head + d->count) % d->capacity] = *t;
+    d->count++;
+    return 0;
+}
+
+void distrib_runner(void *closure, struct scheduler *s);
+
+int
+distrib_spawn(struct distrib *d, const struct distrib_task *t,
+              struct scheduler *s)
+{
+    int rc;
+
+    // Compté avant d'être visible, le processus reste actif
+    atomic_fetch_add(&d->pending, 1);
+
+    pthread_mutex_lock(&d->mutex);
+    rc = queue_push(d, t);
+    pthread_mutex_unlock(&d->mutex);
+
+    if(rc < 0) {
+        perror("Distributed task allocation");
+        atomic_fetch_sub(&d->pending, 1);
+        return -1;
+    }
+
+    // Chaque tâche de l'ordonnanceur exécute un descripteur, s'il en reste
+    while((rc = sched_spawn(distrib_runner, d, s)) < 0) {
+        if(errno != EAGAIN) {
+            break;
+        }
+    }
+
+    return rc;
+}
+
+/* Exécute le descripteur le plus récent de la file, s'il n'a pas été volé */
+void
+distrib_runner(void *closure, struct scheduler *s)
+{
+    struct distrib *d = (struct distrib *)closure;
+    struct distrib_task t;
+    int found;
+
+    pthread_mutex_lock(&d->mutex);
+    if((found = d->count > 0)) {
+        d->count--;
+        t = d->tasks[(d->head + d->count) % d->capacity];
+    }
+    pthread_mutex_unlock(&d->mutex);
+
+    if(found) {
+        assert(t.kind >= 0 && t.kind < d->nfuncs);
+        d->funcs[t.kind](&t, d->arg, d, s);
+        atomic_fetch_add_explicit(&d->stats->executed, 1,
+                                  memory_order_relaxed);
+    }
+
+    if(atomic_fetch_sub(&d->pending, 1) == 1) {
+        notify(d->wake);
+    }
+}
+
+/* Répond à une demande de vol de from avec la moitié des plus anciens
+ * descripteurs, les plus gros en général, et la moitié du crédit */
+static void
+serve_steal(struct distrib *d, int from)
+{
+    struct message m = {MSG_NONE, 0, 0, {{0}}};
+
+    // Un crédit de 1 ne se divise plus, on garde les tâches
+    if(d->credit >= 2) {
+        pthread_mutex_lock(&d->mutex);
+        m.count = (d->count + 1) / 2;
+        if(m.count > STEAL_MAX) {
+            m.count = STEAL_MAX;
+        }
+        for(int i = 0; i < m.count; ++i) {
+            m.tasks[i] = d->tasks[d->head];
+            d->head = (d->head + 1) % d->capacity;
+            d->count--;
+        }
+        pthread_mutex_unlock(&d->mutex);
+    }
+
+    if(m.count > 0) {
+        m.type = MSG_WORK;
+        m.credit = d->credit / 2;
+        d->credit -= m.credit;
+        d->stats->given += m.count;
+    }
+
+    send_message(d, from, &m);
+}
+
+/* Ajoute les tâches reçues, depuis le thread de communication qui ne fait
+ * pas partie de l'ordonnanceur */
+static void
+receive_work(struct distrib *d, struct message *m)
+{
+    d->credit += m->credit;
+    d->stats->received += m->count;
+
+    for(int i = 0; i < m->count; ++i) {
+        int rc = distrib_spawn(d, &m->tasks[i], d->sched);
+        assert(rc >= 0);
+    }
+}
+
+static long
+now_ms(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000 + t.tv_nsec / 1000000;
+}
+
+/* Thread de communication : répond aux demandes des autres processus, vole
+ * quand le processus est inactif et gère la terminaison */
+static void *
+distrib_comm(void *arg)
+{
+    struct distrib *d = (struct distrib *)arg;
+    struct pollfd fds[MAX_PROCS + 1];
+    unsigned int seed = d->rank + 1;
+    int waiting = 0, stop = 0;
+    long backoff = 0, next = 0;
+
+    for(int p = 0; p < d->nprocs; ++p) {
+        fds[p] = (struct pollfd){d->peers[p], POLLIN, 0};
+    }
+    fds[d->nprocs] = (struct pollfd){d->wake, POLLIN, 0};
+
+    while(!stop) {
+        int idle = atomic_load(&d->pending) == 0;
+        int timeout = -1;
+
+        if(idle && d->rank == 0 && d->credit == CREDIT_TOTAL) {
+            break;
+        }
+
+        if(idle && d->rank != 0 && d->credit > 0) {
+            struct message m = {MSG_CREDIT, 0, d->credit, {{0}}};
+
+            send_message(d, 0, &m);
+            d->credit = 0;
+        }
+
+        if(idle && !waiting && d->nprocs > 1) {
+            long t = now_ms();
+
+            if(t >= next) {
+                struct message m = {MSG_STEAL, 0, 0, {{0}}};
+                int victim = rand_r(&seed) % (d->nprocs - 1);
+
+                send_message(d, victim >= d->rank ? victim + 1 : victim, &m);
+                d->stats->requests++;
+                waiting = 1;
+            } else {
+                timeout = next - t;
+            }
+        }
+
+        if(poll(fds, d->nprocs + 1, timeout) < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            d->failed = 1;
+            break;
+        }
+
+        if(fds[d->nprocs].revents & POLLIN) {
+            uint64_t value;
+
+            if(read(d->wake, &value, sizeof(value)) < 0) {
+                perror("eventfd read");
+            }
+        }
+
+        for(int p = 0; p < d->nprocs; ++p) {
+            struct message m;
+            ssize_t size;
+
+            if(!(fds[p].revents & (POLLIN | POLLHUP))) {
+                continue;
+            }
+
+            // Un processus ne part qu'après avoir relayé la terminaison : sans
+            // elle, son crédit ou ses tâches sont perdus
+            if((size = recv(fds[p].fd, &m, sizeof(m), 0)) <= 0) {
+                fds[p].fd = -1;
+                if(!stop) {
+                    fprintf(stderr, "Process %d: process %d hung up\n",
+                            d->rank, p);
+                    d->failed = 1;
+                    stop = 1;
+                }
+                continue;
+            }
+
+            switch(m.type) {
+            case MSG_STEAL:
+                serve_steal(d, p);
+                break;
+            case MSG_WORK:
+                receive_work(d, &m);
+                waiting = 0;
+                backoff = 0;
+                break;
+            case MSG_NONE:
+                waiting = 0;
+                d->stats->refused++;
+                backoff = backoff ? 2 * backoff : STEAL_BACKOFF;
+                if(backoff > STEAL_BACKOFF_MAX) {
+                    backoff = STEAL_BACKOFF_MAX;
+                }
+                next = now_ms() + backoff;
+                break;
+            case MSG_CREDIT:
+                d->credit += m.credit;
+                break;
+            case MSG_STOP:
+                stop = 1;
+                break;
+            case MSG_ABORT:
+                d->failed = 1;
+                stop = 1;
+                break;
+            }
+        }
+    }
+
+    // Relayée à tous : les autres ne voient pas de départ sans message
+    for(int p = 0; p < d->nprocs; ++p) {
+        struct message m = {d->failed ? MSG_ABORT : MSG_STOP, 0, 0, {{0}}};
+
+        if(fds[p].fd >= 0) {
+            send_message(d, p, &m);
+        }
+    }
+
+    notify(d->done);
+    return NULL;
+}
+
+/* Tâche initiale de chaque processus : lance le thread de communication et
+ * la tâche racine dans le premier processus, puis attend la terminaison
+ * (sans occuper de thread avec les fibers) */
+void
+distrib_root(void *closure, struct scheduler *s)
+{
+    struct distrib *d = (struct distrib *)closure;
+    int rc;
+
+    d->sched = s;
+    rc = pthread_create(&d->comm, NULL, distrib_comm, d);
+    assert(rc == 0);
+
+    // Le premier processus était compté actif jusqu'ici, pour ne pas
+    // terminer avant d'avoir lancé la racine
+    if(d->root) {
+        rc = distrib_spawn(d, d->root, s);
+        assert(rc >= 0);
+        if(atomic_fetch_sub(&d->pending, 1) == 1) {
+            notify(d->wake);
+        }
+    }
+
+    sched_wait_fd(d->done, POLLIN);
+}
+
+/* Fait tourner le processus rank jusqu'à la terminaison
+ *
+ * Renvoie 0, -1 en cas d'échec */
+static int
+distrib_process(struct distrib *d, int nthreads, int qlen)
+{
+    int rc = -1;
+
+    d->capacity = QUEUE_SIZE;
+    if(!(d->tasks = malloc(d->capacity * sizeof(struct distrib_task)))) {
+        perror("Distributed queue allocation");
+        return -1;
+    }
+    if((d->wake = eventfd(0, EFD_CLOEXEC)) < 0 ||
+       (d->done = eventfd(0, EFD_CLOEXEC)) < 0) {
+        perror("eventfd");
+        goto out;
+    }
+    if(pthread_mutex_init(&d->mutex, NULL) != 0) {
+        fprintf(stderr, "Can't init mutex\n");
+        goto out;
+    }
+
+    atomic_init(&d->pending, d->root ? 1 : 0);
+    d->credit = d->root ? CREDIT_TOTAL : 0;
+
+    // Un thread de plus, occupé par l'attente de la terminaison sans fibers
+    if(nthreads <= 0) {
+        nthreads = sched_default_threads();
+    }
+    rc = sched_init(nthreads + 1, qlen, distrib_root, d);
+    if(rc >= 0) {
+        pthread_join(d->comm, NULL);
+        rc = d->failed ? -1 : 0;
+    }
+
+    pthread_mutex_destroy(&d->mutex);
+out:
+    if(d->wake >= 0) {
+        close(d->wake);
+    }
+    if(d->done >= 0) {
+        close(d->done);
+    }
+    free(d->tasks);
+    return rc;
+}
+
+int
+distrib_run(int nprocs, int nthreads, int qlen, const distrib_func *funcs,
+            int nfuncs, void *arg, const struct distrib_task *root)
+{
+    static int sockets[MAX_PROCS][MAX_PROCS];
+    struct distrib_stats *stats;
+    struct distrib d = {0};
+    pid_t pids[MAX_PROCS];
+    int rank = 0, rc;
+
+    if(nprocs < 1 || nprocs > MAX_PROCS) {
+        fprintf(stderr, "Between 1 and %d processes\n", MAX_PROCS);
+        return -1;
+    }
+
+    if(!(stats = distrib_shared(nprocs * sizeof(struct distrib_stats)))) {
+        return -1;
+    }
+
+    // Une paire de sockets par couple de processus, messages délimités
+    for(int i = 0; i < nprocs; ++i) {
+        for(int j = 0; j < nprocs; ++j) {
+            sockets[i][j] = -1;
+        }
+    }
+    for(int i = 0; i < nprocs; ++i) {
+        for(int j = i + 1; j < nprocs; ++j) {
+            int sv[2];
+
+            if(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) < 0) {
+                perror("socketpair");
+                goto fail;
+            }
+            sockets[i][j] = sv[0];
+            sockets[j][i] = sv[1];
+        }
+    }
+
+    // Les processus créés n'ont rien à écrire de ce qui précède
+    fflush(stdout);
+    for(int r = 1; r < nprocs; ++r) {
+        if((pids[r] = fork()) < 0) {
+            perror("fork");
+            // Les processus déjà créés attendraient le premier indéfiniment
+            for(int c = 1; c < r; ++c) {
+                kill(pids[c], SIGKILL);
+                waitpid(pids[c], NULL, 0);
+            }
+            goto fail;
+        }
+        if(pids[r] == 0) {
+            rank = r;
+            break;
+        }
+    }
+
+    // Chaque processus garde ses propres sockets
+    for(int i = 0; i < nprocs; ++i) {
+        for(int j = 0; j < nprocs; ++j) {
+            if(i != rank && sockets[i][j] >= 0) {
+                close(sockets[i][j]);
+            }
+        }
+    }
+
+    d.rank = rank;
+    d.nprocs = nprocs;
+    d.funcs = funcs;
+    d.nfuncs = nfuncs;
+    d.arg = arg;
+    d.root = rank == 0 ? root : NULL;
+    d.wake = d.done = -1;
+    d.stats = &stats[rank];
+    memcpy(d.peers, sockets[rank], nprocs * sizeof(int));
+
+    rc = distrib_process(&d, nthreads, qlen);
+
+    for(int p = 0; p < nprocs; ++p) {
+        if(d.peers[p] >= 0) {
+            close(d.peers[p]);
+        }
+    }
+
+    if(rank != 0) {
+        fflush(stdout);
+        _exit(rc < 0 ? 1 : 0);
+    }
+
+    for(int r = 1; r < nprocs; ++r) {
+        int status;
+
+        if(waitpid(pids[r], &status, 0) < 0 || !WIFEXITED(status) ||
+           WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "Process %d failed\n", r);
+            rc = -1;
+        }
+    }
+
+    printf(" processus     exécutées      données       reçues  "
+           "demandes de vol (refusés)\n");
+    for(int r = 0; r < nprocs; ++r) {
+        printf(" %-9d %12ld %12ld %12ld %12ld (%ld)\n", r,
+               atomic_load(&stats[r].executed), stats[r].given,
+               stats[r].received, stats[r].requests, stats[r].refused);
+    }
+
+    distrib_shared_free(stats, nprocs * sizeof(struct distrib_stats));
+    return rc;
+
+fail:
+    for(int i = 0; i < nprocs; ++i) {
+        for(int j = 0; j < nprocs; ++j) {
+            if(sockets[i][j] >= 0) {
+                close(sockets[i][j]);
+            }
+        }
+    }
+    distrib_shared_free(stats, nprocs * sizeof(struct distrib_stats));
+    return -1;
+}
@@ -0,0 +1,682 @@
+#include "../includes/fiber.h"
+#include "../includes/token.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if !defined(__x86_64__) || defined(FIBER_UCONTEXT)
+#include <ucontext.h>
+#define FIBER_USE_UCONTEXT
+#endif
+
+/* Taille de la pile d'une fiber */
+#define FIBER_STACK (64 << 10)
+
+/* Piles gardées par thread, le reste est partagé */
+#define FIBER_CACHE 16
+
+/* Taille d'une ligne de cache */
+#define CACHE_LINE 64
+
+/* Fiber en cours d'exécution sur une pile, entre deux fiber_run */
+#define FIBER_RUNNING -1
+
+struct fiber {
+    /* Contexte de la fiber, et celui du thread qui l'exécute pour y revenir */
+#ifdef FIBER_USE_UCONTEXT
+    ucontext_t context;
+    ucontext_t caller;
+#else
+    void *sp;
+    void *caller_sp;
+#endif
+
+    /* Pile, précédée d'une page de garde */
+    void *stack;
+
+    /* Tâche, et fonction appelée à sa place si elle est annulée */
+    taskfunc f;
+    taskfunc cancel;
+    void *closure;
+    struct scheduler *sched;
+
+    /* Jeton courant de la tâche quand elle ne tourne pas */
+    struct sched_token *token;
+
+    /* Gardé pour l'ordonnanceur */
+    int origin;
+
+    /* enum fiber_state, ou FIBER_RUNNING */
+    int state;
+
+    /* Appelée par le thread une fois la fiber arrêtée, pour l'inscrire là
+     * où elle attend */
+    void (*park)(struct fiber *, void *);
+    void *park_arg;
+
+    /* Événements reçus par sched_wait_fd */
+    int revents;
+
+    /* Fibers auxquelles elle appartient */
+    struct fibers *fibers;
+
+    /* Suivante dans une liste (piles libres, attente d'un sched_join) */
+    struct fiber *next;
+};
+
+/* Piles libres d'un thread */
+struct cache {
+    alignas(CACHE_LINE) struct fiber *free;
+    int n;
+};
+
+struct fibers {
+    /* Piles libres par thread */
+    struct cache *caches;
+    int nthreads;
+
+    /* Piles libres partagées */
+    pthread_mutex_t mutex;
+    struct fiber *free;
+
+    /* Piles allouées, libres ou non */
+    atomic_size_t stacks;
+
+    /* Relance une fiber */
+    void (*resume)(struct fiber *, void *);
+    void *arg;
+
+    /* Descripteurs surveillés pour sched_wait_fd, et de quoi arrêter le
+     * thread qui les surveille */
+    int epoll;
+    int stop;
+    pthread_t poller;
+    int polling;
+};
+
+struct sched_join {
+    /* Tâches restantes */
+    int count;
+
+    /* Protège le compteur et les listes d'attente */
+    pthread_mutex_t mutex;
+
+    /* Threads qui attendent hors d'une fiber */
+    pthread_cond_t cond;
+
+    /* Fibers qui attendent */
+    struct fiber *waiters;
+};
+
+/* Descripteur attendu par sched_wait_fd */
+struct fd_wait {
+    int fd;
+    int events;
+
+    /* errno si le descripteur n'a pas pu être surveillé */
+    int error;
+};
+
+/* Fiber en cours d'exécution par le thread */
+static _Thread_local struct fiber *current = NULL;
+
+#ifndef FIBER_USE_UCONTEXT
+/* Sauve les registres préservés par les appels sur la pile courante, range
+ * le pointeur de pile dans *save, puis reprend le contexte sauvé sur la pile
+ * sp */
+void fiber_switch(void **save, void *sp);
+
+__asm__(".text\n"
+        ".globl fiber_switch\n"
+        ".hidden fiber_switch\n"
+        ".type fiber_switch, @function\n"
+        "fiber_switch:\n"
+        "    pushq %rbp\n"
+        "    pushq %rbx\n"
+        "    pushq %r12\n"
+        "    pushq %r13\n"
+        "    pushq %r14\n"
+        "    pushq %r15\n"
+        "    subq $8, %rsp\n"
+        "    stmxcsr (%rsp)\n"
+        "    fnstcw 4(%rsp)\n"
+        "    movq %rsp, (%rdi)\n"
+        "    movq %rsi, %rsp\n"
+        "    ldmxcsr (%rsp)\n"
+        "    fldcw 4(%rsp)\n"
+        "    addq $8, %rsp\n"
+        "    popq %r15\n"
+        "    popq %r14\n"
+        "    popq %r13\n"
+        "    popq %r12\n"
+        "    popq %rbx\n"
+        "    popq %rbp\n"
+        "    ret\n"
+        ".size fiber_switch, .-fiber_switch\n");
+#endif
+
+int
+fibers_enabled(void)
+{
+    const char *env = getenv("SCHED_FIBERS");
+
+    return env && *env && strcmp(env, "0") != 0;
+}
+
+/* Relance une fiber qui attendait */
+static void
+fiber_wake(struct fiber *f)
+{
+    f->fibers->resume(f, f->fibers->arg);
+}
+
+/* Thread qui relance les fibers dont le descripteur est prêt */
+static void *
+fibers_poller(void *arg)
+{
+    struct fibers *fs = (struct fibers *)arg;
+    struct epoll_event events[64];
+
+    while(1) {
+        int n = epoll_wait(fs->epoll, events, 64, -1);
+
+        if(n < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait");
+            return NULL;
+        }
+
+        for(int i = 0; i < n; ++i) {
+            struct fiber *f = (struct fiber *)events[i].data.ptr;
+
+            // L'eventfd d'arrêt
+            if(!f) {
+                return NULL;
+            }
+
+            f->revents = events[i].events;
+            fiber_wake(f);
+        }
+    }
+}
+
+struct fibers *
+fibers_new(int nthreads, void (*resume)(struct fiber *, void *), void *arg)
+{
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = NULL};
+    struct fibers *fs;
+
+    if(!(fs = calloc(1, sizeof(struct fibers)))) {
+        perror("Fibers");
+        return NULL;
+    }
+
+    if(!(fs->caches =
+             aligned_alloc(CACHE_LINE, nthreads * sizeof(struct cache)))) {
+        perror("Fiber caches");
+        free(fs);
+        return NULL;
+    }
+    for(int i = 0; i < nthreads; ++i) {
+        fs->caches[i].free = NULL;
+        fs->caches[i].n = 0;
+    }
+    fs->nthreads = nthreads;
+    atomic_init(&fs->stacks, 0);
+    fs->resume = resume;
+    fs->arg = arg;
+    fs->epoll = -1;
+    fs->stop = -1;
+
+    if(pthread_mutex_init(&fs->mutex, NULL) != 0) {
+        fprintf(stderr, "Can't init mutex\n");
+        free(fs->caches);
+        free(fs);
+        return NULL;
+    }
+
+    if((fs->epoll = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+       (fs->stop = eventfd(0, EFD_CLOEXEC)) < 0 ||
+       epoll_ctl(fs->epoll, EPOLL_CTL_ADD, fs->stop, &ev) < 0) {
+        perror("Fibers epoll");
+        fibers_free(fs);
+        return NULL;
+    }
+
+    if(pthread_create(&fs->poller, NULL, fibers_poller, fs) != 0) {
+        fprintf(stderr, "Can't create the poller thread\n");
+        fibers_free(fs);
+        return NULL;
+    }
+    fs->polling = 1;
+
+    return fs;
+}
+
+/* Libère une liste de fibers et leurs piles */
+static void
+fibers_release(struct fiber *f)
+{
+    while(f) {
+        struct fiber *next = f->next;
+
+        munmap(f->stack, FIBER_STACK + getpagesize());
+        free(f);
+        f = next;
+    }
+}
+
+void
+fibers_free(struct fibers *fs)
+{
+    if(fs->polling) {
+        uint64_t one = 1;
+
+        if(write(fs->stop, &one, sizeof(one)) != sizeof(one)) {
+            perror("Fibers stop");
+        }
+        pthread_join(fs->poller, NULL);
+    }
+    if(fs->stop >= 0) {
+        close(fs->stop);
+    }
+    if(fs->epoll >= 0) {
+        close(fs->epoll);
+    }
+
+    for(int i = 0; i < fs->nthreads; ++i) {
+        fibers_release(fs->caches[i].free);
+    }
+    fibers_release(fs->free);
+
+    pthread_mutex_destroy(&fs->mutex);
+    free(fs->caches);
+    free(fs);
+}
+
+/* Point d'entrée d'une fiber, sur sa propre pile */
+static void
+fiber_entry(void)
+{
+    struct fiber *f = current;
+
+    f->state = sched_token_run(f->f, f->cancel, f->closure, f->token, f->sched)
+                   ? FIBER_DONE
+                   : FIBER_CANCELLED;
+
+    // Retour au thread qui l'exécute en dernier, sans jamais revenir ici
+#ifdef FIBER_USE_UCONTEXT
+    setcontext(&f->caller);
+#else
+    fiber_switch(&f->sp, f->caller_sp);
+#endif
+    abort();
+}
+
+/* Prend une fiber libre, d'abord dans les piles du thread th */
+static struct fiber *
+fiber_alloc(struct fibers *fs, int th)
+{
+    size_t page = getpagesize();
+    struct fiber *f = NULL;
+
+    if(th >= 0 && th < fs->nthreads && fs->caches[th].free) {
+        f = fs->caches[th].free;
+        fs->caches[th].free = f->next;
+        fs->caches[th].n--;
+        return f;
+    }
+
+    pthread_mutex_lock(&fs->mutex);
+    if((f = fs->free)) {
+        fs->free = f->next;
+    }
+    pthread_mutex_unlock(&fs->mutex);
+
+    if(f) {
+        return f;
+    }
+
+    if(!(f = malloc(sizeof(struct fiber)))) {
+        perror("Fiber");
+        return NULL;
+    }
+
+    f->stack = mmap(NULL, FIBER_STACK + page, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if(f->stack == MAP_FAILED) {
+        perror("Fiber stack");
+        free(f);
+        return NULL;
+    }
+
+    // Page de garde, un débordement de pile plante au lieu d'écraser
+    // une autre pile
+    if(mprotect(f->stack, page, PROT_NONE) < 0) {
+        perror("Fiber guard page");
+    }
+
+    f->fibers = fs;
+    atomic_fetch_add_explicit(&fs->stacks, 1, memory_order_relaxed);
+
+    return f;
+}
+
+/* Rend la fiber aux piles libres du thread th */
+static void
+fiber_release(struct fiber *f, int th)
+{
+    struct fibers *fs = f->fibers;
+
+    if(th >= 0 && th < fs->nthreads && fs->caches[th].n < FIBER_CACHE) {
+        f->next = fs->caches[th].free;
+        fs->caches[th].free = f;
+        fs->caches[th].n++;
+        return;
+    }
+
+    pthread_mutex_lock(&fs->mutex);
+    f->next = fs->free;
+    fs->free = f;
+    pthread_mutex_unlock(&fs->mutex);
+}
+
+struct fiber *
+fiber_new(struct fibers *fs, int th, taskfunc func, taskfunc cancel,
+          void *closure, struct sched_token *token, struct scheduler *s,
+          int origin)
+{
+    struct fiber *f;
+    char *top;
+
+    if(!(f = fiber_alloc(fs, th))) {
+        return NULL;
+    }
+
+    f->f = func;
+    f->cancel = cancel;
+    f->closure = closure;
+    f->token = token;
+    f->sched = s;
+    f->origin = origin;
+    f->state = FIBER_RUNNING;
+    f->next = NULL;
+
+    top = (char *)f->stack + getpagesize() + FIBER_STACK;
+
+#ifdef FIBER_USE_UCONTEXT
+    getcontext(&f->context);
+    f->context.uc_stack.ss_sp = (char *)f->stack + getpagesize();
+    f->context.uc_stack.ss_size = FIBER_STACK;
+    f->context.uc_link = NULL;
+    makecontext(&f->context, fiber_entry, 0);
+    (void)top;
+#else
+    // Contexte initial repris par fiber_switch : registres nuls, contrôle
+    // flottant par défaut, puis retour dans fiber_entry avec une pile
+    // alignée comme après un appel
+    void **sp = (void **)top;
+
+    *--sp = NULL;
+    *--sp = (void *)(uintptr_t)fiber_entry;
+    for(int i = 0; i < 6; ++i) {
+        *--sp = NULL;
+    }
+    *--sp = (void *)(uintptr_t)(0x1F80 | (uint64_t)0x037F << 32);
+    f->sp = sp;
+#endif
+
+    return f;
+}
+
+enum fiber_state
+fiber_run(struct fiber *f, int th)
+{
+    struct fiber *saved = current;
+    struct sched_token *token;
+    int state;
+
+    // La fiber emporte son jeton courant quand elle change de thread
+    current = f;
+    token = sched_token_swap(f->token);
+#ifdef FIBER_USE_UCONTEXT
+    swapcontext(&f->caller, &f->context);
+#else
+    fiber_switch(&f->caller_sp, f->sp);
+#endif
+    f->token = sched_token_swap(token);
+    current = saved;
+
+    // La fiber est arrêtée, elle peut maintenant être inscrite là où elle
+    // attend, et reprendre ailleurs avant même qu'on sorte d'ici
+    if((state = f->state) == FIBER_WAITING) {
+        f->park(f, f->park_arg);
+        return FIBER_WAITING;
+    }
+
+    fiber_release(f, th);
+
+    return state;
+}
+
+int
+fiber_origin(struct fiber *f)
+{
+    return f->origin;
+}
+
+/* Arrête la fiber courante, park(fiber, arg) est ensuite appelée par le
+ * thread qui l'exécutait et doit faire en sorte que fiber_wake soit appelée
+ *
+ * Peut reprendre sur un autre thread */
+static void
+fiber_suspend(void (*park)(struct fiber *, void *), void *arg)
+{
+    struct fiber *f = current;
+
+    f->park = park;
+    f->park_arg = arg;
+    f->state = FIBER_WAITING;
+#ifdef FIBER_USE_UCONTEXT
+    swapcontext(&f->context, &f->caller);
+#else
+    fiber_switch(&f->sp, f->caller_sp);
+#endif
+    f->state = FIBER_RUNNING;
+}
+
+/* Relance tout de suite la fiber qui vient de s'arrêter */
+static void
+yield_park(struct fiber *f, void *arg)
+{
+    (void)arg;
+    fiber_wake(f);
+}
+
+int
+fiber_yield(void)
+{
+    if(!current) {
+        return 0;
+    }
+
+    fiber_suspend(yield_park, NULL);
+    return 1;
+}
+
+size_t
+fibers_memory(struct fibers *fs)
+{
+    return atomic_load(&fs->stacks) * (FIBER_STACK + getpagesize());
+}
+
+struct sched_join *
+sched_join_new(int count)
+{
+    struct sched_join *join;
+
+    if(!(join = malloc(sizeof(struct sched_join)))) {
+        perror("Join");
+        return NULL;
+    }
+
+    if(pthread_mutex_init(&join->mutex, NULL) != 0) {
+        fprintf(stderr, "Can't init mutex\n");
+        free(join);
+        return NULL;
+    }
+    if(pthread_cond_init(&join->cond, NULL) != 0) {
+        fprintf(stderr, "Can't init condition variable\n");
+        pthread_mutex_destroy(&join->mutex);
+        free(join);
+        return NULL;
+    }
+
+    join->count = count;
+    join->waiters = NULL;
+
+    return join;
+}
+
+void
+sched_join_done(struct sched_join *join)
+{
+    struct fiber *waiters = NULL;
+
+    // Le compteur passe à 0 sous le mutex : un thread qui le voit à 0 ne
+    // peut pas libérer le join avant que le mutex soit rendu
+    pthread_mutex_lock(&join->mutex);
+    if(--join->count == 0) {
+        waiters = join->waiters;
+        join->waiters = NULL;
+        pthread_cond_broadcast(&join->cond);
+    }
+    pthread_mutex_unlock(&join->mutex);
+
+    // Le join peut être libéré dès que le mutex est rendu, on n'y touche
+    // plus
+    while(waiters) {
+        struct fiber *next = waiters->next;
+
+        fiber_wake(waiters);
+        waiters = next;
+    }
+}
+
+/* Inscrit la fiber parmi celles qui attendent le join */
+static void
+join_park(struct fiber *f, void *arg)
+{
+    struct sched_join *join = (struct sched_join *)arg;
+
+    pthread_mutex_lock(&join->mutex);
+    if(join->count == 0) {
+        pthread_mutex_unlock(&join->mutex);
+        fiber_wake(f);
+        return;
+    }
+    f->next = join->waiters;
+    join->waiters = f;
+    pthread_mutex_unlock(&join->mutex);
+}
+
+void
+sched_join_wait(struct sched_join *join)
+{
+    int done;
+
+    // Toujours sous le mutex, pour ne pas voir le compteur à 0 avant que
+    // sched_join_done ait fini de s'en servir
+    pthread_mutex_lock(&join->mutex);
+    done = join->count == 0;
+    pthread_mutex_unlock(&join->mutex);
+
+    if(done) {
+        return;
+    }
+
+    if(current) {
+        fiber_suspend(join_park, join);
+        return;
+    }
+
+    pthread_mutex_lock(&join->mutex);
+    while(join->count > 0) {
+        pthread_cond_wait(&join->cond, &join->mutex);
+    }
+    pthread_mutex_unlock(&join->mutex);
+}
+
+void
+sched_join_free(struct sched_join *join)
+{
+    pthread_cond_destroy(&join->cond);
+    pthread_mutex_destroy(&join->mutex);
+    free(join);
+}
+
+/* Fait surveiller le descripteur pour la fiber, une seule fois */
+static void
+fd_park(struct fiber *f, void *arg)
+{
+    struct fd_wait *w = (struct fd_wait *)arg;
+    struct epoll_event ev;
+
+    ev.events = w->events | EPOLLONESHOT;
+    ev.data.ptr = f;
+
+    // Une fois inscrite, la fiber peut reprendre à tout moment et w
+    // disparaître avec sa pile
+    if(epoll_ctl(f->fibers->epoll, EPOLL_CTL_ADD, w->fd, &ev) < 0) {
+        w->error = errno;
+        fiber_wake(f);
+    }
+}
+
+int
+sched_wait_fd(int fd, int events)
+{
+    struct fiber *f = current;
+
+    if(!f) {
+        struct pollfd p = {fd, events, 0};
+
+        while(poll(&p, 1, -1) < 0) {
+            if(errno != EINTR) {
+                return -1;
+            }
+        }
+        return p.revents;
+    }
+
+    struct fd_wait w = {fd, events, 0};
+
+    f->revents = 0;
+    fiber_suspend(fd_park, &w);
+
+    // Les fichiers ordinaires ne peuvent pas être surveillés, mais sont
+    // toujours prêts
+    if(w.error == EPERM) {
+        return events;
+    } else if(w.error) {
+        errno = w.error;
+        return -1;
+    }
+
+    epoll_ctl(f->fibers->epoll, EPOLL_CTL_DEL, fd, NULL);
+
+    return f->revents;
+}
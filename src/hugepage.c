@@ -0,0 +1,165 @@
+#include "../includes/hugepage.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/* Taille d'une grande page */
+#define HUGE_PAGE (2UL << 20)
+
+/* Tableau alloué avec mmap */
+struct mapping {
+    void *ptr;
+    size_t size;
+    struct mapping *next;
+};
+
+/* Tableaux alloués avec mmap, pour les distinguer de ceux de malloc */
+static struct mapping *mappings = NULL;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+int
+huge_enabled(void)
+{
+    const char *env = getenv("SCHED_HUGEPAGES");
+
+    return env && *env && strcmp(env, "0") != 0;
+}
+
+void *
+huge_alloc(size_t size)
+{
+    struct mapping *m;
+    size_t len = (size + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1);
+    uintptr_t start, end;
+    char *map;
+
+    // Moins d'une grande page, rien à gagner
+    if(!huge_enabled() || size < HUGE_PAGE) {
+        return malloc(size);
+    }
+
+    if(!(m = malloc(sizeof(struct mapping)))) {
+        perror("Huge mapping");
+        return NULL;
+    }
+
+    // Une grande page de plus pour pouvoir aligner
+    map = mmap(NULL, len + HUGE_PAGE, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(map == MAP_FAILED) {
+        free(m);
+        return malloc(size);
+    }
+
+    start = ((uintptr_t)map + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1);
+    end = start + len;
+    if(start > (uintptr_t)map) {
+        munmap(map, start - (uintptr_t)map);
+    }
+    if((uintptr_t)map + len + HUGE_PAGE > end) {
+        munmap((void *)end, (uintptr_t)map + len + HUGE_PAGE - end);
+    }
+
+    // Sans effet si le noyau ne les gère pas, la mémoire reste utilisable
+    madvise((void *)start, len, MADV_HUGEPAGE);
+
+    m->ptr = (void *)start;
+    m->size = len;
+    pthread_mutex_lock(&mutex);
+    m->next = mappings;
+    mappings = m;
+    pthread_mutex_unlock(&mutex);
+
+    return m->ptr;
+}
+
+void
+huge_free(void *ptr)
+{
+    struct mapping **prev, *m = NULL;
+
+    if(!ptr) {
+        return;
+    }
+
+    pthread_mutex_lock(&mutex);
+    for(prev = &mappings; *prev; prev = &(*prev)->next) {
+        if((*prev)->ptr == ptr) {
+            m = *prev;
+            *prev = m->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&mutex);
+
+    if(!m) {
+        free(ptr);
+        return;
+    }
+
+    munmap(m->ptr, m->size);
+    free(m);
+}
+
+void
+huge_touch(void *ptr, size_t size)
+{
+    volatile char *p = (volatile char *)ptr;
+
+    if(!huge_enabled()) {
+        return;
+    }
+
+    // Une écriture par page normale, une seule suffit si c'est une grande
+    for(size_t i = 0; i < size && i < HUGE_PAGE; i += 4096) {
+        p[i] = p[i];
+    }
+}
+
+size_t
+huge_backed(void *ptr, size_t size)
+{
+    unsigned long start, end;
+    char line[512];
+    long kb = -1;
+    int found = 0;
+    FILE *f;
+
+    if(!ptr || size < HUGE_PAGE || !(f = fopen("/proc/self/smaps", "r"))) {
+        return 0;
+    }
+
+    // Une ligne d'en-tête "début-fin ..." par zone, puis ses champs
+    while(fgets(line, sizeof(line), f)) {
+        if(sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+            if(found) {
+                break;
+            }
+            found = (uintptr_t)ptr >= start && (uintptr_t)ptr < end;
+        } else if(found && sscanf(line, "AnonHugePages: %ld kB", &kb) == 1) {
+            break;
+        }
+    }
+    fclose(f);
+
+    // La zone peut avoir été fusionnée avec ses voisines
+    if(kb <= 0) {
+        return 0;
+    }
+    return (size_t)kb * 1024 < size ? (size_t)kb * 1024 : size;
+}
+
+void
+huge_report(const char *name, size_t backed, size_t size)
+{
+    if(!huge_enabled()) {
+        return;
+    }
+
+    printf("Grandes pages (%s) : %.1f Mio sur %.1f Mio\n", name,
+           backed / 1048576.0, size / 1048576.0);
+}
@@ -0,0 +1,154 @@
+#include "../includes/kernels.h"
+
+#include <float.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Pixels calculés à la fois, la largeur d'un registre SSE2 */
+#define FLOAT_LANES 4
+#define DOUBLE_LANES 2
+
+/* Écart minimum entre deux pixels, en epsilons float de la plus grande
+ * coordonnée, pour calculer tout en float ou en mixte. Sur la vue d'ensemble
+ * (4400 epsilons), 0.27 % des pixels changent en float et 0.01 % en mixte ;
+ * en zoomant, 0.09 % changent en mixte à 730 epsilons et 0.2 % à 180 */
+#define FLOAT_MIN_ULPS 262144.0
+#define MIXED_MIN_ULPS 1024.0
+
+/* Nombre d'itérations à partir duquel un pixel qui s'échappe est recalculé
+ * en double par le noyau mixte. Les pixels qui s'échappent vite sont loin du
+ * bord, là où les erreurs d'arrondi ne changent rien */
+#define MIXED_THRESHOLD 32
+
+/* Pixels recalculés en double à la fois par le noyau mixte */
+#define MIXED_BLOCK 64
+
+typedef float vfloat __attribute__((vector_size(FLOAT_LANES * 4)));
+typedef int32_t vfmask __attribute__((vector_size(FLOAT_LANES * 4)));
+typedef double vdouble __attribute__((vector_size(DOUBLE_LANES * 8)));
+typedef int64_t vdmask __attribute__((vector_size(DOUBLE_LANES * 8)));
+
+static const char *kernel_names[] = {"auto", "float", "mixed", "double"};
+
+int
+kernel_parse(const char *name)
+{
+    for(int i = 0; i < (int)(sizeof(kernel_names) / sizeof(char *)); ++i) {
+        if(strcmp(name, kernel_names[i]) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+const char *
+kernel_name(enum mandel_kernel kernel)
+{
+    return kernel_names[kernel];
+}
+
+enum mandel_kernel
+kernel_select(double spacing, double magnitude)
+{
+    double ulps = spacing / (magnitude * FLT_EPSILON);
+
+    if(ulps >= FLOAT_MIN_ULPS) {
+        return KERNEL_FLOAT;
+    } else if(ulps >= MIXED_MIN_ULPS) {
+        return KERNEL_MIXED;
+    }
+
+    return KERNEL_DOUBLE;
+}
+
+/* Génère kernel_name, qui calcule la ligne lanes pixels à la fois avec des
+ * vecteurs vtype de type et des masques mtype. Les pixels déjà échappés
+ * continuent d'itérer avec les autres, jusqu'à l'infini ou NaN, sans plus
+ * être comptés : |z| ne redescend pas sous 2 une fois dépassé. Les calculs
+ * sont ceux de z * z + c en complexes, pour donner exactement le même
+ * résultat en double */
+#define KERNEL_DEFINE(name, type, vtype, mtype, lanes)                         \
+    static void kernel_##name(const double *re, double im, int n,              \
+                              int iterations, int *counts)                     \
+    {                                                                          \
+        for(int i = 0; i < n; i += lanes) {                                    \
+            vtype x = {0}, y = {0}, cx, cy;                                    \
+            mtype count = {0};                                                 \
+                                                                               \
+            /* Les voies en trop en fin de ligne répètent le dernier pixel */  \
+            for(int l = 0; l < lanes; ++l) {                                   \
+                cx[l] = (type)re[i + l < n ? i + l : n - 1];                   \
+                cy[l] = (type)im;                                              \
+            }                                                                  \
+                                                                               \
+            for(int k = 0; k < iterations; ++k) {                              \
+                vtype x2 = x * x, y2 = y * y;                                  \
+                mtype inside = x2 + y2 <= 4;                                   \
+                int any = 0;                                                   \
+                                                                               \
+                for(int l = 0; l < lanes; ++l) {                               \
+                    any |= inside[l] != 0;                                     \
+                }                                                              \
+                if(!any) {                                                     \
+                    break;                                                     \
+                }                                                              \
+                                                                               \
+                /* inside vaut -1 pour les pixels pas encore échappés */       \
+                count -= inside;                                               \
+                y = 2 * x * y + cy;                                            \
+                x = x2 - y2 + cx;                                              \
+            }                                                                  \
+                                                                               \
+            for(int l = 0; l < lanes && i + l < n; ++l) {                      \
+                counts[i + l] = count[l];                                      \
+            }                                                                  \
+        }                                                                      \
+    }
+
+KERNEL_DEFINE(float, float, vfloat, vfmask, FLOAT_LANES)
+KERNEL_DEFINE(double, double, vdouble, vdmask, DOUBLE_LANES)
+
+/* Calcule la ligne en float, puis recalcule en double les pixels qui
+ * s'échappent après au moins MIXED_THRESHOLD itérations */
+static void
+kernel_mixed(const double *re, double im, int n, int iterations, int *counts)
+{
+    double again[MIXED_BLOCK];
+    int index[MIXED_BLOCK], result[MIXED_BLOCK];
+    int m = 0;
+
+    kernel_float(re, im, n, iterations, counts);
+
+    for(int i = 0; i < n; ++i) {
+        if(counts[i] >= MIXED_THRESHOLD && counts[i] < iterations) {
+            again[m] = re[i];
+            index[m++] = i;
+        }
+
+        if(m == MIXED_BLOCK || (m > 0 && i == n - 1)) {
+            kernel_double(again, im, m, iterations, result);
+            for(int j = 0; j < m; ++j) {
+                counts[index[j]] = result[j];
+            }
+            m = 0;
+        }
+    }
+}
+
+void
+kernel_row(enum mandel_kernel kernel, const double *re, double im, int n,
+           int iterations, int *counts)
+{
+    switch(kernel) {
+    case KERNEL_FLOAT:
+        kernel_float(re, im, n, iterations, counts);
+        break;
+    case KERNEL_MIXED:
+        kernel_mixed(re, im, n, iterations, counts);
+        break;
+    default:
+        kernel_double(re, im, n, iterations, counts);
+        break;
+    }
+}
@@ -1,7 +1,9 @@
 #include "../includes/mandelbrot.h"
+#include "../includes/microbench.h"
 #include "../includes/quicksort.h"
+#include "../includes/tune.h"
+#include "../includes/wavefront.h"
 
-#include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -11,14 +13,21 @@ main(int argc, char *argv[])
 {
     int serial = 0;
     int nthreads = -1;
+    int nprocs = 0;
     int qlen = -1;
 
     int quicksort = 0;
     int mandelbrot = 0;
+    int wavefront = 0;
+    int tune = 0;
+    char *micro = NULL;
+    struct mandelbrot_options mandelbrot_options = {0};
+    int sort_type = SORT_INT32;
+    int kernel;
     double delay;
 
     int opt;
-    while((opt = getopt(argc, argv, "qmst:n:")) != -1) {
+    while((opt = getopt(argc, argv, "qmwpTb:st:n:k:z:a:o:f:v:D:")) != -1) {
         if(opt < 0) {
             goto usage;
         }
@@ -30,37 +39,133 @@ main(int argc, char *argv[])
         case 'm':
             mandelbrot = 1;
             break;
+        case 'w':
+            wavefront = 1;
+            break;
+        case 'b':
+            micro = optarg;
+            break;
         case 's':
             serial = 1;
             break;
+        case 'T':
+            tune = 1;
+            break;
         case 't':
             nthreads = atoi(optarg);
             break;
         case 'n':
             qlen = atoi(optarg);
             break;
+        case 'D':
+            if((nprocs = atoi(optarg)) < 1) {
+                goto usage;
+            }
+            break;
+        case 'z':
+            if((mandelbrot_options.zoom = atof(optarg)) < 1) {
+                goto usage;
+            }
+            break;
+        case 'a':
+            if((mandelbrot_options.frames = atoi(optarg)) < 1) {
+                goto usage;
+            }
+            break;
+        case 'p':
+            mandelbrot_options.progressive = 1;
+            break;
+        case 'o':
+            mandelbrot_options.output = optarg;
+            break;
+        case 'f':
+            if((kernel = kernel_parse(optarg)) < 0) {
+                goto usage;
+            }
+            mandelbrot_options.kernel = kernel;
+            break;
+        case 'v':
+            mandelbrot_options.verify = 1;
+            if((mandelbrot_options.budget = atof(optarg)) < 0) {
+                goto usage;
+            }
+            break;
+        case 'k':
+            if((sort_type = sort_type_parse(optarg)) < 0) {
+                goto usage;
+            }
+            break;
         default:
             goto usage;
         }
     }
-    if(nthreads < 0 && !serial) {
+    if((nthreads < 0 && !serial) || (tune && serial)) {
+        goto usage;
+    }
+    // Réparti : seulement la vue d'ensemble et les clés int32
+    if(nprocs > 0 &&
+       (serial || sort_type != SORT_INT32 || mandelbrot_options.zoom > 0 ||
+        mandelbrot_options.frames > 0 || mandelbrot_options.progressive ||
+        mandelbrot_options.verify || mandelbrot_options.kernel)) {
+        goto usage;
+    }
+    // Un seul mode de mandelbrot à la fois
+    if((mandelbrot_options.frames > 0) + (mandelbrot_options.zoom > 0) +
+           mandelbrot_options.progressive > 1) {
         goto usage;
     }
+    // Pas de noyau pour la perturbation, et la vérification ne porte que
+    // sur la vue d'ensemble calculée d'un coup
+    if((mandelbrot_options.zoom > 0 && mandelbrot_options.kernel) ||
+       (mandelbrot_options.verify &&
+        (mandelbrot_options.frames > 0 || mandelbrot_options.zoom > 0 ||
+         mandelbrot_options.progressive))) {
+        goto usage;
+    }
+
+    // Réglages cherchés maintenant, ou trouvés lors d'un réglage précédent
+    if(tune) {
+        if(tune_run(nthreads) < 0) {
+            return 1;
+        }
+        if(!micro && !quicksort && !mandelbrot && !wavefront) {
+            return 0;
+        }
+    } else if(!serial) {
+        tune_load(nthreads);
+    }
 
-    if(quicksort) {
-        delay = benchmark_quicksort(serial, nthreads, qlen);
+    if(micro) {
+        if((delay = benchmark_micro(micro, nthreads, qlen)) < 0) {
+            goto usage;
+        }
+    } else if(quicksort && nprocs > 0) {
+        delay = benchmark_quicksort_distributed(nprocs, nthreads, qlen);
+    } else if(quicksort) {
+        delay = benchmark_quicksort(serial, nthreads, qlen, sort_type, 0);
+    } else if(mandelbrot && nprocs > 0) {
+        delay = benchmark_mandelbrot_distributed(nprocs, nthreads, qlen);
     } else if(mandelbrot) {
-        delay = benchmark_mandelbrot(serial, nthreads, qlen);
+        delay = benchmark_mandelbrot(serial, nthreads, qlen,
+                                     &mandelbrot_options);
+    } else if(wavefront) {
+        delay = benchmark_wavefront(serial, nthreads, qlen);
     } else {
         goto usage;
     }
 
-    assert(delay >= 0.0);
+    // L'erreur a déjà été affichée
+    if(delay < 0) {
+        return 1;
+    }
     printf("Done in %lf seconds.\n", delay);
 
     return 0;
 
 usage:
-    printf("Usage: %s -q|m [-t threads] [-s]\n", argv[0]);
+    printf("Usage: %s -q|m|w|b name [-t threads] [-s] [-n qlen] [-k type] "
+           "[-z zoom | -a frames [-o file] | -p] [-f kernel] [-v budget] "
+           "[-D processes] [-T]\n",
+           argv[0]);
     return 1;
 }
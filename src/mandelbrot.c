@@ -1,46 +1,85 @@
 #include "../includes/mandelbrot.h"
+#include "../includes/animation.h"
+#include "../includes/distrib.h"
+#include "../includes/hugepage.h"
+#include "../includes/kernels.h"
+#include "../includes/parallel.h"
+#include "../includes/perturbation.h"
 #include "../includes/sched.h"
+#include "../includes/tune.h"
 
 #include <assert.h>
 #include <complex.h>
-#include <errno.h>
+#include <math.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
 
 #define WIDTH 3840
 #define HEIGHT 2160
-#define ITERATIONS 1000
-#define CHUNK_SIZE 8
+#define ITERATIONS MANDEL_ITERATIONS
 
 #define SCALE (WIDTH / 4.0)
 #define DX (WIDTH / 2)
 #define DY (HEIGHT / 2)
 
-struct mandelbrot_args {
+/* Centre des vues profondes, dans la vallée des hippocampes, en double-double
+ * (-0.743643887037158704752191506114774 + 0.131825904205311970493132056385139
+ * i) */
+static const struct dd_complex deep_center = {
+    -0.7436438870371587, -3.628952515063387e-17,
+    0.13182590420531198, -1.2892807754956675e-17};
+
+/* Pixels calculés à la fois par draw_kernel */
+#define ROW_BLOCK 64
+
+/* Vue d'ensemble calculée avec un noyau vectorisé */
+struct render {
     unsigned int *image;
-    int start_x, start_y, end_x, end_y;
+    enum mandel_kernel kernel;
+
+    /* Lignes calculées, [0, HEIGHT[ pour toute l'image */
+    int y0, y1;
 };
 
-struct mandelbrot_args *
-new_mandelbrot_args(unsigned int *image, int start_x, int start_y, int end_x,
-                    int end_y)
-{
-    struct mandelbrot_args *args;
+/* Pas entre deux pixels calculés à chaque passe du rendu progressif : 1/16
+ * des pixels, puis 1/4, puis tous */
+static const int progressive_steps[] = {4, 2, 1};
 
-    if(!(args = malloc(sizeof(struct mandelbrot_args)))) {
-        perror("Mandelbrot parameters");
-        return NULL;
-    }
+#define PROGRESSIVE_PASSES                                                     \
+    (int)(sizeof(progressive_steps) / sizeof(progressive_steps[0]))
 
-    args->image = image;
-    args->start_x = start_x;
-    args->start_y = start_y;
-    args->end_x = end_x;
-    args->end_y = end_y;
+/* Rendu progressif en cours */
+struct progressive {
+    unsigned int *image;
+    enum mandel_kernel kernel;
 
-    return args;
-}
+    /* Passe en cours */
+    int pass;
+
+    /* Début du rendu et fin de chaque passe */
+    struct timespec begin;
+    struct timespec ends[PROGRESSIVE_PASSES];
+};
+
+/* Vue profonde en cours de calcul */
+struct deep {
+    unsigned int *image;
+
+    /* Orbite de référence, celle du centre */
+    struct perturbation *ref;
+
+    /* Écart entre deux pixels */
+    double spacing;
+
+    /* Itérations maximum */
+    int iterations;
+
+    /* Totaux des itérations et des rebasages */
+    atomic_long total;
+    atomic_long rebases;
+};
 
 int
 mandel(double complex c)
@@ -99,71 +138,217 @@ pixel(unsigned int *image, int x, int y)
 }
 
 void
-draw(void *closure, struct scheduler *s)
-{
-    struct mandelbrot_args *args = (struct mandelbrot_args *)closure;
-    unsigned int *image = args->image;
-    int start_x = args->start_x;
-    int start_y = args->start_y;
-    int end_x = args->end_x;
-    int end_y = args->end_y;
-
-    free(closure);
-
-    if((end_x - start_x) < CHUNK_SIZE && (end_y - start_y) < CHUNK_SIZE) {
-        // Si le morceau est petit alors on dessine
-        for(int y = start_y; y < end_y; y++) {
-            for(int x = start_x; x < end_x; x++) {
-                pixel(image, x, y);
-            }
+draw(int start_x, int start_y, int end_x, int end_y, void *arg,
+     struct scheduler *s)
+{
+    unsigned int *image = (unsigned int *)arg;
+
+    (void)s;
+
+    for(int y = start_y; y < end_y; y++) {
+        for(int x = start_x; x < end_x; x++) {
+            pixel(image, x, y);
         }
-    } else {
-        // Sinon on recoupe le morceau
-        int mid_x = (start_x + end_x) / 2;
-        int mid_y = (start_y + end_y) / 2;
-        int rc;
-
-        while((rc = sched_spawn(
-                   draw,
-                   new_mandelbrot_args(image, start_x, start_y, mid_x, mid_y),
-                   s)) < 0) {
-            if(errno != EAGAIN) {
-                break;
+    }
+}
+
+void
+draw_kernel(int start_x, int start_y, int end_x, int end_y, void *arg,
+            struct scheduler *s)
+{
+    struct render *r = (struct render *)arg;
+    double re[ROW_BLOCK];
+    int counts[ROW_BLOCK];
+
+    (void)s;
+
+    for(int y = start_y; y < end_y; y++) {
+        for(int x0 = start_x; x0 < end_x; x0 += ROW_BLOCK) {
+            int n = end_x - x0 < ROW_BLOCK ? end_x - x0 : ROW_BLOCK;
+
+            // Mêmes coordonnées que toc
+            for(int i = 0; i < n; i++) {
+                re[i] = (x0 + i - (int)DX) / SCALE;
             }
-        }
-        assert(rc >= 0);
+            kernel_row(r->kernel, re, (y - (int)DY) / SCALE, n, ITERATIONS,
+                       counts);
 
-        while(
-            (rc = sched_spawn(
-                 draw, new_mandelbrot_args(image, mid_x, start_y, end_x, mid_y),
-                 s)) < 0) {
-            if(errno != EAGAIN) {
-                break;
+            for(int i = 0; i < n; i++) {
+                r->image[y * WIDTH + x0 + i] = torgb(counts[i]);
             }
         }
+    }
+}
+
+void
+draw_kernel_root(void *closure, struct scheduler *s)
+{
+    struct render *r = (struct render *)closure;
+    int rc = parallel_for_2d(0, r->y0, WIDTH, r->y1, tuning.chunk,
+                             tuning.chunk, draw_kernel, NULL, closure, s);
+    assert(rc >= 0);
+}
+
+/* Tâche distribuée : calcule le rectangle [args[0], args[2][ x [args[1],
+ * args[3][, coupé en deux selon sa plus grande dimension tant qu'il dépasse
+ * tuning.chunk x tuning.chunk */
+static void
+draw_distributed(const struct distrib_task *t, void *arg, struct distrib *d,
+                 struct scheduler *s)
+{
+    int x0 = t->args[0], y0 = t->args[1], x1 = t->args[2], y1 = t->args[3];
+    int rc;
+
+    if(x1 - x0 <= tuning.chunk && y1 - y0 <= tuning.chunk) {
+        draw_kernel(x0, y0, x1, y1, arg, s);
+        return;
+    }
+
+    if(x1 - x0 >= y1 - y0) {
+        int mid = x0 + (x1 - x0) / 2;
+
+        rc = distrib_spawn(d, &(struct distrib_task){0, {x0, y0, mid, y1}}, s);
+        assert(rc >= 0);
+        rc = distrib_spawn(d, &(struct distrib_task){0, {mid, y0, x1, y1}}, s);
         assert(rc >= 0);
+    } else {
+        int mid = y0 + (y1 - y0) / 2;
 
-        while(
-            (rc = sched_spawn(
-                 draw, new_mandelbrot_args(image, start_x, mid_y, mid_x, end_y),
-                 s)) < 0) {
-            if(errno != EAGAIN) {
-                break;
-            }
-        }
+        rc = distrib_spawn(d, &(struct distrib_task){0, {x0, y0, x1, mid}}, s);
+        assert(rc >= 0);
+        rc = distrib_spawn(d, &(struct distrib_task){0, {x0, mid, x1, y1}}, s);
         assert(rc >= 0);
+    }
+}
+
+/* Calcule les pixels de la passe en cours dans [start_x, end_x[ x [start_y,
+ * end_y[, en coordonnées de la grille de la passe. Chaque pixel calculé
+ * remplit le bloc de step x step pixels qu'il représente, jusqu'à ce qu'une
+ * passe plus fine le découpe. Les pixels déjà calculés par la passe
+ * précédente sont sautés */
+void
+draw_progressive(int start_x, int start_y, int end_x, int end_y, void *arg,
+                 struct scheduler *s)
+{
+    struct progressive *p = (struct progressive *)arg;
+    int step = progressive_steps[p->pass];
+    int previous = p->pass > 0 ? progressive_steps[p->pass - 1] : 0;
+    double re[ROW_BLOCK];
+    int xs[ROW_BLOCK], counts[ROW_BLOCK];
+
+    (void)s;
+
+    for(int j = start_y; j < end_y; j++) {
+        int y = j * step;
+
+        // Les pixels de la ligne qui restent à calculer sont rassemblés par
+        // blocs pour le noyau
+        for(int i = start_x; i < end_x;) {
+            int n = 0;
+
+            for(; i < end_x && n < ROW_BLOCK; i++) {
+                int x = i * step;
+
+                if(previous && x % previous == 0 && y % previous == 0) {
+                    continue;
+                }
+                xs[n] = x;
+                re[n++] = (x - (int)DX) / SCALE;
+            }
+            kernel_row(p->kernel, re, (y - (int)DY) / SCALE, n, ITERATIONS,
+                       counts);
+
+            for(int k = 0; k < n; k++) {
+                unsigned int rgb = torgb(counts[k]);
 
-        while((rc = sched_spawn(
-                   draw, new_mandelbrot_args(image, mid_x, mid_y, end_x, end_y),
-                   s)) < 0) {
-            if(errno != EAGAIN) {
-                break;
+                for(int by = y; by < y + step && by < HEIGHT; by++) {
+                    for(int bx = xs[k]; bx < xs[k] + step && bx < WIDTH;
+                         bx++) {
+                        p->image[by * WIDTH + bx] = rgb;
+                    }
+                }
             }
         }
-        assert(rc >= 0);
     }
 }
 
+void draw_progressive_done(void *arg, struct scheduler *s);
+
+/* Lance la passe en cours, sur la grille de ses pixels */
+static void
+progressive_pass(struct progressive *p, struct scheduler *s)
+{
+    int step = progressive_steps[p->pass];
+    int rc;
+
+    rc = parallel_for_2d(0, 0, (WIDTH + step - 1) / step,
+                         (HEIGHT + step - 1) / step, tuning.chunk, tuning.chunk,
+                         draw_progressive, draw_progressive_done, p, s);
+    assert(rc >= 0);
+}
+
+/* Fin d'une passe : l'image est utilisable à sa résolution, la passe suivante
+ * ne commence qu'ensuite pour ne pas être recouverte par ses blocs */
+void
+draw_progressive_done(void *arg, struct scheduler *s)
+{
+    struct progressive *p = (struct progressive *)arg;
+
+    clock_gettime(CLOCK_MONOTONIC, &p->ends[p->pass]);
+
+    if(++p->pass < PROGRESSIVE_PASSES) {
+        progressive_pass(p, s);
+    }
+}
+
+void
+draw_progressive_root(void *closure, struct scheduler *s)
+{
+    progressive_pass((struct progressive *)closure, s);
+}
+
+void
+draw_deep(int start_x, int start_y, int end_x, int end_y, void *arg,
+          struct scheduler *s)
+{
+    struct deep *d = (struct deep *)arg;
+    long total = 0, rebases = 0;
+
+    (void)s;
+
+    for(int y = start_y; y < end_y; y++) {
+        for(int x = start_x; x < end_x; x++) {
+            int n = perturbation_iterate(d->ref, (x - DX) * d->spacing,
+                                         (y - DY) * d->spacing, &rebases);
+
+            // Les couleurs bouclent, l'intérieur reste blanc
+            d->image[y * WIDTH + x] =
+                torgb(n < d->iterations ? n % ITERATIONS : ITERATIONS);
+            total += n;
+        }
+    }
+
+    atomic_fetch_add_explicit(&d->total, total, memory_order_relaxed);
+    atomic_fetch_add_explicit(&d->rebases, rebases, memory_order_relaxed);
+}
+
+void
+draw_deep_root(void *closure, struct scheduler *s)
+{
+    int rc = parallel_for_2d(0, 0, WIDTH, HEIGHT, tuning.chunk, tuning.chunk,
+                             draw_deep, NULL, closure, s);
+    assert(rc >= 0);
+}
+
+void
+draw_root(void *closure, struct scheduler *s)
+{
+    // Découpe l'image en morceaux d'au plus tuning.chunk x tuning.chunk pixels
+    int rc = parallel_for_2d(0, 0, WIDTH, HEIGHT, tuning.chunk, tuning.chunk,
+                             draw, NULL, closure, s);
+    assert(rc >= 0);
+}
+
 void
 draw_serial(unsigned int *image)
 {
@@ -174,38 +359,297 @@ draw_serial(unsigned int *image)
     }
 }
 
-double
-benchmark_mandelbrot(int serial, int nthreads, int qlen)
+/* Calcule la vue profonde de grossissement zoom dans image
+ *
+ * Renvoie le temps d'exécution, orbite de référence comprise */
+static double
+render_deep(unsigned int *image, double zoom, int serial, int nthreads,
+            int qlen)
 {
-    unsigned int *image;
-    struct timespec begin, end;
+    struct timespec begin, middle, end;
+    struct deep d;
     double delay;
     int rc;
+
+    // Plus la vue est profonde, plus les points proches du bord mettent
+    // longtemps à s'échapper
+    d.iterations = ITERATIONS * (1 + (int)log10(zoom));
+    d.image = image;
+    d.spacing = 4.0 / zoom / WIDTH;
+    atomic_init(&d.total, 0);
+    atomic_init(&d.rebases, 0);
+
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    if(!(d.ref = perturbation_new(deep_center, d.iterations))) {
+        return -1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &middle);
+
+    if(serial) {
+        draw_deep(0, 0, WIDTH, HEIGHT, &d, NULL);
+    } else {
+        rc = sched_init(nthreads, qlen, draw_deep_root, &d);
+        assert(rc >= 0);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    delay = end.tv_sec + end.tv_nsec / 1000000000.0 -
+            (begin.tv_sec + begin.tv_nsec / 1000000000.0);
+
+    long total = atomic_load(&d.total);
+    printf("Zoom %g par perturbation : %d itérations au plus, référence de %d "
+           "itérations en %.3f ms\n",
+           zoom, d.iterations, perturbation_length(d.ref),
+           (middle.tv_sec - begin.tv_sec) * 1e3 +
+               (middle.tv_nsec - begin.tv_nsec) / 1e6);
+    printf(" %.0f itérations par pixel, %.2f ns par itération, %.2f "
+           "rebasages par pixel\n",
+           (double)total / (WIDTH * HEIGHT), delay * 1e9 / total,
+           (double)atomic_load(&d.rebases) / (WIDTH * HEIGHT));
+
+    perturbation_free(d.ref);
+    return delay;
+}
+
+/* Calcule la vue d'ensemble avec le noyau kernel, ou avec le calcul
+ * scalaire de référence si reference vaut 1. Le noyau ne calcule que les rows
+ * lignes du centre
+ *
+ * Renvoie le temps d'exécution */
+static double
+render(unsigned int *image, enum mandel_kernel kernel, int reference,
+       int rows, int serial, int nthreads, int qlen)
+{
+    struct render r = {image, kernel, (HEIGHT - rows) / 2,
+                       (HEIGHT - rows) / 2 + rows};
+    struct timespec begin, end;
+    int rc;
+
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    if(serial && reference) {
+        draw_serial(image);
+    } else if(serial) {
+        draw_kernel(0, r.y0, WIDTH, r.y1, &r, NULL);
+    } else {
+        rc = reference ? sched_init(nthreads, qlen, draw_root, image)
+                       : sched_init(nthreads, qlen, draw_kernel_root, &r);
+        assert(rc >= 0);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return end.tv_sec + end.tv_nsec / 1000000000.0 -
+           (begin.tv_sec + begin.tv_nsec / 1000000000.0);
+}
+
+/* Renvoie le nombre de pixels de image différents de ceux de reference */
+static long
+compare(const unsigned int *image, const unsigned int *reference)
+{
+    long diff = 0;
+
+    for(int i = 0; i < WIDTH * HEIGHT; i++) {
+        diff += image[i] != reference[i];
+    }
+
+    return diff;
+}
+
+/* Renvoie le noyau demandé, ou celui choisi d'après l'écart entre deux
+ * pixels de la vue d'ensemble */
+static enum mandel_kernel
+overview_kernel(const struct mandelbrot_options *options)
+{
+    // Les coordonnées vont jusqu'à DX / SCALE en valeur absolue
+    if(options->kernel == KERNEL_AUTO) {
+        return kernel_select(1 / SCALE, (DX > DY ? DX : DY) / SCALE);
+    }
+
+    return options->kernel;
+}
+
+/* Calcule la vue d'ensemble avec le noyau demandé, puis la compare à
+ * l'image de référence si demandé
+ *
+ * Renvoie le temps d'exécution du dernier noyau utilisé, -1 en cas d'échec
+ * ou si la dernière image comparée dépasse le budget */
+static double
+render_kernel(unsigned int *image, const struct mandelbrot_options *options,
+              int serial, int nthreads, int qlen)
+{
+    enum mandel_kernel kernel = overview_kernel(options);
     int n = WIDTH * HEIGHT;
+    int rows = options->rows > 0 && options->rows < HEIGHT ? options->rows
+                                                           : HEIGHT;
+    unsigned int *reference;
+    double delay;
+    int ok;
+
+    delay = render(image, kernel, 0, rows, serial, nthreads, qlen);
+    printf("Noyau %s%s\n", kernel_name(kernel),
+           options->kernel == KERNEL_AUTO ? " (choisi automatiquement)" : "");
+
+    if(!options->verify) {
+        return delay;
+    }
+
+    if(!(reference = huge_alloc(n * sizeof(unsigned int)))) {
+        perror("Reference allocation");
+        return -1;
+    }
+    render(reference, KERNEL_DOUBLE, 1, HEIGHT, serial, nthreads, qlen);
+
+    while(1) {
+        long diff = compare(image, reference);
+
+        ok = diff <= options->budget / 100 * n;
+        printf("Vérification : %ld pixels différents de la référence en "
+               "double (%.4f %%, budget %.4f %%) : %s\n",
+               diff, 100.0 * diff / n, options->budget,
+               ok ? "ok" : "hors budget");
+
+        // Seul un noyau choisi automatiquement peut être remplacé
+        if(ok || options->kernel != KERNEL_AUTO || kernel == KERNEL_DOUBLE) {
+            break;
+        }
+
+        kernel++;
+        delay = render(image, kernel, 0, rows, serial, nthreads, qlen);
+        printf("Noyau %s\n", kernel_name(kernel));
+    }
+
+    huge_free(reference);
+
+    // Une vérification qui échoue doit pouvoir arrêter un script
+    if(!ok) {
+        fprintf(stderr, "Image out of the %.4f %% budget\n", options->budget);
+        return -1;
+    }
+
+    return delay;
+}
+
+double
+benchmark_mandelbrot_distributed(int nprocs, int nthreads, int qlen)
+{
+    static const distrib_func funcs[] = {draw_distributed};
+    struct distrib_task root = {0, {0, 0, WIDTH, HEIGHT}};
+    struct timespec begin, end;
+    size_t size = WIDTH * HEIGHT * sizeof(unsigned int);
+    struct render r;
+    int rc;
 
     if(qlen <= 0) {
-        qlen = n;
+        qlen = WIDTH * HEIGHT / (tuning.chunk * tuning.chunk) /
+               tuning.mandelbrot_qlen;
     }
 
-    if(!(image = malloc(n * sizeof(unsigned int)))) {
-        perror("Image allocation");
-        return 1;
+    // Écrite directement par tous les processus
+    if(!(r.image = distrib_shared(size))) {
+        return -1;
     }
+    r.kernel = kernel_select(1 / SCALE, (DX > DY ? DX : DY) / SCALE);
+    r.y0 = 0;
+    r.y1 = HEIGHT;
 
     clock_gettime(CLOCK_MONOTONIC, &begin);
 
+    rc = distrib_run(nprocs, nthreads, qlen, funcs, 1, &r, &root);
+    if(rc < 0) {
+        distrib_shared_free(r.image, size);
+        return -1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    printf("Noyau %s (choisi automatiquement)\n", kernel_name(r.kernel));
+    distrib_shared_free(r.image, size);
+    return end.tv_sec + end.tv_nsec / 1000000000.0 -
+           (begin.tv_sec + begin.tv_nsec / 1000000000.0);
+}
+
+/* Calcule la vue d'ensemble par passes de plus en plus fines, et affiche
+ * quand chacune est terminée
+ *
+ * Renvoie le temps d'exécution */
+static double
+render_progressive(unsigned int *image,
+                   const struct mandelbrot_options *options, int serial,
+                   int nthreads, int qlen)
+{
+    struct progressive p = {.image = image};
+    int rc;
+
+    p.kernel = overview_kernel(options);
+
+    clock_gettime(CLOCK_MONOTONIC, &p.begin);
+
     if(serial) {
-        draw_serial(image);
+        for(; p.pass < PROGRESSIVE_PASSES; p.pass++) {
+            int step = progressive_steps[p.pass];
+
+            draw_progressive(0, 0, (WIDTH + step - 1) / step,
+                             (HEIGHT + step - 1) / step, &p, NULL);
+            clock_gettime(CLOCK_MONOTONIC, &p.ends[p.pass]);
+        }
     } else {
-        rc = sched_init(nthreads, qlen, draw,
-                        new_mandelbrot_args(image, 0, 0, WIDTH, HEIGHT));
+        rc = sched_init(nthreads, qlen, draw_progressive_root, &p);
         assert(rc >= 0);
     }
 
-    clock_gettime(CLOCK_MONOTONIC, &end);
-    delay = end.tv_sec + end.tv_nsec / 1000000000.0 -
-            (begin.tv_sec + begin.tv_nsec / 1000000000.0);
+    printf("Noyau %s%s\n", kernel_name(p.kernel),
+           options->kernel == KERNEL_AUTO ? " (choisi automatiquement)" : "");
+    printf("Rendu progressif :");
+    for(int i = 0; i < PROGRESSIVE_PASSES; ++i) {
+        int step = progressive_steps[i];
+
+        printf("%s 1/%d en %.3f s", i > 0 ? "," : "", step * step,
+               p.ends[i].tv_sec - p.begin.tv_sec +
+                   (p.ends[i].tv_nsec - p.begin.tv_nsec) / 1e9);
+    }
+    printf("\n");
+
+    return p.ends[PROGRESSIVE_PASSES - 1].tv_sec - p.begin.tv_sec +
+           (p.ends[PROGRESSIVE_PASSES - 1].tv_nsec - p.begin.tv_nsec) / 1e9;
+}
+
+double
+benchmark_mandelbrot(int serial, int nthreads, int qlen,
+                     const struct mandelbrot_options *options)
+{
+    unsigned int *image;
+    double delay;
+    int n = WIDTH * HEIGHT;
+
+    if(options->frames > 0) {
+        return benchmark_animation(serial, nthreads, qlen, options->frames,
+                                   options->output, options->kernel);
+    }
+
+    if(qlen <= 0) {
+        qlen = n / tuning.mandelbrot_qlen;
+    }
+
+    // Pas d'initialisation : chaque page est touchée en premier par le
+    // thread qui calcule ses pixels
+    if(!(image = huge_alloc(n * sizeof(unsigned int)))) {
+        perror("Image allocation");
+        return 1;
+    }
+
+    if(options->zoom > 0) {
+        delay = render_deep(image, options->zoom, serial, nthreads, qlen);
+    } else if(options->progressive) {
+        delay = render_progressive(image, options, serial, nthreads, qlen);
+    } else {
+        delay = render_kernel(image, options, serial, nthreads, qlen);
+    }
+
+    huge_report("image", huge_backed(image, n * sizeof(unsigned int)),
+                n * sizeof(unsigned int));
 
-    free(image);
+    huge_free(image);
     return delay;
 }
@@ -0,0 +1,646 @@
+#include "../includes/microbench.h"
+#include "../includes/parallel.h"
+#include "../includes/priority.h"
+#include "../includes/search.h"
+#include "../includes/submit.h"
+#include "../includes/wait.h"
+#include "../includes/sched.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Profondeur de l'arbre du benchmark spawn */
+#define SPAWN_DEPTH 18
+
+/* Rang calculé par le benchmark fib */
+#define FIB_N 25
+
+/* Arbre du benchmark uts : la racine a UTS_ROOT enfants, puis chaque noeud a
+ * UTS_M enfants avec une probabilité UTS_Q, aucun sinon */
+#define UTS_ROOT 2000
+#define UTS_M 8
+#define UTS_Q 0.1249
+
+/* Nombre de tâches créées par le producteur du benchmark fanout */
+#define FANOUT 262144
+
+/* Intervalle et grain des boucles du benchmark reduce */
+#define REDUCE_N (1 << 22)
+#define REDUCE_GRAIN 4096
+
+/* Allers-retours du benchmark pingpong */
+#define PINGPONG_ROUNDS 1000
+
+/* Temps d'attente maximal d'un vol dans le benchmark pingpong */
+#define PINGPONG_TIMEOUT 0.001
+
+/* Taille d'une ligne de cache */
+#define CACHE_LINE 64
+
+/* Micro-benchmark */
+struct micro {
+    /* Nom donné en ligne de commande */
+    const char *name;
+
+    /* Tâche initiale */
+    taskfunc root;
+
+    /* Prépare une exécution, renvoie le nombre de tâches à exécuter */
+    long (*setup)(int nthreads);
+
+    /* Vérifie l'exécution, peut écrire des informations en plus dans le
+     * tampon (peut être NULL) */
+    int (*check)(char *, size_t);
+
+    /* Taille de file nécessaire */
+    int qlen;
+};
+
+/* Compteur par thread, sur sa propre ligne de cache */
+struct counter {
+    alignas(CACHE_LINE) atomic_long n;
+};
+
+/* Compteurs des threads, le dernier est partagé par les threads extérieurs à
+ * l'ordonnanceur */
+static struct counter *counters;
+static int ncounters;
+
+static double
+now(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+/* Ajoute une tâche, en réessayant tant que l'ordonnanceur est plein */
+static void
+spawn(taskfunc f, void *closure, struct scheduler *s)
+{
+    int rc;
+
+    while((rc = sched_spawn(f, closure, s)) < 0) {
+        if(errno != EAGAIN) {
+            break;
+        }
+    }
+    assert(rc >= 0);
+}
+
+static int
+counters_init(int nthreads)
+{
+    free(counters);
+    ncounters = nthreads + 1;
+    if(!(counters = aligned_alloc(CACHE_LINE,
+                                  ncounters * sizeof(struct counter)))) {
+        perror("Counters");
+        return -1;
+    }
+    for(int i = 0; i < ncounters; ++i) {
+        atomic_init(&counters[i].n, 0);
+    }
+
+    return 0;
+}
+
+static void
+counters_add(long v, struct scheduler *s)
+{
+    int i = sched_self(s);
+
+    if(i < 0 || i >= ncounters - 1) {
+        i = ncounters - 1;
+    }
+    atomic_fetch_add_explicit(&counters[i].n, v, memory_order_relaxed);
+}
+
+static long
+counters_sum(void)
+{
+    long sum = 0;
+
+    for(int i = 0; i < ncounters; ++i) {
+        sum += atomic_load(&counters[i].n);
+    }
+
+    return sum;
+}
+
+/* spawn : tâche vide qui crée deux sous-arbres de profondeur closure - 1 */
+void
+spawn_tree(void *closure, struct scheduler *s)
+{
+    intptr_t depth = (intptr_t)closure;
+
+    if(depth > 0) {
+        spawn(spawn_tree, (void *)(depth - 1), s);
+        spawn(spawn_tree, (void *)(depth - 1), s);
+    }
+}
+
+void
+spawn_root(void *closure, struct scheduler *s)
+{
+    (void)closure;
+    spawn_tree((void *)SPAWN_DEPTH, s);
+}
+
+static long
+spawn_setup(int nthreads)
+{
+    (void)nthreads;
+    return (2L << SPAWN_DEPTH) - 1;
+}
+
+/* fib : fib(n) crée fib(n - 1) et fib(n - 2), les feuilles ajoutent leur
+ * valeur au compteur de leur thread */
+void
+fib(void *closure, struct scheduler *s)
+{
+    intptr_t n = (intptr_t)closure;
+
+    if(n < 2) {
+        counters_add(n, s);
+        return;
+    }
+
+    spawn(fib, (void *)(n - 1), s);
+    spawn(fib, (void *)(n - 2), s);
+}
+
+void
+fib_root(void *closure, struct scheduler *s)
+{
+    (void)closure;
+    fib((void *)FIB_N, s);
+}
+
+static long
+fib_serial(int n)
+{
+    long a = 0, b = 1, t;
+
+    while(n-- > 0) {
+        t = a + b;
+        a = b;
+        b = t;
+    }
+
+    return a;
+}
+
+static long
+fib_setup(int nthreads)
+{
+    if(counters_init(nthreads) < 0) {
+        return -1;
+    }
+
+    // Un appel par noeud de l'arbre : 2 fib(n + 1) - 1
+    return 2 * fib_serial(FIB_N + 1) - 1;
+}
+
+static int
+fib_check(char *buf, size_t len)
+{
+    (void)buf;
+    (void)len;
+    return counters_sum() == fib_serial(FIB_N) ? 0 : -1;
+}
+
+/* uts : arbre déséquilibré, dont la forme ne dépend que de l'état de
+ * chaque noeud */
+static uint64_t
+splitmix64(uint64_t x)
+{
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+static int
+uts_children(uint64_t state, int root)
+{
+    if(root) {
+        return UTS_ROOT;
+    }
+
+    return (state >> 11) * (1.0 / 9007199254740992.0) < UTS_Q ? UTS_M : 0;
+}
+
+void
+uts(void *closure, struct scheduler *s)
+{
+    uint64_t state = (uintptr_t)closure;
+    int n = uts_children(state, 0);
+
+    counters_add(1, s);
+    for(int i = 0; i < n; ++i) {
+        spawn(uts, (void *)(uintptr_t)splitmix64(state + i), s);
+    }
+}
+
+void
+uts_root(void *closure, struct scheduler *s)
+{
+    (void)closure;
+
+    counters_add(1, s);
+    for(int i = 0; i < UTS_ROOT; ++i) {
+        spawn(uts, (void *)(uintptr_t)splitmix64(i), s);
+    }
+}
+
+/* Taille de l'arbre, calculée en série */
+static long
+uts_serial(void)
+{
+    static long size = 0;
+    uint64_t *stack;
+    long top = 0, cap = 2 * UTS_ROOT;
+
+    if(size > 0) {
+        return size;
+    }
+
+    if(!(stack = malloc(cap * sizeof(uint64_t)))) {
+        perror("UTS stack");
+        return -1;
+    }
+
+    size = 1;
+    for(int i = 0; i < UTS_ROOT; ++i) {
+        stack[top++] = splitmix64(i);
+    }
+    while(top > 0) {
+        uint64_t state = stack[--top];
+        int n = uts_children(state, 0);
+
+        size++;
+        if(top + n > cap) {
+            cap *= 2;
+            if(!(stack = realloc(stack, cap * sizeof(uint64_t)))) {
+                perror("UTS stack");
+                return -1;
+            }
+        }
+        for(int i = 0; i < n; ++i) {
+            stack[top++] = splitmix64(state + i);
+        }
+    }
+
+    free(stack);
+    return size;
+}
+
+static long
+uts_setup(int nthreads)
+{
+    if(counters_init(nthreads) < 0) {
+        return -1;
+    }
+
+    return uts_serial();
+}
+
+static int
+uts_check(char *buf, size_t len)
+{
+    (void)buf;
+    (void)len;
+    return counters_sum() == uts_serial() ? 0 : -1;
+}
+
+/* fanout : un seul producteur crée toutes les tâches */
+void
+empty_task(void *closure, struct scheduler *s)
+{
+    (void)closure;
+    counters_add(1, s);
+}
+
+void
+fanout_root(void *closure, struct scheduler *s)
+{
+    (void)closure;
+
+    for(int i = 0; i < FANOUT; ++i) {
+        spawn(empty_task, NULL, s);
+    }
+}
+
+static long
+fanout_setup(int nthreads)
+{
+    if(counters_init(nthreads) < 0) {
+        return -1;
+    }
+
+    return FANOUT + 1;
+}
+
+static int
+fanout_check(char *buf, size_t len)
+{
+    (void)buf;
+    (void)len;
+    return counters_sum() == FANOUT ? 0 : -1;
+}
+
+/* reduce : parallel_for remplit un tableau avec ses indices, puis
+ * parallel_reduce en fait la somme */
+static long *reduce_values;
+static long reduce_result;
+
+static void
+reduce_fill(int begin, int end, void *arg, struct scheduler *s)
+{
+    (void)arg;
+    (void)s;
+
+    for(int i = begin; i < end; ++i) {
+        reduce_values[i] = i;
+    }
+}
+
+static void
+reduce_sum(int begin, int end, void *acc, void *arg)
+{
+    long *sum = (long *)acc;
+
+    (void)arg;
+
+    for(int i = begin; i < end; ++i) {
+        *sum += reduce_values[i];
+    }
+}
+
+static void
+reduce_add(void *acc, const void *other, void *arg)
+{
+    (void)arg;
+    *(long *)acc += *(const long *)other;
+}
+
+static void
+reduce_store(void *result, void *arg, struct scheduler *s)
+{
+    (void)arg;
+    (void)s;
+    reduce_result = *(long *)result;
+}
+
+/* Lancé par la dernière tâche de parallel_for */
+static void
+reduce_filled(void *arg, struct scheduler *s)
+{
+    long zero = 0;
+    int rc;
+
+    (void)arg;
+
+    rc = parallel_reduce(0, REDUCE_N, REDUCE_GRAIN, sizeof(long), &zero,
+                         reduce_sum, reduce_add, reduce_store, NULL, s);
+    assert(rc >= 0);
+}
+
+void
+reduce_root(void *closure, struct scheduler *s)
+{
+    int rc;
+
+    (void)closure;
+
+    rc = parallel_for(0, REDUCE_N, REDUCE_GRAIN, reduce_fill, reduce_filled,
+                      NULL, s);
+    assert(rc >= 0);
+}
+
+static long
+reduce_setup(int nthreads)
+{
+    (void)nthreads;
+
+    free(reduce_values);
+    if(!(reduce_values = malloc(REDUCE_N * sizeof(long)))) {
+        perror("Reduce values");
+        return -1;
+    }
+    memset(reduce_values, 0xff, REDUCE_N * sizeof(long));
+    reduce_result = -1;
+
+    // Chaque boucle crée une tâche par morceau sauf le premier
+    return 2 * (REDUCE_N / REDUCE_GRAIN - 1) + 1;
+}
+
+static int
+reduce_check(char *buf, size_t len)
+{
+    (void)buf;
+    (void)len;
+
+    for(long i = 0; i < REDUCE_N; ++i) {
+        if(reduce_values[i] != i) {
+            return -1;
+        }
+    }
+
+    return reduce_result == (long)REDUCE_N * (REDUCE_N - 1) / 2 ? 0 : -1;
+}
+
+/* pingpong : une tâche en crée une autre puis attend qu'un autre thread la
+ * vole, ce qui mesure la latence d'un vol */
+struct pingpong_round {
+    /* 0 : en attente, 1 : volée, 2 : abandonnée */
+    atomic_int state;
+
+    /* Création de la tâche */
+    double created;
+
+    /* Début de la tâche */
+    double started;
+};
+
+static struct pingpong_round rounds[PINGPONG_ROUNDS];
+
+void
+pong(void *closure, struct scheduler *s)
+{
+    struct pingpong_round *r = (struct pingpong_round *)closure;
+    int expected = 0;
+
+    (void)s;
+
+    r->started = now();
+    atomic_compare_exchange_strong(&r->state, &expected, 1);
+}
+
+void
+ping(void *closure, struct scheduler *s)
+{
+    (void)closure;
+
+    for(int i = 0; i < PINGPONG_ROUNDS; ++i) {
+        struct pingpong_round *r = &rounds[i];
+        int expected = 0;
+
+        atomic_init(&r->state, 0);
+        r->created = now();
+        spawn(pong, r, s);
+
+        // Attend le vol, abandonne la manche si personne ne vient
+        while(atomic_load(&r->state) == 0) {
+            if(now() - r->created > PINGPONG_TIMEOUT &&
+               atomic_compare_exchange_strong(&r->state, &expected, 2)) {
+                break;
+            }
+            sched_yield();
+        }
+    }
+}
+
+static long
+pingpong_setup(int nthreads)
+{
+    (void)nthreads;
+    return 2 * PINGPONG_ROUNDS;
+}
+
+static int
+pingpong_check(char *buf, size_t len)
+{
+    double latency = 0;
+    int stolen = 0;
+
+    for(int i = 0; i < PINGPONG_ROUNDS; ++i) {
+        if(atomic_load(&rounds[i].state) == 1) {
+            latency += rounds[i].started - rounds[i].created;
+            stolen++;
+        }
+    }
+
+    if(stolen > 0) {
+        snprintf(buf, len, "  vol : %.0f ns (%d/%d)", latency * 1e9 / stolen,
+                 stolen, PINGPONG_ROUNDS);
+    } else {
+        snprintf(buf, len, "  vol : aucun (0/%d)", PINGPONG_ROUNDS);
+    }
+
+    return 0;
+}
+
+static struct micro micros[] = {
+    {"spawn", spawn_root, spawn_setup, NULL, 1 << 16},
+    {"fib", fib_root, fib_setup, fib_check, 1 << 16},
+    {"uts", uts_root, uts_setup, uts_check, 1 << 20},
+    {"fanout", fanout_root, fanout_setup, fanout_check, FANOUT},
+    {"pingpong", ping, pingpong_setup, pingpong_check, PINGPONG_ROUNDS},
+    {"reduce", reduce_root, reduce_setup, reduce_check, 1 << 16},
+};
+
+/* Benchmarks d'une fonctionnalité de l'ordonnanceur, lancés une seule fois
+ * avec nthreads threads et qui affichent leurs propres mesures */
+static const struct {
+    const char *name;
+    double (*run)(int nthreads, int qlen);
+} scenarios[] = {
+    {"prio", benchmark_priority},
+    {"search", benchmark_search},
+    {"wait", benchmark_wait},
+    {"submit", benchmark_submit},
+};
+
+/* Lance un micro-benchmark pour 1, 2, 4... nthreads threads */
+static double
+run_micro(struct micro *m, int nthreads, int qlen)
+{
+    double total = 0;
+    double delays[64];
+    char extra[64][64];
+    int threads[64];
+    int nruns = 0;
+    long ntasks = 0;
+
+    if(qlen <= 0) {
+        qlen = m->qlen;
+    }
+
+    for(int th = 1;; th = th * 2 < nthreads ? th * 2 : nthreads) {
+        double begin;
+        int rc;
+
+        if((ntasks = m->setup(th)) < 0) {
+            return -1;
+        }
+
+        begin = now();
+        rc = sched_init(th, qlen, m->root, NULL);
+        assert(rc >= 0);
+
+        threads[nruns] = th;
+        delays[nruns] = now() - begin;
+        extra[nruns][0] = '\0';
+        rc = m->check ? m->check(extra[nruns], sizeof(extra[nruns])) : 0;
+        assert(rc >= 0);
+        total += delays[nruns++];
+
+        if(th == nthreads) {
+            break;
+        }
+    }
+
+    printf("%s : %ld tâches\n", m->name, ntasks);
+    printf(" threads     secondes   ns/tâche      tâches/s\n");
+    for(int i = 0; i < nruns; ++i) {
+        printf(" %7d %12.6f %10.2f %13.0f%s\n", threads[i], delays[i],
+               delays[i] * 1e9 / ntasks, ntasks / delays[i], extra[i]);
+    }
+
+    return total;
+}
+
+double
+benchmark_micro(const char *name, int nthreads, int qlen)
+{
+    int all = strcmp(name, "all") == 0;
+    int found = 0;
+    double total = 0, delay;
+
+    if(nthreads <= 0) {
+        nthreads = sched_default_threads();
+    }
+
+    for(int i = 0; i < (int)(sizeof(micros) / sizeof(*micros)); ++i) {
+        if(all || strcmp(name, micros[i].name) == 0) {
+            found = 1;
+            if((delay = run_micro(&micros[i], nthreads, qlen)) < 0) {
+                return -1;
+            }
+            total += delay;
+        }
+    }
+
+    for(int i = 0; i < (int)(sizeof(scenarios) / sizeof(*scenarios)); ++i) {
+        if(strcmp(name, scenarios[i].name) == 0) {
+            found = 1;
+            if((delay = scenarios[i].run(nthreads, qlen)) < 0) {
+                return -1;
+            }
+            total += delay;
+        }
+    }
+
+    return found ? total : -1;
+}
@@ -0,0 +1,357 @@
+#include "../includes/parallel.h"
+#include "../includes/sched.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Nombre de morceaux par thread du partitionneur automatique */
+#define AUTO_CHUNKS 4
+
+/* Taille d'une ligne de cache, pour séparer les accumulateurs */
+#define CACHE_LINE 64
+
+enum parallel_kind {
+    PARALLEL_FOR,
+    PARALLEL_FOR_2D,
+    PARALLEL_REDUCE,
+};
+
+/* État partagé par toutes les tâches d'une boucle */
+struct parallel_ctx {
+    /* Nombre d'éléments restant à traiter */
+    atomic_long remaining;
+
+    enum parallel_kind kind;
+    union {
+        range_body body;
+        range2d_body body2d;
+        reduce_body rbody;
+    };
+    range_done done;
+    void *arg;
+
+    /* Taille maximale d'un morceau, 0 si partitionneur automatique */
+    int grain_x, grain_y;
+
+    /* Découpes supplémentaires accordées à un morceau volé */
+    int steal_depth;
+
+    /* Réduction : un accumulateur par thread, plus un pour les threads
+     * extérieurs à l'ordonnanceur, protégé par mutex */
+    reduce_join join;
+    reduce_done rdone;
+    size_t stride;
+    int nslots;
+    char *accs;
+    pthread_mutex_t mutex;
+};
+
+/* Morceau [x0, x1[ x [y0, y1[ à traiter */
+struct parallel_range {
+    struct parallel_ctx *ctx;
+    int x0, y0, x1, y1;
+
+    /* Découpes restantes du partitionneur automatique */
+    int depth;
+
+    /* Thread qui a créé la tâche */
+    int owner;
+};
+
+/* Exécute une tâche de découpe */
+void parallel_task(void *, struct scheduler *);
+
+/* Libère une tâche de découpe annulée */
+void parallel_cancel(void *, struct scheduler *);
+
+/* Options des tâches de découpe, libérées si elles sont annulées */
+static const struct sched_attr parallel_attr = {
+    SCHED_PRIO_NORMAL, SCHED_ANY_WORKER, NULL, parallel_cancel};
+
+/* Renvoie le plus petit n tel que 2^n >= x */
+static int
+log2_ceil(int x)
+{
+    int n = 0;
+    while((1 << n) < x) {
+        n++;
+    }
+    return n;
+}
+
+static struct parallel_ctx *
+new_parallel_ctx(enum parallel_kind kind, void *arg, int grain_x, int grain_y,
+                 struct scheduler *s)
+{
+    struct parallel_ctx *ctx;
+
+    if(!(ctx = malloc(sizeof(struct parallel_ctx)))) {
+        perror("Parallel context");
+        return NULL;
+    }
+
+    ctx->kind = kind;
+    ctx->arg = arg;
+    ctx->done = NULL;
+    ctx->grain_x = grain_x > 0 ? grain_x : 0;
+    ctx->grain_y = grain_y > 0 ? grain_y : 0;
+    ctx->steal_depth = log2_ceil(sched_nthreads(s)) + 1;
+    ctx->accs = NULL;
+
+    return ctx;
+}
+
+static void
+free_parallel_ctx(struct parallel_ctx *ctx)
+{
+    if(ctx->kind == PARALLEL_REDUCE) {
+        pthread_mutex_destroy(&ctx->mutex);
+        free(ctx->accs);
+    }
+    free(ctx);
+}
+
+/* Vrai si le morceau doit encore être coupé */
+static int
+splittable(struct parallel_range *r)
+{
+    struct parallel_ctx *ctx = r->ctx;
+    int w = r->x1 - r->x0;
+    int h = r->y1 - r->y0;
+
+    if(ctx->grain_x == 0) {
+        return r->depth > 0 && (w > 1 || h > 1);
+    }
+
+    return w > ctx->grain_x || h > ctx->grain_y;
+}
+
+/* Coupe r en deux selon sa plus grande dimension (en nombre de grains), r
+ * garde la première moitié et right reçoit la seconde */
+static void
+split(struct parallel_range *r, struct parallel_range *right)
+{
+    struct parallel_ctx *ctx = r->ctx;
+    int w = r->x1 - r->x0;
+    int h = r->y1 - r->y0;
+
+    *right = *r;
+
+    if(ctx->grain_x == 0 ? w >= h : w * ctx->grain_y >= h * ctx->grain_x) {
+        int mid = r->x0 + w / 2;
+        r->x1 = mid;
+        right->x0 = mid;
+    } else {
+        int mid = r->y0 + h / 2;
+        r->y1 = mid;
+        right->y0 = mid;
+    }
+
+    if(r->depth > 0) {
+        r->depth--;
+        right->depth--;
+    }
+}
+
+/* Termine la boucle : combine les accumulateurs et prévient l'appelant */
+static void
+complete(struct parallel_ctx *ctx, struct scheduler *s)
+{
+    if(ctx->kind == PARALLEL_REDUCE) {
+        for(int i = 1; i < ctx->nslots; ++i) {
+            ctx->join(ctx->accs, ctx->accs + i * ctx->stride, ctx->arg);
+        }
+        ctx->rdone(ctx->accs, ctx->arg, s);
+    } else if(ctx->done) {
+        ctx->done(ctx->arg, s);
+    }
+
+    free_parallel_ctx(ctx);
+}
+
+/* Traite un morceau qui ne sera plus coupé */
+static void
+run_leaf(struct parallel_range *r, int self, struct scheduler *s)
+{
+    struct parallel_ctx *ctx = r->ctx;
+    long size = (long)(r->x1 - r->x0) * (r->y1 - r->y0);
+
+    switch(ctx->kind) {
+    case PARALLEL_FOR:
+        ctx->body(r->x0, r->x1, ctx->arg, s);
+        break;
+    case PARALLEL_FOR_2D:
+        ctx->body2d(r->x0, r->y0, r->x1, r->y1, ctx->arg, s);
+        break;
+    case PARALLEL_REDUCE:
+        if(self >= 0 && self < ctx->nslots - 1) {
+            ctx->rbody(r->x0, r->x1, ctx->accs + self * ctx->stride, ctx->arg);
+        } else {
+            pthread_mutex_lock(&ctx->mutex);
+            ctx->rbody(r->x0, r->x1,
+                       ctx->accs + (ctx->nslots - 1) * ctx->stride, ctx->arg);
+            pthread_mutex_unlock(&ctx->mutex);
+        }
+        break;
+    }
+
+    if(atomic_fetch_sub(&ctx->remaining, size) == size) {
+        complete(ctx, s);
+    }
+}
+
+void
+parallel_task(void *closure, struct scheduler *s)
+{
+    struct parallel_range *r = (struct parallel_range *)closure;
+    struct parallel_range *right;
+    int self = sched_self(s);
+
+    // Morceau volé, on s'autorise à le redécouper
+    if(r->ctx->grain_x == 0 && self != r->owner) {
+        r->depth += r->ctx->steal_depth;
+    }
+
+    while(splittable(r)) {
+        if(!(right = malloc(sizeof(struct parallel_range)))) {
+            // On traite le reste sur place
+            break;
+        }
+
+        split(r, right);
+        right->owner = self;
+
+        if(sched_spawn_attr(parallel_task, right, &parallel_attr, s) < 0) {
+            parallel_task(right, s);
+        }
+    }
+
+    run_leaf(r, self, s);
+    free(r);
+}
+
+void
+parallel_cancel(void *closure, struct scheduler *s)
+{
+    struct parallel_range *r = (struct parallel_range *)closure;
+    struct parallel_ctx *ctx = r->ctx;
+    long size = (long)(r->x1 - r->x0) * (r->y1 - r->y0);
+
+    // Le morceau compte comme traité, pour que la boucle se termine et
+    // libère son contexte
+    free(r);
+    if(atomic_fetch_sub(&ctx->remaining, size) == size) {
+        complete(ctx, s);
+    }
+}
+
+/* Lance la découpe de [x0, x1[ x [y0, y1[ */
+static int
+parallel_start(struct parallel_ctx *ctx, int x0, int y0, int x1, int y1,
+               struct scheduler *s)
+{
+    struct parallel_range *r;
+
+    if(x1 <= x0 || y1 <= y0) {
+        atomic_init(&ctx->remaining, 0);
+        complete(ctx, s);
+        return 0;
+    }
+    atomic_init(&ctx->remaining, (long)(x1 - x0) * (y1 - y0));
+
+    if(!(r = malloc(sizeof(struct parallel_range)))) {
+        perror("Parallel range");
+        free_parallel_ctx(ctx);
+        return -1;
+    }
+
+    r->ctx = ctx;
+    r->x0 = x0;
+    r->y0 = y0;
+    r->x1 = x1;
+    r->y1 = y1;
+    r->depth = log2_ceil(AUTO_CHUNKS * sched_nthreads(s));
+    r->owner = sched_self(s);
+
+    parallel_task(r, s);
+
+    return 0;
+}
+
+int
+parallel_for(int begin, int end, int grain, range_body body, range_done done,
+             void *arg, struct scheduler *s)
+{
+    struct parallel_ctx *ctx;
+
+    if(!(ctx = new_parallel_ctx(PARALLEL_FOR, arg, grain, 1, s))) {
+        return -1;
+    }
+    ctx->body = body;
+    ctx->done = done;
+
+    return parallel_start(ctx, begin, 0, end, 1, s);
+}
+
+int
+parallel_for_2d(int x0, int y0, int x1, int y1, int grain_x, int grain_y,
+                range2d_body body, range_done done, void *arg,
+                struct scheduler *s)
+{
+    struct parallel_ctx *ctx;
+
+    if(grain_x <= 0 || grain_y <= 0) {
+        grain_x = grain_y = PARALLEL_AUTO;
+    }
+
+    if(!(ctx = new_parallel_ctx(PARALLEL_FOR_2D, arg, grain_x, grain_y, s))) {
+        return -1;
+    }
+    ctx->body2d = body;
+    ctx->done = done;
+
+    return parallel_start(ctx, x0, y0, x1, y1, s);
+}
+
+int
+parallel_reduce(int begin, int end, int grain, size_t acc_size,
+                const void *identity, reduce_body body, reduce_join join,
+                reduce_done done, void *arg, struct scheduler *s)
+{
+    struct parallel_ctx *ctx;
+
+    if(acc_size == 0) {
+        fprintf(stderr, "acc_size must be greater than 0\n");
+        return -1;
+    }
+
+    if(!(ctx = new_parallel_ctx(PARALLEL_REDUCE, arg, grain, 1, s))) {
+        return -1;
+    }
+    ctx->rbody = body;
+    ctx->join = join;
+    ctx->rdone = done;
+    ctx->stride = (acc_size + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+    ctx->nslots = sched_nthreads(s) + 1;
+
+    if(!(ctx->accs = aligned_alloc(CACHE_LINE, ctx->stride * ctx->nslots))) {
+        perror("Reduce accumulators");
+        free(ctx);
+        return -1;
+    }
+    for(int i = 0; i < ctx->nslots; ++i) {
+        memcpy(ctx->accs + i * ctx->stride, identity, acc_size);
+    }
+
+    if(pthread_mutex_init(&ctx->mutex, NULL) != 0) {
+        fprintf(stderr, "Can't init mutex\n");
+        free(ctx->accs);
+        free(ctx);
+        return -1;
+    }
+
+    return parallel_start(ctx, begin, 0, end, 1, s);
+}
@@ -0,0 +1,256 @@
+#include "../includes/perf.h"
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* Événements mesurés */
+static const struct {
+    uint32_t type;
+    uint64_t config;
+    const char *name;
+} events[] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "défauts LLC"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "mauvais branchements"},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, "changements ctx"},
+};
+
+#define NEVENTS (int)(sizeof(events) / sizeof(events[0]))
+
+static const char *phases[PERF_NPHASES] = {"exécution", "vol", "attente"};
+
+struct perf {
+    /* Descripteur de chaque événement, -1 si non disponible */
+    int fds[NEVENTS];
+
+    /* Descripteur du groupe, lu en une seule fois */
+    int leader;
+
+    /* Position de chaque événement dans la lecture du groupe */
+    int index[NEVENTS];
+
+    /* Nombre d'événements du groupe */
+    int nopened;
+
+    /* Valeurs à la dernière lecture */
+    uint64_t last[NEVENTS];
+
+    /* Totaux par phase */
+    uint64_t total[PERF_NPHASES][NEVENTS];
+
+    /* Phase courante */
+    enum perf_phase phase;
+};
+
+/* Affiche une seule fois pourquoi les compteurs sont indisponibles */
+static atomic_flag warned = ATOMIC_FLAG_INIT;
+
+static int
+event_open(struct perf_event_attr *attr, int group)
+{
+    int fd;
+
+    // Tente de compter aussi le noyau, puis seulement l'espace utilisateur
+    // si perf_event_paranoid l'interdit
+    attr->exclude_kernel = 0;
+    if((fd = syscall(SYS_perf_event_open, attr, 0, -1, group, 0)) < 0 &&
+       (errno == EACCES || errno == EPERM)) {
+        attr->exclude_kernel = 1;
+        fd = syscall(SYS_perf_event_open, attr, 0, -1, group, 0);
+    }
+
+    return fd;
+}
+
+/* Ajoute aux totaux de la phase courante ce qui a été compté depuis la
+ * dernière lecture */
+static void
+perf_read(struct perf *p)
+{
+    uint64_t values[1 + NEVENTS];
+
+    if(read(p->leader, values, sizeof(values)) <= 0) {
+        return;
+    }
+
+    for(int i = 0; i < NEVENTS; ++i) {
+        if(p->index[i] >= 0) {
+            uint64_t v = values[1 + p->index[i]];
+
+            p->total[p->phase][i] += v - p->last[i];
+            p->last[i] = v;
+        }
+    }
+}
+
+/* Largeur à passer à printf pour que s occupe width colonnes, les
+ * caractères accentués prenant plusieurs octets */
+static int
+columns(const char *s, int width)
+{
+    for(; *s; ++s) {
+        if((*s & 0xC0) == 0x80) {
+            width++;
+        }
+    }
+
+    return width;
+}
+
+int
+perf_enabled(void)
+{
+    const char *env = getenv("SCHED_PERF");
+
+    return env && *env && strcmp(env, "0") != 0;
+}
+
+struct perf *
+perf_open(enum perf_phase phase)
+{
+    struct perf *p;
+    int err = 0;
+
+    if(!(p = calloc(1, sizeof(struct perf)))) {
+        perror("Perf");
+        return NULL;
+    }
+
+    p->leader = -1;
+    for(int i = 0; i < NEVENTS; ++i) {
+        struct perf_event_attr attr;
+
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[i].type;
+        attr.config = events[i].config;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+
+        // Le premier événement disponible est le chef du groupe
+        p->index[i] = -1;
+        if((p->fds[i] = event_open(&attr, p->leader)) < 0) {
+            err = errno;
+            continue;
+        }
+
+        if(p->leader < 0) {
+            p->leader = p->fds[i];
+        }
+        p->index[i] = p->nopened++;
+    }
+
+    if(p->leader < 0) {
+        if(!atomic_flag_test_and_set(&warned)) {
+            fprintf(stderr, "perf_event_open: %s, counters disabled\n",
+                    strerror(err));
+        }
+        free(p);
+        return NULL;
+    }
+
+    p->phase = phase;
+    perf_read(p);
+
+    return p;
+}
+
+void
+perf_phase(struct perf *p, enum perf_phase phase)
+{
+    if(!p || phase == p->phase) {
+        return;
+    }
+
+    perf_read(p);
+    p->phase = phase;
+}
+
+void
+perf_stop(struct perf *p)
+{
+    if(!p) {
+        return;
+    }
+
+    perf_read(p);
+
+    for(int i = NEVENTS - 1; i >= 0; --i) {
+        if(p->fds[i] >= 0) {
+            close(p->fds[i]);
+            p->fds[i] = -1;
+        }
+    }
+    p->leader = -1;
+}
+
+void
+perf_report(struct perf **perfs, int n)
+{
+    uint64_t total[PERF_NPHASES][NEVENTS] = {{0}};
+    int available[NEVENTS] = {0};
+    int any = 0;
+
+    for(int t = 0; t < n; ++t) {
+        if(!perfs[t]) {
+            continue;
+        }
+
+        any = 1;
+        for(int i = 0; i < NEVENTS; ++i) {
+            available[i] |= perfs[t]->index[i] >= 0;
+            for(int ph = 0; ph < PERF_NPHASES; ++ph) {
+                total[ph][i] += perfs[t]->total[ph][i];
+            }
+        }
+    }
+
+    if(!any) {
+        return;
+    }
+
+    printf("-------- Compteurs (perf) --------\n");
+    printf(" %-21s", "");
+    for(int ph = 0; ph < PERF_NPHASES; ++ph) {
+        printf(" %*s", columns(phases[ph], 14), phases[ph]);
+    }
+    printf("\n");
+
+    for(int i = 0; i < NEVENTS; ++i) {
+        printf(" %-*s", columns(events[i].name, 21), events[i].name);
+        for(int ph = 0; ph < PERF_NPHASES; ++ph) {
+            if(available[i]) {
+                printf(" %14llu", (unsigned long long)total[ph][i]);
+            } else {
+                printf(" %14s", "n/a");
+            }
+        }
+        printf("\n");
+    }
+
+    // Instructions par cycle, les deux premiers événements
+    if(available[0] && available[1]) {
+        printf(" %-21s", "IPC");
+        for(int ph = 0; ph < PERF_NPHASES; ++ph) {
+            printf(" %14.2f", total[ph][0] ? (double)total[ph][1] /
+                                                 total[ph][0]
+                                           : 0.0);
+        }
+        printf("\n");
+    }
+    printf("----------------------------------\n");
+}
+
+void
+perf_free(struct perf *p)
+{
+    free(p);
+}
@@ -0,0 +1,170 @@
+#include "../includes/perturbation.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Nombre double-double : hi + lo, avec |lo| <= ulp(hi) / 2 */
+struct dd {
+    double hi, lo;
+};
+
+struct perturbation {
+    /* Orbite de référence, arrondie en double */
+    double *re, *im;
+
+    /* Itérations calculées, la dernière étant celle où elle s'échappe */
+    int length;
+
+    /* Itérations maximum */
+    int iterations;
+};
+
+/* Somme exacte a + b = s + e */
+static struct dd
+two_sum(double a, double b)
+{
+    double s = a + b;
+    double bb = s - a;
+
+    return (struct dd){s, (a - (s - bb)) + (b - bb)};
+}
+
+/* Comme two_sum, si |a| >= |b| */
+static struct dd
+quick_two_sum(double a, double b)
+{
+    double s = a + b;
+
+    return (struct dd){s, b - (s - a)};
+}
+
+/* Produit exact a * b = p + e */
+static struct dd
+two_prod(double a, double b)
+{
+    double p = a * b;
+
+    return (struct dd){p, fma(a, b, -p)};
+}
+
+static struct dd
+dd_add(struct dd a, struct dd b)
+{
+    struct dd s = two_sum(a.hi, b.hi);
+
+    return quick_two_sum(s.hi, s.lo + a.lo + b.lo);
+}
+
+static struct dd
+dd_sub(struct dd a, struct dd b)
+{
+    return dd_add(a, (struct dd){-b.hi, -b.lo});
+}
+
+static struct dd
+dd_mul(struct dd a, struct dd b)
+{
+    struct dd p = two_prod(a.hi, b.hi);
+
+    return quick_two_sum(p.hi, p.lo + a.hi * b.lo + a.lo * b.hi);
+}
+
+struct perturbation *
+perturbation_new(struct dd_complex center, int iterations)
+{
+    struct dd cre = {center.re_hi, center.re_lo};
+    struct dd cim = {center.im_hi, center.im_lo};
+    struct dd zre = {0, 0}, zim = {0, 0};
+    struct perturbation *p;
+
+    if(!(p = malloc(sizeof(struct perturbation)))) {
+        perror("Perturbation");
+        return NULL;
+    }
+
+    if(!(p->re = malloc((iterations + 1) * sizeof(double))) ||
+       !(p->im = malloc((iterations + 1) * sizeof(double)))) {
+        perror("Reference orbit");
+        free(p->re);
+        free(p);
+        return NULL;
+    }
+    p->iterations = iterations;
+
+    // Z(0) = 0, Z(n + 1) = Z(n)^2 + C
+    p->re[0] = p->im[0] = 0;
+    for(p->length = 1; p->length <= iterations; ++p->length) {
+        struct dd re2 = dd_mul(zre, zre), im2 = dd_mul(zim, zim);
+        struct dd reim = dd_mul(zre, zim);
+
+        zre = dd_add(dd_sub(re2, im2), cre);
+        zim = dd_add(dd_add(reim, reim), cim);
+
+        p->re[p->length] = zre.hi + zre.lo;
+        p->im[p->length] = zim.hi + zim.lo;
+
+        if(p->re[p->length] * p->re[p->length] +
+               p->im[p->length] * p->im[p->length] >
+           4.0) {
+            break;
+        }
+    }
+    if(p->length > iterations) {
+        p->length = iterations;
+    }
+
+    return p;
+}
+
+void
+perturbation_free(struct perturbation *p)
+{
+    free(p->re);
+    free(p->im);
+    free(p);
+}
+
+int
+perturbation_length(struct perturbation *p)
+{
+    return p->length;
+}
+
+int
+perturbation_iterate(struct perturbation *p, double dx, double dy,
+                     long *rebases)
+{
+    const double *zre = p->re, *zim = p->im;
+    double re = 0, im = 0;
+    int m = 0, i = 0;
+
+    while(i < p->iterations) {
+        // d = 2 Z d + d^2 + dc = (2 Z + d) d + dc
+        double a = 2 * zre[m] + re, b = 2 * zim[m] + im;
+        double t = a * re - b * im + dx;
+        im = a * im + b * re + dy;
+        re = t;
+        m++;
+        i++;
+
+        // z = Z + d
+        double x = zre[m] + re, y = zim[m] + im;
+        double z2 = x * x + y * y;
+
+        if(z2 > 4.0) {
+            break;
+        }
+
+        // L'écart devient plus grand que le point lui-même, ou la
+        // référence s'est échappée : on repart de Z(0) avec d = z
+        if(z2 < re * re + im * im || m >= p->length) {
+            re = x;
+            im = y;
+            m = 0;
+            (*rebases)++;
+        }
+    }
+
+    return i;
+}
@@ -0,0 +1,184 @@
+#include "../includes/priority.h"
+#include "../includes/sched.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* Nombre de tâches sondes */
+#define PROBES 500
+
+/* Intervalle entre deux sondes, en secondes */
+#define PROBE_INTERVAL 0.0002
+
+/* Durée d'une tâche de fond, en secondes */
+#define BACKGROUND_TASK 0.00005
+
+/* Tâches de fond par thread, chacune se recrée tant que les sondes ne sont
+ * pas toutes créées */
+#define BACKGROUND_PER_THREAD 4
+
+struct probe {
+    /* Création de la tâche */
+    double created;
+
+    /* Début de la tâche */
+    double started;
+};
+
+static struct probe probes[PROBES];
+
+/* Mis à 1 quand toutes les sondes sont créées */
+static atomic_int stop;
+
+/* Options des sondes */
+static struct sched_attr probe_attr = SCHED_ATTR_DEFAULT;
+
+static double
+now(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+/* Ajoute une tâche, en réessayant tant que l'ordonnanceur est plein */
+static void
+spawn(taskfunc f, void *closure, const struct sched_attr *attr,
+      struct scheduler *s)
+{
+    int rc;
+
+    while((rc = sched_spawn_attr(f, closure, attr, s)) < 0) {
+        if(errno != EAGAIN) {
+            break;
+        }
+    }
+    assert(rc >= 0);
+}
+
+/* Tâche de fond : calcule un moment puis se recrée */
+void
+background(void *closure, struct scheduler *s)
+{
+    double end = now() + BACKGROUND_TASK;
+
+    while(now() < end) {
+    }
+
+    if(!atomic_load(&stop)) {
+        spawn(background, closure, NULL, s);
+    }
+}
+
+void
+probe(void *closure, struct scheduler *s)
+{
+    struct probe *p = (struct probe *)closure;
+
+    (void)s;
+
+    p->started = now();
+}
+
+/* Crée les sondes à intervalle régulier */
+void
+ticker(void *closure, struct scheduler *s)
+{
+    double next = now();
+
+    (void)closure;
+
+    for(int i = 0; i < PROBES; ++i) {
+        while(now() < next) {
+        }
+
+        probes[i].created = now();
+        spawn(probe, &probes[i], &probe_attr, s);
+        next += PROBE_INTERVAL;
+    }
+
+    atomic_store(&stop, 1);
+}
+
+void
+priority_root(void *closure, struct scheduler *s)
+{
+    (void)closure;
+
+    for(int i = 0; i < BACKGROUND_PER_THREAD * sched_nthreads(s); ++i) {
+        spawn(background, NULL, NULL, s);
+    }
+
+    // Ajouté en dernier pour être exécuté tout de suite
+    spawn(ticker, NULL, NULL, s);
+}
+
+static int
+compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* Lance une exécution avec des sondes de priorité priority et affiche la
+ * distribution de leur latence */
+static double
+run_priority(enum sched_priority priority, const char *name, int nthreads,
+             int qlen)
+{
+    double latencies[PROBES];
+    double begin, delay;
+    int rc;
+
+    atomic_store(&stop, 0);
+    probe_attr.priority = priority;
+
+    begin = now();
+    rc = sched_init(nthreads, qlen, priority_root, NULL);
+    assert(rc >= 0);
+    delay = now() - begin;
+
+    for(int i = 0; i < PROBES; ++i) {
+        latencies[i] = probes[i].started - probes[i].created;
+    }
+    qsort(latencies, PROBES, sizeof(double), compare_double);
+
+    printf(" %-9s %12.1f %12.1f %12.1f\n", name,
+           latencies[PROBES / 2] * 1e6, latencies[PROBES * 99 / 100] * 1e6,
+           latencies[PROBES - 1] * 1e6);
+
+    return delay;
+}
+
+double
+benchmark_priority(int nthreads, int qlen)
+{
+    double delay = 0;
+
+    if(nthreads <= 0) {
+        nthreads = sched_default_threads();
+    }
+    if(nthreads < 2) {
+        fprintf(stderr, "prio needs at least 2 threads\n");
+        return -1;
+    }
+
+    // Toutes les sondes peuvent attendre en même temps
+    if(qlen <= 0) {
+        qlen = PROBES + BACKGROUND_PER_THREAD * nthreads;
+    }
+
+    printf("prio : %d sondes toutes les %.0f µs, %d threads occupés\n", PROBES,
+           PROBE_INTERVAL * 1e6, nthreads);
+    printf(" priorité  médiane (µs)     p99 (µs)     max (µs)\n");
+    delay += run_priority(SCHED_PRIO_NORMAL, "normale", nthreads, qlen);
+    delay += run_priority(SCHED_PRIO_HIGH, "haute", nthreads, qlen);
+
+    return delay;
+}
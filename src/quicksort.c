@@ -1,137 +1,159 @@
 #include "../includes/quicksort.h"
+#include "../includes/distrib.h"
+#include "../includes/hugepage.h"
 #include "../includes/sched.h"
+#include "../includes/tune.h"
 
 #include <assert.h>
 #include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
-int
-partition(int *a, int lo, int hi)
-{
-    int pivot = a[lo];
-    int i = lo - 1;
-    int j = hi + 1;
-    int t;
-    while(1) {
-        do {
-            i++;
-        } while(a[i] < pivot);
-
-        do {
-            j--;
-        } while(a[j] > pivot);
-
-        if(i >= j) {
-            return j;
-        }
-
-        t = a[i];
-        a[i] = a[j];
-        a[j] = t;
-    }
-}
-
-struct quicksort_args {
-    int *a;
-    int lo, hi;
+/* Élément clé/valeur, trié selon la clé */
+struct kv {
+    uint64_t key;
+    uint64_t value;
 };
 
-struct quicksort_args *
-new_args(int *a, int lo, int hi)
-{
-    struct quicksort_args *args = malloc(sizeof(struct quicksort_args));
-    if(args == NULL) {
-        return NULL;
-    }
-
-    args->a = a;
-    args->lo = lo;
-    args->hi = hi;
-    return args;
-}
-
-void
-quicksort_serial(int *a, int lo, int hi)
-{
-    int p;
-
-    if(lo >= hi) {
-        return;
+#define LESS(a, b) ((a) < (b))
+#define KV_LESS(a, b) ((a).key < (b).key)
+
+QUICKSORT_DEFINE(int32, int32_t, LESS)
+QUICKSORT_DEFINE(uint64, uint64_t, LESS)
+QUICKSORT_DEFINE(float, float, LESS)
+QUICKSORT_DEFINE(double, double, LESS)
+QUICKSORT_DEFINE(kv, struct kv, KV_LESS)
+
+/* Génération des clés à partir de l'état `s` du générateur */
+#define GEN_INT32(s, i) ((int32_t)(((s) >> 33) & 0x7FFFFFFF))
+#define GEN_UINT64(s, i) ((uint64_t)(s))
+#define GEN_FLOAT(s, i) ((float)((s) >> 40) / (float)(1 << 24))
+#define GEN_DOUBLE(s, i) ((double)((s) >> 11) / 9007199254740992.0)
+#define GEN_KV(s, i) ((struct kv){(s), (uint64_t)(i)})
+
+/* Génère le benchmark pour une famille de tri créée par QUICKSORT_DEFINE */
+#define QUICKSORT_BENCHMARK_DEFINE(name, type, less, gen)                      \
+    static double benchmark_quicksort_##name(int serial, int nthreads,         \
+                                             int qlen, int n)                  \
+    {                                                                          \
+        type *a;                                                               \
+        struct timespec begin, end;                                            \
+        double delay;                                                          \
+        int rc;                                                                \
+                                                                               \
+        if(qlen <= 0) {                                                        \
+            qlen = (n + tuning.cutoff - 1) / tuning.cutoff /                   \
+                   tuning.quicksort_qlen;                                      \
+        }                                                                      \
+                                                                               \
+        if(!(a = huge_alloc(n * sizeof(type)))) {                              \
+            perror("Array allocation");                                        \
+            return -1;                                                         \
+        }                                                                      \
+                                                                               \
+        unsigned long long s = 0;                                              \
+        for(int i = 0; i < n; i++) {                                           \
+            s = s * 6364136223846793005ULL + 1442695040888963407;              \
+            a[i] = gen(s, i);                                                  \
+        }                                                                      \
+                                                                               \
+        clock_gettime(CLOCK_MONOTONIC, &begin);                                \
+                                                                               \
+        if(serial) {                                                           \
+            quicksort_serial_##name(a, 0, n - 1);                              \
+        } else {                                                               \
+            rc = sched_init(nthreads, qlen, quicksort_##name,                  \
+                            new_args_##name(a, 0, n - 1));                     \
+            if(rc < 0) {                                                       \
+                huge_free(a);                                                  \
+                return -1;                                                     \
+            }                                                                  \
+        }                                                                      \
+                                                                               \
+        clock_gettime(CLOCK_MONOTONIC, &end);                                  \
+        delay = end.tv_sec + end.tv_nsec / 1000000000.0 -                      \
+                (begin.tv_sec + begin.tv_nsec / 1000000000.0);                 \
+                                                                               \
+        for(int i = 0; i < n - 1; i++) {                                       \
+            assert(!less(a[i + 1], a[i]));                                     \
+        }                                                                      \
+                                                                               \
+        huge_report("tableau", huge_backed(a, n * sizeof(type)),               \
+                    n * sizeof(type));                                         \
+        huge_free(a);                                                          \
+        return delay;                                                          \
     }
 
-    p = partition(a, lo, hi);
-    quicksort_serial(a, lo, p);
-    quicksort_serial(a, p + 1, hi);
-}
+QUICKSORT_BENCHMARK_DEFINE(int32, int32_t, LESS, GEN_INT32)
+QUICKSORT_BENCHMARK_DEFINE(uint64, uint64_t, LESS, GEN_UINT64)
+QUICKSORT_BENCHMARK_DEFINE(float, float, LESS, GEN_FLOAT)
+QUICKSORT_BENCHMARK_DEFINE(double, double, LESS, GEN_DOUBLE)
+QUICKSORT_BENCHMARK_DEFINE(kv, struct kv, KV_LESS, GEN_KV)
 
-void
-quicksort(void *closure, struct scheduler *s)
+/* Tâche distribuée : trie a[args[0]..args[1]] (bornes incluses) */
+static void
+quicksort_distributed(const struct distrib_task *t, void *arg,
+                      struct distrib *d, struct scheduler *s)
 {
-    struct quicksort_args *args = (struct quicksort_args *)closure;
-    int *a = args->a;
-    int lo = args->lo;
-    int hi = args->hi;
+    int32_t *a = (int32_t *)arg;
+    int lo = t->args[0];
+    int hi = t->args[1];
     int p;
     int rc;
 
-    free(closure);
-
     if(lo >= hi) {
         return;
     }
 
-    if(hi - lo <= 128) {
-        quicksort_serial(a, lo, hi);
+    if(hi - lo <= tuning.cutoff) {
+        quicksort_serial_int32(a, lo, hi);
         return;
     }
 
-    p = partition(a, lo, hi);
+    p = partition_int32(a, lo, hi);
 
-    while((rc = sched_spawn(quicksort, new_args(a, lo, p), s)) < 0) {
-        if(errno != EAGAIN) {
-            break;
-        }
-    }
+    rc = distrib_spawn(d, &(struct distrib_task){0, {lo, p}}, s);
     assert(rc >= 0);
-
-    while((rc = sched_spawn(quicksort, new_args(a, p + 1, hi), s)) < 0) {
-        if(errno != EAGAIN) {
-            break;
-        }
-    }
+    rc = distrib_spawn(d, &(struct distrib_task){0, {p + 1, hi}}, s);
     assert(rc >= 0);
 }
 
 double
-benchmark_quicksort(int serial, int nthreads, int qlen)
+benchmark_quicksort_distributed(int nprocs, int nthreads, int qlen)
 {
-    int *a;
+    static const distrib_func funcs[] = {quicksort_distributed};
     struct timespec begin, end;
+    int32_t *a;
     double delay;
     int rc;
-    int n = 10 * 1024 * 1024;
+    int n = QUICKSORT_N;
+    struct distrib_task root = {0, {0, n - 1}};
 
     if(qlen <= 0) {
-        qlen = (n + 127) / 128;
+        qlen = (n + tuning.cutoff - 1) / tuning.cutoff / tuning.quicksort_qlen;
     }
 
-    a = malloc(n * sizeof(int));
+    // Partagé avec les autres processus, jamais copié
+    if(!(a = distrib_shared(n * sizeof(int32_t)))) {
+        return -1;
+    }
 
     unsigned long long s = 0;
     for(int i = 0; i < n; i++) {
         s = s * 6364136223846793005ULL + 1442695040888963407;
-        a[i] = (int)((s >> 33) & 0x7FFFFFFF);
+        a[i] = GEN_INT32(s, i);
     }
 
     clock_gettime(CLOCK_MONOTONIC, &begin);
 
-    if(serial) {
-        quicksort_serial(a, 0, n - 1);
-    } else {
-        rc = sched_init(nthreads, qlen, quicksort, new_args(a, 0, n - 1));
-        assert(rc >= 0);
+    // Les tâches d'un processus parti sont perdues : rien à vérifier
+    rc = distrib_run(nprocs, nthreads, qlen, funcs, 1, a, &root);
+    if(rc < 0) {
+        distrib_shared_free(a, n * sizeof(int32_t));
+        return -1;
     }
 
     clock_gettime(CLOCK_MONOTONIC, &end);
@@ -139,9 +161,51 @@ benchmark_quicksort(int serial, int nthreads, int qlen)
             (begin.tv_sec + begin.tv_nsec / 1000000000.0);
 
     for(int i = 0; i < n - 1; i++) {
-        assert(a[i] <= a[i + 1]);
+        assert(!LESS(a[i + 1], a[i]));
     }
 
-    free(a);
+    distrib_shared_free(a, n * sizeof(int32_t));
     return delay;
 }
+
+int
+sort_type_parse(const char *name)
+{
+    static const char *names[] = {
+        [SORT_INT32] = "int32", [SORT_UINT64] = "uint64",
+        [SORT_FLOAT] = "float", [SORT_DOUBLE] = "double",
+        [SORT_KV] = "kv",
+    };
+
+    for(int i = 0; i < (int)(sizeof(names) / sizeof(*names)); ++i) {
+        if(strcmp(name, names[i]) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+double
+benchmark_quicksort(int serial, int nthreads, int qlen, enum sort_type type,
+                    int n)
+{
+    if(n <= 0) {
+        n = QUICKSORT_N;
+    }
+
+    switch(type) {
+    case SORT_INT32:
+        return benchmark_quicksort_int32(serial, nthreads, qlen, n);
+    case SORT_UINT64:
+        return benchmark_quicksort_uint64(serial, nthreads, qlen, n);
+    case SORT_FLOAT:
+        return benchmark_quicksort_float(serial, nthreads, qlen, n);
+    case SORT_DOUBLE:
+        return benchmark_quicksort_double(serial, nthreads, qlen, n);
+    case SORT_KV:
+        return benchmark_quicksort_kv(serial, nthreads, qlen, n);
+    }
+
+    return -1;
+}
@@ -0,0 +1,82 @@
+#include "../includes/quiescence.h"
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Taille d'une ligne de cache */
+#define CACHE_LINE 64
+
+/* Case d'un thread, sur sa propre ligne de cache */
+struct leaf {
+    alignas(CACHE_LINE) atomic_long n;
+};
+
+struct quiescence {
+    /* Nombre de cases non nulles, plus les tâches comptées directement */
+    alignas(CACHE_LINE) atomic_long root;
+
+    /* Cases des threads */
+    struct leaf *leaves;
+    int nleaves;
+};
+
+struct quiescence *
+quiescence_new(int nleaves)
+{
+    struct quiescence *q;
+
+    if(!(q = aligned_alloc(CACHE_LINE, sizeof(struct quiescence)))) {
+        perror("Quiescence");
+        return NULL;
+    }
+
+    if(!(q->leaves =
+             aligned_alloc(CACHE_LINE, nleaves * sizeof(struct leaf)))) {
+        perror("Quiescence leaves");
+        free(q);
+        return NULL;
+    }
+
+    atomic_init(&q->root, 0);
+    for(int i = 0; i < nleaves; ++i) {
+        atomic_init(&q->leaves[i].n, 0);
+    }
+    q->nleaves = nleaves;
+
+    return q;
+}
+
+void
+quiescence_free(struct quiescence *q)
+{
+    free(q->leaves);
+    free(q);
+}
+
+void
+quiescence_arrive(struct quiescence *q, int leaf)
+{
+    if(leaf < 0 || leaf >= q->nleaves ||
+       atomic_fetch_add(&q->leaves[leaf].n, 1) == 0) {
+        atomic_fetch_add(&q->root, 1);
+    }
+}
+
+int
+quiescence_depart(struct quiescence *q, int leaf)
+{
+    if(leaf < 0 || leaf >= q->nleaves ||
+       atomic_fetch_sub(&q->leaves[leaf].n, 1) == 1) {
+        return atomic_fetch_sub(&q->root, 1) == 1;
+    }
+
+    return 0;
+}
+
+int
+quiescence_done(struct quiescence *q)
+{
+    return atomic_load(&q->root) == 0;
+}
@@ -0,0 +1,421 @@
+#include "../includes/replay.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Début de chaque journal, 24 octets */
+struct header {
+    char magic[8];
+
+    /* Commun à tous les journaux d'un même enregistrement */
+    uint64_t stamp;
+
+    /* Nombre de threads de l'exécution enregistrée, et index du thread */
+    int32_t nthreads;
+    int32_t th;
+} __attribute__((packed));
+
+/* Décision d'un thread, 12 octets dans les fichiers */
+struct entry {
+    uint64_t id;
+
+    /* Thread à qui la tâche a été prise, RECORD_INJECT ou RECORD_SLEEP */
+    int32_t from;
+} __attribute__((packed));
+
+/* Journal d'un thread, qui grandit au fur et à mesure */
+struct log {
+    struct entry *entries;
+    size_t len;
+    size_t size;
+};
+
+struct record {
+    int nthreads;
+    int run;
+    uint64_t stamp;
+    const char *prefix;
+    struct log *logs;
+};
+
+/* Case de la table des tâches rejouées */
+struct slot {
+    /* 0 si la case est vide */
+    uint64_t id;
+
+    /* Thread qui exécute la tâche, et position dans son journal */
+    int th;
+    int pos;
+
+    /* 1 quand la tâche a été créée */
+    atomic_int placed;
+};
+
+struct replay {
+    int nthreads;
+
+    /* Nombre de tâches de chaque thread */
+    int *lengths;
+
+    /* Table par adressage ouvert, en nombre de cases puissance de 2 */
+    struct slot *slots;
+    size_t mask;
+};
+
+/* Taille de départ d'un journal */
+#define LOG_SIZE 4096
+
+/* Début de l'en-tête d'un journal */
+#define LOG_MAGIC "SCHEDLOG"
+
+uint64_t
+record_task_id(uint64_t parent, uint64_t rank)
+{
+    // splitmix64, pour que des arbres voisins ne se chevauchent pas
+    uint64_t z = parent * 0x9E3779B97F4A7C15ULL + rank;
+
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+
+    return z ? z : 1;
+}
+
+int
+record_enabled(void)
+{
+    const char *env = getenv("SCHED_RECORD");
+
+    return env && *env;
+}
+
+int
+replay_enabled(void)
+{
+    const char *env = getenv("SCHED_REPLAY");
+
+    return env && *env;
+}
+
+/* Range dans path le fichier du journal du thread th */
+static void
+log_path(char *path, size_t size, const char *prefix, int run, int th)
+{
+    snprintf(path, size, "%s.%d.%d", prefix, run, th);
+}
+
+struct record *
+record_new(int nthreads, int run)
+{
+    struct record *r;
+
+    if(!(r = malloc(sizeof(struct record)))) {
+        perror("Record");
+        return NULL;
+    }
+
+    if(!(r->logs = calloc(nthreads, sizeof(struct log)))) {
+        perror("Record logs");
+        free(r);
+        return NULL;
+    }
+    r->nthreads = nthreads;
+    r->run = run;
+    r->prefix = getenv("SCHED_RECORD");
+
+    // Distingue cet enregistrement des précédents avec le même préfixe
+    struct timespec t;
+    clock_gettime(CLOCK_REALTIME, &t);
+    r->stamp = record_task_id((uint64_t)t.tv_sec * 1000000000 + t.tv_nsec,
+                              (uint64_t)getpid());
+
+    return r;
+}
+
+void
+record_add(struct record *r, int th, uint64_t id, int from)
+{
+    if(!r) {
+        return;
+    }
+
+    struct log *l = &r->logs[th];
+
+    if(l->len == l->size) {
+        size_t size = l->size ? 2 * l->size : LOG_SIZE;
+        struct entry *entries;
+
+        // Faute de mémoire, le journal s'arrête là et le rejeu passera le
+        // reste aux threads libres
+        if(!(entries = realloc(l->entries, size * sizeof(struct entry)))) {
+            return;
+        }
+        l->entries = entries;
+        l->size = size;
+    }
+
+    l->entries[l->len].id = id;
+    l->entries[l->len].from = from;
+    l->len++;
+}
+
+int
+record_write(struct record *r)
+{
+    char path[PATH_MAX];
+    size_t total = 0;
+
+    if(!r) {
+        return 0;
+    }
+
+    for(int i = 0; i < r->nthreads; ++i) {
+        struct header h = {LOG_MAGIC, r->stamp, r->nthreads, i};
+        struct log *l = &r->logs[i];
+        FILE *f;
+
+        log_path(path, sizeof(path), r->prefix, r->run, i);
+        if(!(f = fopen(path, "wb"))) {
+            perror(path);
+            return -1;
+        }
+
+        if(fwrite(&h, sizeof(struct header), 1, f) != 1 ||
+           fwrite(l->entries, sizeof(struct entry), l->len, f) != l->len) {
+            perror(path);
+            fclose(f);
+            return -1;
+        }
+        fclose(f);
+        total += l->len;
+    }
+
+    // Les journaux en trop d'un enregistrement précédent avec plus de
+    // threads ne doivent pas rester à côté de ceux-ci
+    for(int i = r->nthreads;; ++i) {
+        log_path(path, sizeof(path), r->prefix, r->run, i);
+        if(unlink(path) < 0) {
+            if(errno != ENOENT) {
+                perror(path);
+                return -1;
+            }
+            break;
+        }
+    }
+
+    printf("Journal : %zu décisions dans %s.%d.*\n", total, r->prefix,
+           r->run);
+
+    return 0;
+}
+
+void
+record_free(struct record *r)
+{
+    if(!r) {
+        return;
+    }
+
+    for(int i = 0; i < r->nthreads; ++i) {
+        free(r->logs[i].entries);
+    }
+    free(r->logs);
+    free(r);
+}
+
+/* Lit l'en-tête du journal de path dans h, ses décisions dans entries et
+ * leur nombre dans len
+ *
+ * Renvoie -1 en cas d'échec */
+static int
+log_read(const char *path, struct header *h, struct entry **entries,
+         size_t *len)
+{
+    FILE *f;
+    long size;
+
+    if(!(f = fopen(path, "rb"))) {
+        perror(path);
+        return -1;
+    }
+
+    if(fseek(f, 0, SEEK_END) < 0 || (size = ftell(f)) < 0 ||
+       fseek(f, 0, SEEK_SET) < 0) {
+        perror(path);
+        fclose(f);
+        return -1;
+    }
+
+    if(size < (long)sizeof(struct header) ||
+       fread(h, sizeof(struct header), 1, f) != 1 ||
+       memcmp(h->magic, LOG_MAGIC, sizeof(h->magic)) != 0) {
+        fprintf(stderr, "%s: not a scheduler log\n", path);
+        fclose(f);
+        return -1;
+    }
+
+    *len = (size - sizeof(struct header)) / sizeof(struct entry);
+    if(!(*entries = malloc(*len * sizeof(struct entry) + 1))) {
+        perror(path);
+        fclose(f);
+        return -1;
+    }
+
+    if(fread(*entries, sizeof(struct entry), *len, f) != *len) {
+        fprintf(stderr, "%s: truncated log\n", path);
+        free(*entries);
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+
+    return 0;
+}
+
+/* Ajoute la tâche id, position pos du thread th, à la table
+ *
+ * Renvoie -1 si elle y est déjà */
+static int
+replay_insert(struct replay *r, uint64_t id, int th, int pos)
+{
+    size_t i = id & r->mask;
+
+    for(; r->slots[i].id; i = (i + 1) & r->mask) {
+        if(r->slots[i].id == id) {
+            return -1;
+        }
+    }
+
+    r->slots[i].id = id;
+    r->slots[i].th = th;
+    r->slots[i].pos = pos;
+    atomic_init(&r->slots[i].placed, 0);
+
+    return 0;
+}
+
+struct replay *
+replay_load(int nthreads, int run)
+{
+    const char *prefix = getenv("SCHED_REPLAY");
+    char path[PATH_MAX];
+    struct entry *entries[nthreads];
+    size_t lens[nthreads], total = 0;
+    struct header first, h;
+    struct replay *r;
+    int nread;
+
+    // Un journal par thread de l'exécution enregistrée, tous avec l'en-tête
+    // du premier
+    for(nread = 0; nread < nthreads; ++nread) {
+        struct header *hp = nread ? &h : &first;
+
+        log_path(path, sizeof(path), prefix, run, nread);
+        if(log_read(path, hp, &entries[nread], &lens[nread]) < 0) {
+            break;
+        }
+
+        if(first.nthreads != nthreads) {
+            fprintf(stderr, "%s.%d.*: recorded with %d threads, cannot "
+                            "replay with %d\n",
+                    prefix, run, first.nthreads, nthreads);
+            free(entries[nread]);
+            break;
+        }
+        if(nread && (h.stamp != first.stamp ||
+                     h.nthreads != first.nthreads || h.th != nread)) {
+            fprintf(stderr, "%s: not from the same recording as %s.%d.0\n",
+                    path, prefix, run);
+            free(entries[nread]);
+            break;
+        }
+
+        total += lens[nread];
+    }
+
+    if(nread < nthreads) {
+        while(--nread >= 0) {
+            free(entries[nread]);
+        }
+        return NULL;
+    }
+
+    if(!(r = calloc(1, sizeof(struct replay))) ||
+       !(r->lengths = calloc(nthreads, sizeof(int)))) {
+        perror("Replay");
+        free(r);
+        r = NULL;
+        goto end;
+    }
+    r->nthreads = nthreads;
+
+    // Table remplie au plus à moitié
+    for(r->mask = 1; r->mask < 2 * total; r->mask *= 2) {
+    }
+    if(!(r->slots = calloc(r->mask, sizeof(struct slot)))) {
+        perror("Replay table");
+        replay_free(r);
+        r = NULL;
+        goto end;
+    }
+    r->mask--;
+
+    // Les mises en sommeil ne sont pas rejouées, seules les tâches comptent
+    for(int i = 0; i < nthreads; ++i) {
+        for(size_t j = 0; j < lens[i]; ++j) {
+            if(entries[i][j].from != RECORD_SLEEP &&
+               replay_insert(r, entries[i][j].id, i, r->lengths[i]) == 0) {
+                r->lengths[i]++;
+            }
+        }
+    }
+
+end:
+    for(int i = 0; i < nthreads; ++i) {
+        free(entries[i]);
+    }
+
+    return r;
+}
+
+int
+replay_length(struct replay *r, int th)
+{
+    return r->lengths[th];
+}
+
+int
+replay_place(struct replay *r, uint64_t id, int *th)
+{
+    for(size_t i = id & r->mask; r->slots[i].id; i = (i + 1) & r->mask) {
+        if(r->slots[i].id == id) {
+            // Une tâche créée deux fois n'est rejouée qu'une fois
+            if(atomic_exchange(&r->slots[i].placed, 1)) {
+                return -1;
+            }
+
+            *th = r->slots[i].th;
+            return r->slots[i].pos;
+        }
+    }
+
+    return -1;
+}
+
+void
+replay_free(struct replay *r)
+{
+    if(!r) {
+        return;
+    }
+
+    free(r->slots);
+    free(r->lengths);
+    free(r);
+}
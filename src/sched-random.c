@@ -1,13 +1,27 @@
+#include "../includes/quiescence.h"
 #include "../includes/sched.h"
+#include "../includes/token.h"
 
 #include <errno.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+/* Index du thread courant dans l'ordonnanceur */
+static _Thread_local int self = -1;
+
 struct task_info {
     void *closure;
     taskfunc f;
+
+    /* Case du compteur de tâches en cours où la tâche est comptée */
+    int origin;
+
+    /* Jeton d'annulation, peut être NULL */
+    struct sched_token *token;
+
+    /* Appelée à la place de f si la tâche est annulée, peut être NULL */
+    taskfunc cancel;
 };
 
 struct scheduler {
@@ -23,6 +37,9 @@ struct scheduler {
     /* Nombre de threads en attente */
     int nthsleep;
 
+    /* Nombre de threads ayant démarré, sert à leur attribuer un index */
+    int nthstarted;
+
     /* Taille de la pile */
     int qlen;
 
@@ -31,6 +48,9 @@ struct scheduler {
 
     /* Position actuelle dans la pile */
     int top;
+
+    /* Tâches en attente ou en cours d'exécution */
+    struct quiescence *pending;
 };
 
 /* Lance une tâche de la pile */
@@ -56,6 +76,7 @@ sched_init(int nthreads, int qlen, taskfunc f, void *closure)
     sched.nthreads = nthreads;
 
     sched.nthsleep = 0;
+    sched.nthstarted = 0;
 
     if(pthread_mutex_init(&sched.mutex, NULL) != 0) {
         fprintf(stderr, "Can't init mutex\n");
@@ -67,15 +88,29 @@ sched_init(int nthreads, int qlen, taskfunc f, void *closure)
         return -1;
     }
 
+    if(!(sched.pending = quiescence_new(nthreads))) {
+        return -1;
+    }
+
     sched.top = -1;
     if((sched.tasks = malloc(qlen * sizeof(struct task_info))) == NULL) {
         perror("Stack");
+        quiescence_free(sched.pending);
         return -1;
     }
 
     // Initialise l'aléatoire
     srand(time(NULL));
 
+    // Ajoute la tâche initiale avant de lancer les threads, sinon ils
+    // peuvent tous s'endormir et se terminer avant qu'elle n'arrive
+    if(sched_spawn(f, closure, &sched) < 0) {
+        fprintf(stderr, "Can't create the initial task\n");
+        free(sched.tasks);
+        quiescence_free(sched.pending);
+        return -1;
+    }
+
     pthread_t threads[nthreads];
     for(int i = 0; i < nthreads; ++i) {
         if(pthread_create(&threads[i], NULL, sched_worker, &sched) != 0) {
@@ -93,15 +128,11 @@ sched_init(int nthreads, int qlen, taskfunc f, void *closure)
             }
 
             free(sched.tasks);
+            quiescence_free(sched.pending);
             return -1;
         }
     }
 
-    if(sched_spawn(f, closure, &sched) < 0) {
-        fprintf(stderr, "Can't create the initial task\n");
-        return -1;
-    }
-
     for(int i = 0; i < nthreads; ++i) {
         if((pthread_join(threads[i], NULL) != 0)) {
             fprintf(stderr, "Can't wait the thread %d\n", i);
@@ -110,6 +141,7 @@ sched_init(int nthreads, int qlen, taskfunc f, void *closure)
     }
 
     free(sched.tasks);
+    quiescence_free(sched.pending);
 
     pthread_mutex_destroy(&sched.mutex);
     pthread_cond_destroy(&sched.cond);
@@ -120,45 +152,88 @@ sched_init(int nthreads, int qlen, taskfunc f, void *closure)
 int
 sched_spawn(taskfunc f, void *closure, struct scheduler *s)
 {
+    return sched_spawn_attr(f, closure, NULL, s);
+}
+
+int
+sched_spawn_attr(taskfunc f, void *closure, const struct sched_attr *attr,
+                 struct scheduler *s)
+{
+    // Une seule pile : ni priorité ni thread préféré, seulement le jeton
+    struct sched_token *token = sched_token_inherit(attr);
+    taskfunc cancel = attr ? attr->cancel : NULL;
+
+    // Sous-arbre annulé, la tâche n'a pas besoin d'être exécutée
+    if(sched_token_cancelled(token)) {
+        sched_token_drop(cancel, closure, token, s);
+        return 0;
+    }
+
+    // La tâche est comptée avant d'être visible des autres threads
+    quiescence_arrive(s->pending, self);
+
     pthread_mutex_lock(&s->mutex);
 
     if(s->top + 1 >= s->qlen) {
         pthread_mutex_unlock(&s->mutex);
+        quiescence_depart(s->pending, self);
         errno = EAGAIN;
         fprintf(stderr, "Stack is full\n");
         return -1;
     }
 
     s->top++;
-    s->tasks[s->top] = (struct task_info){closure, f};
+    s->tasks[s->top] = (struct task_info){closure, f, self, token, cancel};
 
-    pthread_cond_signal(&s->cond);
+    if(s->nthsleep > 0) {
+        pthread_cond_signal(&s->cond);
+    }
     pthread_mutex_unlock(&s->mutex);
 
     return 0;
 }
 
+int
+sched_nthreads(struct scheduler *s)
+{
+    return s->nthreads;
+}
+
+const char *
+sched_name(void)
+{
+    return "random";
+}
+
+int
+sched_self(struct scheduler *s)
+{
+    (void)s;
+    return self;
+}
+
 void *
 sched_worker(void *arg)
 {
     struct scheduler *s = (struct scheduler *)arg;
 
+    pthread_mutex_lock(&s->mutex);
+    self = s->nthstarted++;
+    pthread_mutex_unlock(&s->mutex);
+
     struct task_info task;
     while(1) {
         pthread_mutex_lock(&s->mutex);
 
         // S'il on a rien à faire
         if(s->top == -1) {
-            s->nthsleep++;
-            if(s->nthsleep == s->nthreads) {
-                // Signal a tout les threads que il n'y a plus rien à faire
-                // si un thread attend une tâche
-                pthread_cond_broadcast(&s->cond);
+            // Plus aucune tâche en cours nulle part, c'est terminé
+            if(quiescence_done(s->pending)) {
                 pthread_mutex_unlock(&s->mutex);
-
                 break;
             }
 
+            s->nthsleep++;
             pthread_cond_wait(&s->cond, &s->mutex);
             s->nthsleep--;
             pthread_mutex_unlock(&s->mutex);
@@ -176,8 +251,15 @@ sched_worker(void *arg)
         s->top--;
         pthread_mutex_unlock(&s->mutex);
 
-        // Exécute la tâche
-        task.f(task.closure, s);
+        // Exécute la tâche, sauf si elle a été annulée entre temps
+        sched_token_run(task.f, task.cancel, task.closure, task.token, s);
+
+        // Dernière tâche, on réveille ceux qui attendent pour qu'ils partent
+        if(quiescence_depart(s->pending, task.origin)) {
+            pthread_mutex_lock(&s->mutex);
+            pthread_cond_broadcast(&s->cond);
+            pthread_mutex_unlock(&s->mutex);
+        }
     }
 
     return NULL;
@@ -0,0 +1,413 @@
+#include "../includes/quiescence.h"
+#include "../includes/sched.h"
+#include "../includes/token.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* Taille d'une ligne de cache */
+#define CACHE_LINE 64
+
+/* Index du thread courant dans l'ordonnanceur */
+static _Thread_local int self = -1;
+
+/* Graine de l'aléatoire du thread courant */
+static _Thread_local unsigned int seed;
+
+struct task_info {
+    void *closure;
+    taskfunc f;
+
+    /* Case du compteur de tâches en cours où la tâche est comptée */
+    int origin;
+
+    /* Jeton d'annulation, peut être NULL */
+    struct sched_token *token;
+
+    /* Appelée à la place de f si la tâche est annulée, peut être NULL */
+    taskfunc cancel;
+};
+
+/* Pile de tâches, chacune sur ses propres lignes de cache */
+struct shard {
+    /* Mutex qui protège la pile */
+    alignas(CACHE_LINE) pthread_mutex_t mutex;
+
+    /* Position actuelle dans la pile */
+    int top;
+
+    /* Tâches */
+    struct task_info *tasks;
+};
+
+struct scheduler {
+    /* Nombre de threads instanciés */
+    int nthreads;
+
+    /* Nombre de threads ayant démarré, sert à leur attribuer un index */
+    atomic_int nthstarted;
+
+    /* Taille de chaque pile */
+    int qlen;
+
+    /* Piles de tâches */
+    struct shard *shards;
+    int nshards;
+
+    /* Tâches en attente ou en cours d'exécution */
+    struct quiescence *pending;
+
+    /* Condition threads dormant */
+    alignas(CACHE_LINE) pthread_cond_t cond;
+
+    /* Mutex qui protège le sommeil des threads */
+    pthread_mutex_t mutex;
+
+    /* Nombre de threads en attente */
+    atomic_int nthsleep;
+};
+
+/* Lance une tâche des piles */
+void *sched_worker(void *);
+
+/* Libère les ressources de l'ordonnanceur */
+static int sched_init_cleanup(struct scheduler *, int);
+
+/* Nombre de piles : SCHED_SHARDS si défini, un par thread sinon */
+static int
+sched_shards(int nthreads)
+{
+    const char *env = getenv("SCHED_SHARDS");
+    int nshards;
+
+    if(!env) {
+        return nthreads;
+    }
+
+    nshards = atoi(env);
+    if(nshards <= 0) {
+        fprintf(stderr, "SCHED_SHARDS must be greater than 0, using %d\n",
+                nthreads);
+        return nthreads;
+    }
+
+    return nshards;
+}
+
+int
+sched_init(int nthreads, int qlen, taskfunc f, void *closure)
+{
+    static struct scheduler sched;
+
+    if(qlen <= 0) {
+        fprintf(stderr, "qlen must be greater than 0\n");
+        return -1;
+    }
+    sched.qlen = qlen;
+
+    if(nthreads < 0) {
+        fprintf(stderr, "nthreads must be greater than 0\n");
+        return -1;
+    } else if(nthreads == 0) {
+        nthreads = sched_default_threads();
+    }
+    sched.nthreads = nthreads;
+    sched.nshards = 0;
+    sched.shards = NULL;
+    sched.pending = NULL;
+
+    atomic_init(&sched.nthsleep, 0);
+    atomic_init(&sched.nthstarted, 0);
+
+    if(pthread_mutex_init(&sched.mutex, NULL) != 0) {
+        fprintf(stderr, "Can't init mutex\n");
+        return -1;
+    }
+
+    if(pthread_cond_init(&sched.cond, NULL) != 0) {
+        fprintf(stderr, "Can't init condition variable\n");
+        pthread_mutex_destroy(&sched.mutex);
+        return -1;
+    }
+
+    if(!(sched.pending = quiescence_new(nthreads))) {
+        return sched_init_cleanup(&sched, -1);
+    }
+
+    // Piles, alignées sur les lignes de cache
+    int nshards = sched_shards(nthreads);
+    if(!(sched.shards =
+             aligned_alloc(CACHE_LINE, nshards * sizeof(struct shard)))) {
+        perror("Shards");
+        return sched_init_cleanup(&sched, -1);
+    }
+
+    for(int i = 0; i < nshards; ++i) {
+        struct shard *shard = &sched.shards[i];
+
+        shard->top = -1;
+        if(!(shard->tasks = malloc(qlen * sizeof(struct task_info)))) {
+            perror("Stack");
+            return sched_init_cleanup(&sched, -1);
+        }
+
+        if(pthread_mutex_init(&shard->mutex, NULL) != 0) {
+            fprintf(stderr, "Can't init mutex for shard %d\n", i);
+            free(shard->tasks);
+            return sched_init_cleanup(&sched, -1);
+        }
+        sched.nshards++;
+    }
+
+    // Ajoute la tâche initiale avant de lancer les threads, sinon ils
+    // peuvent tous s'endormir et se terminer avant qu'elle n'arrive
+    if(sched_spawn(f, closure, &sched) < 0) {
+        fprintf(stderr, "Can't create the initial task\n");
+        return sched_init_cleanup(&sched, -1);
+    }
+
+    pthread_t threads[nthreads];
+    for(int i = 0; i < nthreads; ++i) {
+        if(pthread_create(&threads[i], NULL, sched_worker, &sched) != 0) {
+            fprintf(stderr, "Can't create the thread %d", i);
+
+            if(i > 0) {
+                fprintf(stderr, ", cancelling already created threads...\n");
+                for(int j = 0; j < i; ++j) {
+                    if(pthread_cancel(threads[j]) != 0) {
+                        fprintf(stderr, "Can't cancel the thread %d\n", j);
+                    }
+                }
+            } else {
+                fprintf(stderr, "\n");
+            }
+
+            return sched_init_cleanup(&sched, -1);
+        }
+    }
+
+    for(int i = 0; i < nthreads; ++i) {
+        if((pthread_join(threads[i], NULL) != 0)) {
+            fprintf(stderr, "Can't wait the thread %d\n", i);
+            return -1;
+        }
+    }
+
+    return sched_init_cleanup(&sched, 1);
+}
+
+static int
+sched_init_cleanup(struct scheduler *s, int ret_code)
+{
+    pthread_cond_destroy(&s->cond);
+
+    pthread_mutex_destroy(&s->mutex);
+
+    if(s->pending) {
+        quiescence_free(s->pending);
+        s->pending = NULL;
+    }
+
+    if(s->shards) {
+        for(int i = 0; i < s->nshards; ++i) {
+            pthread_mutex_destroy(&s->shards[i].mutex);
+            free(s->shards[i].tasks);
+        }
+
+        free(s->shards);
+        s->shards = NULL;
+    }
+
+    return ret_code;
+}
+
+int
+sched_spawn(taskfunc f, void *closure, struct scheduler *s)
+{
+    return sched_spawn_attr(f, closure, NULL, s);
+}
+
+int
+sched_spawn_attr(taskfunc f, void *closure, const struct sched_attr *attr,
+                 struct scheduler *s)
+{
+    int th = self < 0 ? 0 : self;
+
+    struct sched_token *token = sched_token_inherit(attr);
+    taskfunc cancel = attr ? attr->cancel : NULL;
+
+    // Sous-arbre annulé, la tâche n'a pas besoin d'être exécutée
+    if(sched_token_cancelled(token)) {
+        sched_token_drop(cancel, closure, token, s);
+        return 0;
+    }
+
+    // Pas de priorité, mais la tâche va dans la pile du thread préféré
+    if(attr && attr->worker >= 0 && attr->worker < s->nthreads) {
+        th = attr->worker;
+    }
+
+    struct shard *shard = &s->shards[th % s->nshards];
+
+    // La tâche est comptée avant d'être visible des autres threads
+    quiescence_arrive(s->pending, self);
+
+    pthread_mutex_lock(&shard->mutex);
+
+    if(shard->top + 1 >= s->qlen) {
+        pthread_mutex_unlock(&shard->mutex);
+        quiescence_depart(s->pending, self);
+        errno = EAGAIN;
+        fprintf(stderr, "Stack is full\n");
+        return -1;
+    }
+
+    shard->top++;
+    shard->tasks[shard->top] =
+        (struct task_info){closure, f, self, token, cancel};
+
+    pthread_mutex_unlock(&shard->mutex);
+
+    // Réveille un thread endormi. La barrière garantit qu'un thread qui
+    // s'endort après cette lecture verra la tâche
+    atomic_thread_fence(memory_order_seq_cst);
+    if(atomic_load(&s->nthsleep) > 0) {
+        pthread_mutex_lock(&s->mutex);
+        pthread_cond_signal(&s->cond);
+        pthread_mutex_unlock(&s->mutex);
+    }
+
+    return 0;
+}
+
+int
+sched_nthreads(struct scheduler *s)
+{
+    return s->nthreads;
+}
+
+const char *
+sched_name(void)
+{
+#ifdef SHARDED_RANDOM
+    return "sharded-random";
+#else
+    return "sharded";
+#endif
+}
+
+int
+sched_self(struct scheduler *s)
+{
+    (void)s;
+    return self;
+}
+
+/* Retire une tâche de la pile shard : la dernière ajoutée, ou une tâche
+ * aléatoire si compilé avec SHARDED_RANDOM */
+static int
+shard_pop(struct shard *shard, struct task_info *task)
+{
+    int found = 0;
+
+    pthread_mutex_lock(&shard->mutex);
+    if(shard->top != -1) {
+        found = 1;
+
+#ifdef SHARDED_RANDOM
+        // Échange une tâche aléatoire avec le sommet
+        int random_index = rand_r(&seed) % (shard->top + 1);
+
+        struct task_info echange = shard->tasks[random_index];
+        shard->tasks[random_index] = shard->tasks[shard->top];
+        shard->tasks[shard->top] = echange;
+#endif
+
+        *task = shard->tasks[shard->top];
+        shard->top--;
+    }
+    pthread_mutex_unlock(&shard->mutex);
+
+    return found;
+}
+
+/* Renvoie 1 si une des piles contient une tâche */
+static int
+work_available(struct scheduler *s)
+{
+    int found = 0;
+
+    for(int i = 0; i < s->nshards && !found; ++i) {
+        pthread_mutex_lock(&s->shards[i].mutex);
+        found = s->shards[i].top != -1;
+        pthread_mutex_unlock(&s->shards[i].mutex);
+    }
+
+    return found;
+}
+
+/* Endort le thread jusqu'à ce qu'une tâche soit ajoutée ou que tout soit
+ * terminé */
+static void
+sched_park(struct scheduler *s)
+{
+    pthread_mutex_lock(&s->mutex);
+    atomic_fetch_add(&s->nthsleep, 1);
+
+    // Une tâche ajoutée avant qu'on soit compté comme endormi n'a réveillé
+    // personne, on revérifie donc avant d'attendre
+    if(!quiescence_done(s->pending) && !work_available(s)) {
+        pthread_cond_wait(&s->cond, &s->mutex);
+    }
+
+    atomic_fetch_sub(&s->nthsleep, 1);
+    pthread_mutex_unlock(&s->mutex);
+}
+
+void *
+sched_worker(void *arg)
+{
+    struct scheduler *s = (struct scheduler *)arg;
+
+    self = atomic_fetch_add(&s->nthstarted, 1);
+    seed = time(NULL) ^ self;
+
+    struct task_info task;
+    int found;
+    while(1) {
+        found = 0;
+
+        // Parcourt les piles à partir d'une pile aléatoire
+        for(int i = 0, k = rand_r(&seed) % s->nshards;
+            i < s->nshards && !found; ++i) {
+            found = shard_pop(&s->shards[(i + k) % s->nshards], &task);
+        }
+
+        if(!found) {
+            // Plus aucune tâche en cours nulle part, c'est terminé
+            if(quiescence_done(s->pending)) {
+                break;
+            }
+
+            sched_park(s);
+            continue;
+        }
+
+        // Exécute la tâche, sauf si elle a été annulée entre temps
+        sched_token_run(task.f, task.cancel, task.closure, task.token, s);
+
+        // Dernière tâche, on réveille ceux qui dorment pour qu'ils partent
+        if(quiescence_depart(s->pending, task.origin)) {
+            pthread_mutex_lock(&s->mutex);
+            pthread_cond_broadcast(&s->cond);
+            pthread_mutex_unlock(&s->mutex);
+        }
+    }
+
+    return NULL;
+}
@@ -1,36 +1,365 @@
-#pragma GCC diagnostic ignored "-Wcast-function-type"
 #pragma GCC diagnostic ignored "-Wunused-parameter"
 
 #include "../includes/sched.h"
+#include "../includes/token.h"
 
+#include <errno.h>
 #include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* Taille de la pile de chaque thread */
+#define STACK_SIZE (1024 * 1024)
+
+/* Index du thread courant dans l'ordonnanceur */
+static _Thread_local int self = -1;
+
+/* Tâche d'un thread ou en attente d'un thread */
+struct task_info {
+    void *closure;
+    taskfunc f;
+
+    /* Jeton d'annulation, peut être NULL */
+    struct sched_token *token;
+
+    /* Appelée à la place de f si la tâche est annulée, peut être NULL */
+    taskfunc cancel;
+};
+
+/* Emplacement d'un thread : sa pile est gardée d'une tâche à l'autre */
+struct slot {
+    /* Pile du thread, NULL si pas encore allouée */
+    void *stack;
+
+    /* Attributs de création, qui pointent vers la pile */
+    pthread_attr_t attr;
+
+    /* Thread qui a utilisé la pile en dernier */
+    pthread_t thread;
+
+    /* 1 si thread doit être attendu avant de réutiliser la pile */
+    int joinable;
+
+    /* Tâche à exécuter */
+    struct task_info task;
+    struct scheduler *sched;
+
+    /* Emplacement libre suivant */
+    struct slot *next;
+};
+
+struct scheduler {
+    /* Mutex qui protège la structure */
+    pthread_mutex_t mutex;
+
+    /* Signalée quand toutes les tâches sont terminées */
+    pthread_cond_t cond;
+
+    /* Nombre maximum de threads simultanés */
+    int nthreads;
+
+    /* Emplacements de threads, nthreads au total */
+    struct slot *slots;
+
+    /* Emplacements libres */
+    struct slot *free;
+
+    /* Tâches en attente quand tous les threads sont occupés, reprises par
+     * le prochain thread qui termine la sienne. La file grandit au besoin :
+     * une tâche n'est jamais exécutée sur place, ce qui ferait déborder la
+     * pile d'une récursion profonde */
+    struct task_info *queue;
+    int qlen;
+    int head;
+    int count;
+
+    /* Tâches lancées dans un thread ou en attente, pas encore terminées */
+    int pending;
+};
+
+/* Exécute la tâche d'un emplacement et celles en attente, puis le libère */
+static void *sched_thread(void *);
+
+/* Alloue la pile d'un emplacement, avec une page de garde */
+static int
+slot_alloc(struct slot *slot)
+{
+    long page = sysconf(_SC_PAGESIZE);
+
+    slot->stack = mmap(NULL, STACK_SIZE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if(slot->stack == MAP_FAILED) {
+        perror("Thread stack");
+        slot->stack = NULL;
+        return -1;
+    }
+
+    // La pile grandit vers le bas, la garde est au début
+    if(mprotect(slot->stack, page, PROT_NONE) < 0) {
+        perror("Stack guard");
+    }
+
+    pthread_attr_init(&slot->attr);
+    pthread_attr_setstack(&slot->attr, slot->stack, STACK_SIZE);
+
+    return 0;
+}
+
+/* Ajoute une tâche à la file d'attente, en doublant sa taille si elle est
+ * pleine. Appelée sous le mutex
+ *
+ * Renvoie -1 en cas d'échec d'allocation */
+static int
+queue_push(struct scheduler *s, struct task_info *task)
+{
+    if(s->count == s->qlen) {
+        struct task_info *queue;
+
+        if(!(queue = malloc(2 * s->qlen * sizeof(struct task_info)))) {
+            perror("Queue");
+            return -1;
+        }
+
+        // Les tâches sont remises dans l'ordre à partir de 0
+        for(int i = 0; i < s->count; ++i) {
+            queue[i] = s->queue[(s->head + i) % s->qlen];
+        }
+        free(s->queue);
+        s->queue = queue;
+        s->qlen *= 2;
+        s->head = 0;
+    }
+
+    s->queue[(s->head + s->count++) % s->qlen] = *task;
+
+    return 0;
+}
+
+/* Attend le dernier thread de l'emplacement et libère sa pile */
+static void
+slot_free(struct slot *slot)
+{
+    if(slot->joinable) {
+        pthread_join(slot->thread, NULL);
+        slot->joinable = 0;
+    }
+
+    if(slot->stack) {
+        pthread_attr_destroy(&slot->attr);
+        munmap(slot->stack, STACK_SIZE);
+        slot->stack = NULL;
+    }
+}
 
 int
 sched_init(int nthreads, int qlen, taskfunc f, void *closure)
 {
-    sched_spawn(f, closure, NULL);
-    return 0;
+    static struct scheduler sched;
+    int rc;
+
+    if(nthreads < 0) {
+        fprintf(stderr, "nthreads must be greater than 0\n");
+        return -1;
+    } else if(nthreads == 0) {
+        nthreads = sched_default_threads();
+    }
+    sched.nthreads = nthreads;
+    sched.pending = 0;
+
+    if(qlen <= 0) {
+        fprintf(stderr, "qlen must be greater than 0\n");
+        return -1;
+    }
+    sched.qlen = qlen;
+    sched.head = 0;
+    sched.count = 0;
+
+    if(pthread_mutex_init(&sched.mutex, NULL) != 0) {
+        fprintf(stderr, "Can't init mutex\n");
+        return -1;
+    }
+
+    if(pthread_cond_init(&sched.cond, NULL) != 0) {
+        fprintf(stderr, "Can't init condition variable\n");
+        pthread_mutex_destroy(&sched.mutex);
+        return -1;
+    }
+
+    // Les piles ne sont allouées qu'à leur première utilisation
+    if(!(sched.slots = calloc(nthreads, sizeof(struct slot)))) {
+        perror("Slots");
+        pthread_cond_destroy(&sched.cond);
+        pthread_mutex_destroy(&sched.mutex);
+        return -1;
+    }
+
+    if(!(sched.queue = malloc(qlen * sizeof(struct task_info)))) {
+        perror("Queue");
+        free(sched.slots);
+        pthread_cond_destroy(&sched.cond);
+        pthread_mutex_destroy(&sched.mutex);
+        return -1;
+    }
+
+    sched.free = NULL;
+    for(int i = nthreads - 1; i >= 0; --i) {
+        sched.slots[i].next = sched.free;
+        sched.free = &sched.slots[i];
+    }
+
+    // Attend que toutes les tâches soient terminées, s'il y en a
+    rc = sched_spawn(f, closure, &sched);
+    pthread_mutex_lock(&sched.mutex);
+    while(sched.pending > 0) {
+        pthread_cond_wait(&sched.cond, &sched.mutex);
+    }
+    pthread_mutex_unlock(&sched.mutex);
+
+    for(int i = 0; i < nthreads; ++i) {
+        slot_free(&sched.slots[i]);
+    }
+    free(sched.slots);
+    free(sched.queue);
+
+    pthread_mutex_destroy(&sched.mutex);
+    pthread_cond_destroy(&sched.cond);
+
+    return rc < 0 ? -1 : 1;
 }
 
 int
 sched_spawn(taskfunc f, void *closure, struct scheduler *s)
 {
-    pthread_t thread;
+    return sched_spawn_attr(f, closure, NULL, s);
+}
+
+int
+sched_spawn_attr(taskfunc f, void *closure, const struct sched_attr *attr,
+                 struct scheduler *s)
+{
+    // Chaque tâche a son thread : ni priorité ni thread préféré, seulement
+    // le jeton
+    struct sched_token *token = sched_token_inherit(attr);
+    taskfunc cancel = attr ? attr->cancel : NULL;
+    struct slot *slot;
     int err;
 
-    // Création d'un thread pour la tâche
-    if((err = pthread_create(&thread, NULL, (void *(*)(void *))f, closure)) !=
-       0) {
+    // Sous-arbre annulé, la tâche n'a pas besoin d'être exécutée
+    if(sched_token_cancelled(token)) {
+        sched_token_drop(cancel, closure, token, s);
+        return 0;
+    }
+
+    pthread_mutex_lock(&s->mutex);
+
+    struct task_info task = {closure, f, token, cancel};
+
+    // Tous les threads sont occupés, la tâche attend qu'un thread se libère
+    if(!(slot = s->free)) {
+        if(queue_push(s, &task) < 0) {
+            pthread_mutex_unlock(&s->mutex);
+            errno = EAGAIN;
+            return -1;
+        }
+        s->pending++;
+        pthread_mutex_unlock(&s->mutex);
+        return 0;
+    }
+
+    s->free = slot->next;
+
+    // Le thread précédent a rendu l'emplacement juste avant de se terminer,
+    // l'attente est donc courte
+    if(slot->joinable) {
+        pthread_join(slot->thread, NULL);
+        slot->joinable = 0;
+    }
+
+    slot->task = task;
+    slot->sched = s;
+
+    // Le thread est créé sous le mutex : il ne peut rendre l'emplacement
+    // qu'une fois thread et joinable écrits
+    if(slot->stack || slot_alloc(slot) == 0) {
+        if((err = pthread_create(&slot->thread, &slot->attr, sched_thread,
+                                 slot)) == 0) {
+            slot->joinable = 1;
+            s->pending++;
+            pthread_mutex_unlock(&s->mutex);
+            return 0;
+        }
         fprintf(stderr, "pthread_create error %d\n", err);
-        return -1;
     }
+    slot->next = s->free;
+    s->free = slot;
 
-    // Attend la fin du thread
-    if((err = pthread_join(thread, NULL)) != 0) {
-        fprintf(stderr, "pthread_join error %d\n", err);
+    // Échec de création : la tâche attend qu'un thread en cours termine la
+    // sienne, s'il y en a un
+    if(s->pending == 0 || queue_push(s, &task) < 0) {
+        pthread_mutex_unlock(&s->mutex);
+        errno = EAGAIN;
         return -1;
     }
+    s->pending++;
+    pthread_mutex_unlock(&s->mutex);
 
     return 0;
 }
+
+static void *
+sched_thread(void *arg)
+{
+    struct slot *slot = (struct slot *)arg;
+    struct scheduler *s = slot->sched;
+
+    struct task_info task = slot->task;
+
+    self = slot - s->slots;
+
+    while(1) {
+        // Une tâche en attente a pu être annulée entre temps
+        sched_token_run(task.f, task.cancel, task.closure, task.token, s);
+
+        pthread_mutex_lock(&s->mutex);
+        s->pending--;
+        if(s->count == 0) {
+            break;
+        }
+
+        // Réutilise le thread pour la prochaine tâche en attente
+        task = s->queue[s->head];
+        s->head = (s->head + 1) % s->qlen;
+        s->count--;
+        pthread_mutex_unlock(&s->mutex);
+    }
+
+    // Rend l'emplacement, le prochain qui le prend attendra ce thread
+    slot->next = s->free;
+    s->free = slot;
+    if(s->pending == 0) {
+        pthread_cond_signal(&s->cond);
+    }
+    pthread_mutex_unlock(&s->mutex);
+
+    return NULL;
+}
+
+int
+sched_nthreads(struct scheduler *s)
+{
+    return s->nthreads;
+}
+
+const char *
+sched_name(void)
+{
+    return "threads";
+}
+
+int
+sched_self(struct scheduler *s)
+{
+    return self;
+}
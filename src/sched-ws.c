@@ -1,14 +1,53 @@
+#include "../includes/fiber.h"
+#include "../includes/hugepage.h"
+#include "../includes/perf.h"
+#include "../includes/quiescence.h"
+#include "../includes/replay.h"
 #include "../includes/sched.h"
+#include "../includes/token.h"
 
 #include <errno.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
 
 /* Tâche */
 struct task_info {
     void *closure;
     taskfunc f;
+
+    /* Case du compteur de tâches en cours où la tâche est comptée */
+    int origin;
+
+    /* Jeton d'annulation, peut être NULL */
+    struct sched_token *token;
+
+    /* Appelée à la place de f si la tâche est annulée, peut être NULL */
+    taskfunc cancel;
+
+    /* Identifiant de la tâche, calculé seulement pour l'enregistrement et le
+     * rejeu */
+    uint64_t id;
+};
+
+/* Deque circulaire de tâches d'un niveau de priorité */
+struct deque {
+    /* Premier élément du deque (dernier ajouter) */
+    int bottom;
+
+    /* Dernier élément du deque (premier ajouter) */
+    int top;
+
+    /* Tâches */
+    struct task_info *tasks;
 };
 
 /* Statistiques */
@@ -21,66 +60,224 @@ struct stats {
 
     /* Total des tâches effecutés */
     int total_tasks;
+
+    /* Total des mises en sommeil */
+    int total_sleep;
+
+    /* Total des tâches annulées retirées sans être exécutées */
+    int total_cancelled;
+
+    /* Total des attentes d'une tâche dans sa fiber */
+    int total_waits;
+
+    /* Total des tâches prises dans la file d'injection */
+    int total_injected;
+
+    /* Total des tâches rejouées à leur place */
+    int total_replayed;
+
+    /* Plus grand nombre de tâches en attente dans les deques du thread */
+    int peak_depth;
 };
 
-/* Structure de chaque thread */
-struct worker {
-    /* Premier élément du deque (dernier ajouter) */
-    int bottom;
+/* Taille d'une ligne de cache */
+#define CACHE_LINE 64
 
-    /* Statistiques récoltés */
-    struct stats data;
+/* Nombre maximum de tours de vol ratés avant qu'un thread ne s'endorme,
+ * atteint quand ses vols réussissent tous */
+#define IDLE_ROUNDS 64
 
-    /* Mutex qui protège cette structure */
-    pthread_mutex_t mutex;
+/* Précision du taux d'échec des vols : FAIL_ONE correspond à 100 % */
+#define FAIL_ONE 1024
 
-    /* Deque de tâches */
-    struct task_info *tasks;
+/* Tâches prises à la fois dans la file d'injection */
+#define INJECT_BATCH 8
+
+/* Un thread regarde la file d'injection au moins une fois toutes les
+ * INJECT_INTERVAL tâches, même s'il a du travail */
+#define INJECT_INTERVAL 61
+
+/* En mode travail d'abord, nombre de tâches en attente dans les deques du
+ * thread à partir duquel une nouvelle tâche va dans la file d'injection */
+#define WORKFIRST_DEPTH 128
+
+/* Temps en nanosecondes pendant lequel tous les threads qui rejouent peuvent
+ * attendre la prochaine tâche de leur journal, avant de considérer que le
+ * programme a changé et d'exécuter les suivantes dans le désordre */
+#define REPLAY_PATIENCE 10000000L
+
+/* Case de la file d'injection */
+struct cell {
+    /* Numéro de séquence : vaut n quand la case attend l'ajout n, et n + 1
+     * quand elle contient la tâche de cet ajout */
+    atomic_size_t seq;
+
+    struct task_info task;
+    int prio;
+};
+
+/* File d'injection multi-producteurs multi-consommateurs sans verrou
+ * (Vyukov), pour les tâches créées hors des threads de l'ordonnanceur : un
+ * producteur réserve une case en avançant head puis publie la tâche avec son
+ * numéro de séquence, un consommateur fait de même avec tail */
+struct inject {
+    /* Prochain ajout */
+    alignas(CACHE_LINE) atomic_size_t head;
+
+    /* Prochain retrait */
+    alignas(CACHE_LINE) atomic_size_t tail;
+
+    /* Cases, en nombre puissance de 2 */
+    alignas(CACHE_LINE) struct cell *cells;
+    size_t mask;
+};
+
+/* Structure de chaque thread
+ *
+ * Les champs lus par les voleurs, ceux propres au thread et les statistiques
+ * sont sur des lignes de cache différentes, pour qu'un voleur ou un thread
+ * voisin n'invalide pas la ligne utilisée par le thread */
+struct worker {
+    /* Mutex qui protège les deques */
+    alignas(CACHE_LINE) pthread_mutex_t mutex;
+
+    /* Un deque par niveau de priorité */
+    struct deque deques[SCHED_NPRIO];
+
+    /* Nombre de tâches dans les deques, écrit sous le mutex et lu sans par
+     * le thread en mode travail d'abord */
+    atomic_int depth;
 
     /* Thread */
-    pthread_t thread;
+    alignas(CACHE_LINE) pthread_t thread;
 
-    /* Dernier élément du deque (premier ajouter) */
-    int top;
+    /* Index du thread */
+    int id;
+
+    /* Graine du choix des victimes */
+    unsigned int seed;
+
+    /* Ordonnanceur */
+    struct scheduler *sched;
+
+    /* Compteurs matériels, NULL si désactivés */
+    struct perf *perf;
+
+    /* Tâche à exécuter avant toute autre, créée en mode travail d'abord
+     * (f vaut NULL s'il n'y en a pas) */
+    struct task_info next;
+
+    /* 1 quand une tâche est partie dans la file d'injection parce que le
+     * deque était trop profond : le thread ne vide plus la file avant
+     * d'avoir dépilé toutes ses suites */
+    int unwinding;
+
+    /* Tâches du journal rejoué, dans l'ordre où le thread doit les exécuter,
+     * et pour chacune 1 quand elle a été créée, 2 quand elle a été exécutée */
+    struct task_info *replay_tasks;
+    atomic_char *replay_ready;
+    int replay_len;
+
+    /* Statistiques récoltés */
+    alignas(CACHE_LINE) struct stats data;
 };
 
 /* Scheduler partagé */
 struct scheduler {
-    /* Condition threads dormant */
-    pthread_cond_t cond;
-
-    /* Mutex qui protège cette structure */
-    pthread_mutex_t mutex;
-
     /* Nombre de threads instanciés */
     int nthreads;
 
-    /* Compteur des threads dormants */
-    int nthsleep;
-
     /* Taille deque */
     int qlen;
 
     /* Liste de workers par threads */
     struct worker *workers;
+
+    /* Tâches en attente ou en cours d'exécution */
+    struct quiescence *pending;
+
+    /* 1 si les threads ouvrent des compteurs matériels */
+    int perf;
+
+    /* Fibers des tâches, NULL si désactivées */
+    struct fibers *fibers;
+
+    /* 1 pour exécuter une nouvelle tâche tout de suite et rendre la suite
+     * de sa mère volable (travail d'abord), 0 pour la mettre dans le deque
+     * et continuer la mère (aide d'abord) */
+    int workfirst;
+
+    /* Journaux enregistrés, NULL si désactivés */
+    struct record *record;
+
+    /* Journaux rejoués, NULL si désactivés */
+    struct replay *replay;
+
+    /* Tâches créées hors des tâches, pour leur identifiant */
+    atomic_uint_least64_t external;
+
+    /* Tâches rejouées absentes des journaux, exécutées par n'importe quel
+     * thread */
+    pthread_mutex_t strays_mutex;
+    struct task_info *strays;
+    int nstrays;
+    int strays_size;
+
+    /* Condition threads dormant */
+    alignas(CACHE_LINE) pthread_cond_t cond;
+
+    /* Mutex qui protège le sommeil des threads */
+    pthread_mutex_t mutex;
+
+    /* Compteur des threads dormants */
+    atomic_int nthsleep;
+
+    /* Compteur des threads qui cherchent une tâche */
+    atomic_int nthsearching;
+
+    /* Tâches de haute priorité en attente, lu avant chaque tâche par tous
+     * les threads */
+    alignas(CACHE_LINE) atomic_int nhigh;
+
+    /* Tâches créées hors des threads de l'ordonnanceur */
+    struct inject inject;
 };
 
+/* Index du thread courant dans l'ordonnanceur */
+static _Thread_local int self = -1;
+
+/* Identifiant de la tâche en cours et nombre de filles qu'elle a créées, pour
+ * l'enregistrement et le rejeu */
+static _Thread_local uint64_t current_id = 0;
+static _Thread_local uint64_t current_children = 0;
+
 /* Lance une tâche de la pile */
 void *sched_worker(void *);
 
+/* Renvoie 1 si le mode travail d'abord est demandé (variable
+ * SCHED_WORKFIRST) */
+static int
+workfirst_enabled(void)
+{
+    const char *env = getenv("SCHED_WORKFIRST");
+
+    return env && *env && strcmp(env, "0") != 0;
+}
+
 /* Nettoie les opérations effectuées par l'initialisation de l'ordonnanceur */
-int sched_init_cleanup(struct scheduler, int);
+int sched_init_cleanup(struct scheduler *, int);
 
-/* Récupère l'index du thread courant
- *
- * Assume que le mutex de l'ordonnanceur est verrouillé */
-int current_thread(struct scheduler *);
+/* Relance une fiber qui attendait */
+static void sched_resume(struct fiber *, void *);
 
 int
 sched_init(int nthreads, int qlen, taskfunc f, void *closure)
 {
     static struct scheduler sched;
-    sched.workers = NULL;
+
+    // Appels à sched_init, qui numérotent les journaux
+    static int runs = 0;
+    int run = runs++;
 
     if(qlen <= 0) {
         fprintf(stderr, "qlen must be greater than 0\n");
@@ -88,6 +285,12 @@ sched_init(int nthreads, int qlen, taskfunc f, void *closure)
     }
     sched.qlen = qlen + 1; // circular buffer
 
+    // Les suites des tâches en mode travail d'abord s'ajoutent aux qlen
+    // tâches que doit pouvoir contenir un deque
+    if(workfirst_enabled()) {
+        sched.qlen += WORKFIRST_DEPTH;
+    }
+
     if(nthreads < 0) {
         fprintf(stderr, "nthreads must be greater than 0\n");
         return -1;
@@ -95,57 +298,165 @@ sched_init(int nthreads, int qlen, taskfunc f, void *closure)
         nthreads = sched_default_threads();
     }
     sched.nthreads = 0;
+    sched.workers = NULL;
+    sched.pending = NULL;
+    sched.perf = perf_enabled();
+    sched.fibers = NULL;
+    sched.workfirst = 0;
+    sched.record = NULL;
+    sched.replay = NULL;
+    sched.strays = NULL;
+    sched.nstrays = 0;
+    sched.strays_size = 0;
+    sched.inject.cells = NULL;
 
     // Initialisation variable de condition
     if(pthread_cond_init(&sched.cond, NULL) != 0) {
         fprintf(stderr, "Can't init condition variable\n");
-        return sched_init_cleanup(sched, -1);
+        return sched_init_cleanup(&sched, -1);
     }
 
     // Initialisation du mutex
     if(pthread_mutex_init(&sched.mutex, NULL) != 0) {
         fprintf(stderr, "Can't init mutex\n");
-        return sched_init_cleanup(sched, -1);
+        return sched_init_cleanup(&sched, -1);
+    }
+    if(pthread_mutex_init(&sched.strays_mutex, NULL) != 0) {
+        fprintf(stderr, "Can't init mutex\n");
+        return sched_init_cleanup(&sched, -1);
+    }
+
+    atomic_init(&sched.nthsleep, 0);
+    atomic_init(&sched.nthsearching, 0);
+    atomic_init(&sched.nhigh, 0);
+    atomic_init(&sched.external, 0);
+
+    if(record_enabled() && !(sched.record = record_new(nthreads, run))) {
+        return sched_init_cleanup(&sched, -1);
+    }
+    if(replay_enabled() && !(sched.replay = replay_load(nthreads, run))) {
+        return sched_init_cleanup(&sched, -1);
+    }
+
+    // File d'injection, d'au moins qlen cases
+    sched.inject.mask = 1;
+    while(sched.inject.mask < (size_t)qlen) {
+        sched.inject.mask *= 2;
+    }
+    if(!(sched.inject.cells =
+             huge_alloc(sched.inject.mask * sizeof(struct cell)))) {
+        perror("Inject queue");
+        return sched_init_cleanup(&sched, -1);
     }
+    for(size_t i = 0; i < sched.inject.mask; ++i) {
+        atomic_init(&sched.inject.cells[i].seq, i);
+    }
+    sched.inject.mask--;
+    atomic_init(&sched.inject.head, 0);
+    atomic_init(&sched.inject.tail, 0);
 
-    sched.nthsleep = 0;
+    // Compteur des tâches en cours, une case par thread
+    if(!(sched.pending = quiescence_new(nthreads))) {
+        return sched_init_cleanup(&sched, -1);
+    }
 
-    // Initialize workers
-    if(!(sched.workers = malloc(nthreads * sizeof(struct worker)))) {
+    // Initialize workers, alignés sur les lignes de cache
+    if(!(sched.workers =
+             aligned_alloc(CACHE_LINE, nthreads * sizeof(struct worker)))) {
         perror("Workers");
-        return -1;
+        return sched_init_cleanup(&sched, -1);
     }
     for(int i = 0; i < nthreads; ++i) {
+        for(int p = 0; p < SCHED_NPRIO; ++p) {
+            sched.workers[i].deques[p].tasks = NULL;
+        }
+        sched.workers[i].id = i;
+        sched.workers[i].seed = time(NULL) + i;
+        sched.workers[i].sched = &sched;
+
         // Statistiques
         sched.workers[i].data.total_failed_steal = 0;
         sched.workers[i].data.total_steal = 0;
         sched.workers[i].data.total_tasks = 0;
+        sched.workers[i].data.total_sleep = 0;
+        sched.workers[i].data.total_cancelled = 0;
+        sched.workers[i].data.total_waits = 0;
+        sched.workers[i].data.total_injected = 0;
+        sched.workers[i].data.total_replayed = 0;
+        sched.workers[i].data.peak_depth = 0;
+        sched.workers[i].next.f = NULL;
+        sched.workers[i].unwinding = 0;
+        sched.workers[i].perf = NULL;
+        sched.workers[i].replay_tasks = NULL;
+        sched.workers[i].replay_ready = NULL;
+        sched.workers[i].replay_len = 0;
 
         // Initialisation mutex
         if(pthread_mutex_init(&sched.workers[i].mutex, NULL) != 0) {
             fprintf(stderr, "Can't init mutex %d\n", i);
-            return sched_init_cleanup(sched, -1);
+            return sched_init_cleanup(&sched, -1);
         }
+        sched.nthreads++;
 
-        // Initialisation deque
-        if(!(sched.workers[i].tasks =
-                 malloc(sched.qlen * sizeof(struct task_info)))) {
-            fprintf(stderr, "Thread %d: ", i);
-            perror("Deque list");
-            return sched_init_cleanup(sched, -1);
+        // Initialisation deques
+        for(int p = 0; p < SCHED_NPRIO; ++p) {
+            struct deque *d = &sched.workers[i].deques[p];
+
+            if(!(d->tasks =
+                     huge_alloc(sched.qlen * sizeof(struct task_info)))) {
+                fprintf(stderr, "Thread %d: ", i);
+                perror("Deque list");
+                return sched_init_cleanup(&sched, -1);
+            }
+            d->bottom = 0;
+            d->top = 0;
+        }
+        atomic_init(&sched.workers[i].depth, 0);
+
+        // Place de chaque tâche du journal rejoué
+        if(sched.replay) {
+            struct worker *w = &sched.workers[i];
+
+            w->replay_len = replay_length(sched.replay, i);
+            if(!(w->replay_tasks = calloc(w->replay_len ? w->replay_len : 1,
+                                          sizeof(struct task_info))) ||
+               !(w->replay_ready = calloc(w->replay_len ? w->replay_len : 1,
+                                          1))) {
+                perror("Replay tasks");
+                return sched_init_cleanup(&sched, -1);
+            }
         }
-        sched.workers[i].bottom = 0;
-        sched.workers[i].top = 0;
     }
 
-    // Initialise l'aléatoire
-    srand(time(NULL));
+    // Une fiber change de thread en cours de tâche, ce que les journaux ne
+    // savent pas décrire
+    if((fibers_enabled() || workfirst_enabled()) &&
+       (sched.record || sched.replay)) {
+        fprintf(stderr, "SCHED_FIBERS and SCHED_WORKFIRST ignored with "
+                        "SCHED_RECORD/REPLAY\n");
+    } else {
+        // La suite d'une tâche est sa fiber arrêtée
+        sched.workfirst = workfirst_enabled();
+    }
+
+    // Une tâche qui attend rend son thread aux autres
+    if((fibers_enabled() || sched.workfirst) && !sched.record &&
+       !sched.replay &&
+       !(sched.fibers = fibers_new(nthreads, sched_resume, &sched))) {
+        return sched_init_cleanup(&sched, -1);
+    }
+
+    // Ajoute la tâche initiale avant de lancer les threads, sinon ils
+    // peuvent tous s'endormir et se terminer avant qu'elle n'arrive
+    if(sched_spawn(f, closure, &sched) < 0) {
+        fprintf(stderr, "Can't queue the initial task\n");
+        return sched_init_cleanup(&sched, -1);
+    }
 
     // Création des threads
     for(int i = 0; i < nthreads; ++i) {
-        pthread_mutex_lock(&sched.mutex);
         if(pthread_create(&sched.workers[i].thread, NULL, sched_worker,
-                          (void *)&sched) != 0) {
+                          (void *)&sched.workers[i]) != 0) {
             fprintf(stderr, "Can't create thread %d\n", i);
 
             // Annule les threads déjà créer
@@ -153,18 +464,8 @@ sched_init(int nthreads, int qlen, taskfunc f, void *closure)
                 pthread_cancel(sched.workers[j].thread);
             }
 
-            return sched_init_cleanup(sched, -1);
+            return sched_init_cleanup(&sched, -1);
         }
-
-        sched.nthreads++;
-
-        pthread_mutex_unlock(&sched.mutex);
-    }
-
-    // Ajoute la tâche initiale
-    if(sched_spawn(f, closure, &sched) < 0) {
-        fprintf(stderr, "Can't queue the initial task\n");
-        return sched_init_cleanup(sched, -1);
     }
 
     // Attend la fin des threads
@@ -179,20 +480,35 @@ sched_init(int nthreads, int qlen, taskfunc f, void *closure)
                 }
             }
 
-            return sched_init_cleanup(sched, -1);
+            return sched_init_cleanup(&sched, -1);
         }
     }
 
     /* Statistiques */
 
+    struct rusage usage;
     int total_failed_steal = 0;
     int total_steal = 0;
     int total_tasks = 0;
+    int total_sleep = 0;
+    int total_cancelled = 0;
+    int total_waits = 0;
+    int total_injected = 0;
+    int total_replayed = 0;
+    int peak_depth = 0;
 
     for(int i = 0; i < sched.nthreads; ++i) {
         total_failed_steal += sched.workers[i].data.total_failed_steal;
         total_steal += sched.workers[i].data.total_steal;
         total_tasks += sched.workers[i].data.total_tasks;
+        total_sleep += sched.workers[i].data.total_sleep;
+        total_cancelled += sched.workers[i].data.total_cancelled;
+        total_waits += sched.workers[i].data.total_waits;
+        total_injected += sched.workers[i].data.total_injected;
+        total_replayed += sched.workers[i].data.total_replayed;
+        if(sched.workers[i].data.peak_depth > peak_depth) {
+            peak_depth = sched.workers[i].data.peak_depth;
+        }
     }
 
     printf("------- Statistiques -------\n");
@@ -200,157 +516,899 @@ sched_init(int nthreads, int qlen, taskfunc f, void *closure)
     printf(" Total vols\t    : %d\n", total_steal);
     printf(" Total vols réussis : %d\n", total_steal - total_failed_steal);
     printf(" Total vols échoués : %d\n", total_failed_steal);
+    printf(" Total sommeils     : %d\n", total_sleep);
+    printf(" Total annulées     : %d\n", total_cancelled);
+    printf(" Total injectées    : %d\n", total_injected);
+    if(sched.fibers) {
+        printf(" Total attentes     : %d\n", total_waits);
+    }
+    if(sched.replay) {
+        printf(" Total rejouées     : %d\n", total_replayed);
+    }
+    printf(" Deque le plus plein: %d tâches (%zu Kio)\n", peak_depth,
+           peak_depth * sizeof(struct task_info) >> 10);
+    if(sched.fibers) {
+        printf(" Piles des fibers   : %zu Kio\n",
+               fibers_memory(sched.fibers) >> 10);
+    }
+    if(getrusage(RUSAGE_SELF, &usage) == 0) {
+        printf(" Mémoire max (RSS)  : %ld Kio\n", usage.ru_maxrss);
+    }
     printf("----------------------------\n");
 
-    return sched_init_cleanup(sched, 1);
+    record_write(sched.record);
+
+    if(huge_enabled()) {
+        size_t size = sched.qlen * sizeof(struct task_info), backed = 0;
+
+        for(int i = 0; i < sched.nthreads; ++i) {
+            for(int p = 0; p < SCHED_NPRIO; ++p) {
+                backed += huge_backed(sched.workers[i].deques[p].tasks, size);
+            }
+        }
+        huge_report("deques", backed, size * SCHED_NPRIO * sched.nthreads);
+    }
+
+    if(sched.perf) {
+        struct perf *perfs[sched.nthreads];
+
+        for(int i = 0; i < sched.nthreads; ++i) {
+            perfs[i] = sched.workers[i].perf;
+        }
+        perf_report(perfs, sched.nthreads);
+    }
+
+    return sched_init_cleanup(&sched, 1);
 }
 
 int
-sched_init_cleanup(struct scheduler s, int ret_code)
+sched_init_cleanup(struct scheduler *s, int ret_code)
 {
-    pthread_cond_destroy(&s.cond);
+    pthread_cond_destroy(&s->cond);
+
+    pthread_mutex_destroy(&s->mutex);
+    pthread_mutex_destroy(&s->strays_mutex);
+
+    record_free(s->record);
+    s->record = NULL;
+    replay_free(s->replay);
+    s->replay = NULL;
+    free(s->strays);
+    s->strays = NULL;
+
+    if(s->fibers) {
+        fibers_free(s->fibers);
+        s->fibers = NULL;
+    }
+
+    huge_free(s->inject.cells);
+    s->inject.cells = NULL;
 
-    pthread_mutex_destroy(&s.mutex);
+    if(s->pending) {
+        quiescence_free(s->pending);
+        s->pending = NULL;
+    }
 
-    if(s.workers) {
-        for(int i = 0; i < s.nthreads; ++i) {
-            pthread_mutex_destroy(&s.workers[i].mutex);
+    if(s->workers) {
+        for(int i = 0; i < s->nthreads; ++i) {
+            perf_free(s->workers[i].perf);
+            free(s->workers[i].replay_tasks);
+            free((void *)s->workers[i].replay_ready);
+            pthread_mutex_destroy(&s->workers[i].mutex);
 
-            free(s.workers[i].tasks);
-            s.workers[i].tasks = NULL;
+            for(int p = 0; p < SCHED_NPRIO; ++p) {
+                huge_free(s->workers[i].deques[p].tasks);
+                s->workers[i].deques[p].tasks = NULL;
+            }
         }
 
-        free(s.workers);
-        s.workers = NULL;
+        free(s->workers);
+        s->workers = NULL;
     }
 
     return ret_code;
 }
 
 int
-current_thread(struct scheduler *s)
+sched_nthreads(struct scheduler *s)
 {
-    pthread_t current = pthread_self();
+    return s->nthreads;
+}
 
-    for(int i = 0; i < s->nthreads; ++i) {
-        if(pthread_equal(s->workers[i].thread, current)) {
-            return i;
+const char *
+sched_name(void)
+{
+    return "ws";
+}
+
+int
+sched_self(struct scheduler *s)
+{
+    (void)s;
+    return self;
+}
+
+/* Réveille un thread endormi pour qu'il vienne voler, sauf si un thread
+ * cherche déjà une tâche : il prendra celle-ci, et réveillera le suivant
+ * s'il la vole. Le nombre de threads éveillés suit ainsi la quantité de
+ * travail
+ *
+ * La barrière garantit qu'un thread qui s'endort ou arrête de chercher après
+ * ces lectures verra la tâche */
+static void
+sched_wake(struct scheduler *s)
+{
+    atomic_thread_fence(memory_order_seq_cst);
+    if(atomic_load(&s->nthsleep) > 0 && atomic_load(&s->nthsearching) == 0) {
+        pthread_mutex_lock(&s->mutex);
+        pthread_cond_signal(&s->cond);
+        pthread_mutex_unlock(&s->mutex);
+    }
+}
+
+/* Ajoute la tâche à la file d'injection
+ *
+ * Renvoie 0 si la file est pleine */
+static int
+inject_push(struct inject *q, struct task_info *task, int prio)
+{
+    size_t pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+    struct cell *c;
+
+    while(1) {
+        c = &q->cells[pos & q->mask];
+        size_t seq = atomic_load_explicit(&c->seq, memory_order_acquire);
+        ptrdiff_t diff = (ptrdiff_t)seq - (ptrdiff_t)pos;
+
+        if(diff == 0) {
+            // Case libre, on la réserve
+            if(atomic_compare_exchange_weak_explicit(&q->head, &pos, pos + 1,
+                                                     memory_order_relaxed,
+                                                     memory_order_relaxed)) {
+                break;
+            }
+        } else if(diff < 0) {
+            // La case contient encore une tâche d'un tour précédent
+            return 0;
+        } else {
+            pos = atomic_load_explicit(&q->head, memory_order_relaxed);
         }
     }
 
-    return -1;
+    c->task = *task;
+    c->prio = prio;
+    atomic_store_explicit(&c->seq, pos + 1, memory_order_release);
+
+    return 1;
+}
+
+/* Retire jusqu'à max tâches parmi les plus anciennes de la file d'injection,
+ * réservées ensemble en avançant tail une seule fois
+ *
+ * Renvoie le nombre de tâches retirées, 0 si la file est vide */
+static int
+inject_pop(struct inject *q, struct task_info *tasks, int *prios, int max)
+{
+    size_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    int n;
+
+    while(1) {
+        // Tâches publiées à la suite à partir de pos
+        for(n = 0; n < max; ++n) {
+            struct cell *c = &q->cells[(pos + n) & q->mask];
+            size_t seq = atomic_load_explicit(&c->seq, memory_order_acquire);
+
+            if(seq != pos + n + 1) {
+                break;
+            }
+        }
+
+        if(n == 0) {
+            size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+
+            // Vide, ou un autre consommateur est passé entre temps
+            if(tail == pos) {
+                return 0;
+            }
+            pos = tail;
+        } else if(atomic_compare_exchange_weak_explicit(
+                      &q->tail, &pos, pos + n, memory_order_relaxed,
+                      memory_order_relaxed)) {
+            break;
+        }
+    }
+
+    for(int i = 0; i < n; ++i) {
+        struct cell *c = &q->cells[(pos + i) & q->mask];
+
+        tasks[i] = c->task;
+        prios[i] = c->prio;
+        // Libre pour l'ajout du tour suivant
+        atomic_store_explicit(&c->seq, pos + i + q->mask + 1,
+                              memory_order_release);
+    }
+
+    return n;
+}
+
+/* Renvoie 1 si la file d'injection contient peut-être une tâche */
+static int
+inject_available(struct inject *q)
+{
+    return atomic_load(&q->head) != atomic_load(&q->tail);
+}
+
+/* Recompte les tâches en attente dans les deques de w, et garde le plus
+ * grand nombre vu. Appelée sous son mutex après chaque changement */
+static void
+deque_depth(struct scheduler *s, struct worker *w)
+{
+    int depth = 0;
+
+    for(int p = 0; p < SCHED_NPRIO; ++p) {
+        depth += (w->deques[p].bottom - w->deques[p].top + s->qlen) % s->qlen;
+    }
+
+    atomic_store_explicit(&w->depth, depth, memory_order_relaxed);
+    if(depth > w->data.peak_depth) {
+        w->data.peak_depth = depth;
+    }
+}
+
+/* Ajoute la tâche au deque de priorité prio du thread th, f vaut NULL pour
+ * une fiber qui reprend (closure)
+ *
+ * Renvoie 0 si le deque est plein */
+static int
+deque_push(struct scheduler *s, int th, int prio, struct task_info *task)
+{
+    struct worker *w = &s->workers[th];
+    struct deque *d = &w->deques[prio];
+
+    pthread_mutex_lock(&w->mutex);
+
+    int next = (d->bottom + 1) % s->qlen;
+    if(next == d->top) {
+        pthread_mutex_unlock(&w->mutex);
+        return 0;
+    }
+
+    // Une fiber qui reprend n'est pas une nouvelle tâche
+    if(task->f) {
+        w->data.total_tasks++;
+    }
+
+    d->tasks[d->bottom] = *task;
+    d->bottom = next;
+
+    if(prio == SCHED_PRIO_HIGH) {
+        atomic_fetch_add(&s->nhigh, 1);
+    }
+
+    deque_depth(s, w);
+
+    pthread_mutex_unlock(&w->mutex);
+
+    return 1;
+}
+
+/* Donne la tâche au thread qui l'exécute dans le journal rejoué, ou à
+ * n'importe quel thread si elle n'y est pas
+ *
+ * Renvoie 0 si la tâche n'a pas pu être gardée */
+static int
+replay_push(struct scheduler *s, struct task_info *task)
+{
+    int th, pos = replay_place(s->replay, task->id, &th);
+
+    if(pos >= 0) {
+        struct worker *w = &s->workers[th];
+
+        w->replay_tasks[pos] = *task;
+        atomic_store_explicit(&w->replay_ready[pos], 1, memory_order_release);
+        return 1;
+    }
+
+    pthread_mutex_lock(&s->strays_mutex);
+    if(s->nstrays == s->strays_size) {
+        int size = s->strays_size ? 2 * s->strays_size : s->qlen;
+        struct task_info *strays;
+
+        if(!(strays = realloc(s->strays, size * sizeof(struct task_info)))) {
+            pthread_mutex_unlock(&s->strays_mutex);
+            return 0;
+        }
+        s->strays = strays;
+        s->strays_size = size;
+    }
+    s->strays[s->nstrays++] = *task;
+    pthread_mutex_unlock(&s->strays_mutex);
+
+    return 1;
 }
 
 int
 sched_spawn(taskfunc f, void *closure, struct scheduler *s)
 {
-    int th;
+    return sched_spawn_attr(f, closure, NULL, s);
+}
 
-    pthread_mutex_lock(&s->mutex);
-    if((th = current_thread(s)) < 0) {
-        th = 0;
+int
+sched_spawn_attr(taskfunc f, void *closure, const struct sched_attr *attr,
+                 struct scheduler *s)
+{
+    struct sched_token *token = sched_token_inherit(attr);
+    taskfunc cancel = attr ? attr->cancel : NULL;
+    int prio = attr ? (int)attr->priority : SCHED_PRIO_NORMAL;
+    int th = self;
+    int pushed;
+    uint64_t id = 0;
+
+    // Identifiant calculé avant l'annulation, pour que les sœurs suivantes
+    // gardent le leur
+    if(s->record || s->replay) {
+        id = self >= 0 ? record_task_id(current_id, ++current_children)
+                       : record_task_id(0, atomic_fetch_add(&s->external, 1));
+    }
+
+    // Sous-arbre annulé, la tâche n'a pas besoin d'être exécutée
+    if(sched_token_cancelled(token)) {
+        sched_token_drop(cancel, closure, token, s);
+        return 0;
+    }
+
+    if(prio < 0 || prio >= SCHED_NPRIO) {
+        prio = SCHED_PRIO_NORMAL;
+    }
+
+    // Place la tâche chez le thread préféré
+    if(attr && attr->worker >= 0 && attr->worker < s->nthreads) {
+        th = attr->worker;
+    }
+
+    struct task_info task = {closure, f, self, token, cancel, id};
+
+    // La tâche est comptée avant d'être visible des autres threads
+    quiescence_arrive(s->pending, self);
+
+    // Travail d'abord : le thread exécute la tâche dès que la fiber courante
+    // s'est arrêtée et mise dans son deque, d'où elle peut être volée. Le
+    // deque ne contient plus que les suites des tâches en cours, autant que
+    // la profondeur de la récursion. Après fiber_yield, la tâche courante a
+    // peut-être changé de thread
+    if(s->workfirst && self >= 0 && th == self &&
+       prio == SCHED_PRIO_NORMAL) {
+        struct worker *w = &s->workers[self];
+
+        if(atomic_load_explicit(&w->depth, memory_order_relaxed) <
+           WORKFIRST_DEPTH) {
+            w->next = task;
+            w->data.total_tasks++;
+            if(fiber_yield()) {
+                return 0;
+            }
+
+            // Pas dans une fiber, la tâche va dans le deque
+            w->next.f = NULL;
+            w->data.total_tasks--;
+        } else if(inject_push(&s->inject, &task, prio)) {
+            // Trop de suites en attente : une tâche qui se recrée à sa fin
+            // les empilerait sans fin. La nouvelle tâche va dans la file
+            // d'injection, et le thread dépile dans l'ordre les suites, qui
+            // se terminent, jusqu'à celles qui ont encore du travail
+            w->unwinding = 1;
+            sched_wake(s);
+            return 0;
+        }
     }
-    pthread_mutex_unlock(&s->mutex);
 
-    pthread_mutex_lock(&s->workers[th].mutex);
+    // Le rejeu décide seul du thread qui exécute la tâche
+    if(s->replay) {
+        if(!replay_push(s, &task)) {
+            quiescence_depart(s->pending, self);
+            perror("Replay");
+            return -1;
+        }
+        return 0;
+    }
+
+    // Hors des threads de l'ordonnanceur, la tâche passe par la file
+    // d'injection que tous vident, sauf celles de haute priorité qui doivent
+    // être vues tout de suite
+    if(th < 0 && prio != SCHED_PRIO_HIGH) {
+        pushed = inject_push(&s->inject, &task, prio);
+    } else {
+        pushed = deque_push(s, th < 0 ? 0 : th, prio, &task);
+    }
 
-    int next = (s->workers[th].bottom + 1) % s->qlen;
-    if(next == s->workers[th].top) {
-        pthread_mutex_unlock(&s->workers[th].mutex);
+    if(!pushed) {
+        quiescence_depart(s->pending, self);
         fprintf(stderr, "Stack is full\n");
         errno = EAGAIN;
         return -1;
     }
 
-    s->workers[th].data.total_tasks++;
+    sched_wake(s);
 
-    s->workers[th].tasks[s->workers[th].bottom] =
-        (struct task_info){closure, f};
-    s->workers[th].bottom = next;
+    return 0;
+}
 
-    pthread_mutex_unlock(&s->workers[th].mutex);
+/* Ajoute une fiber qui peut reprendre au deque du thread courant, ou à la
+ * file d'injection pour le thread qui surveille les descripteurs. Elle est
+ * déjà comptée parmi les tâches en cours et ne doit pas être perdue : si le
+ * deque est plein on essaie ceux des autres, jusqu'à ce qu'une place se
+ * libère */
+static void
+sched_resume(struct fiber *fiber, void *arg)
+{
+    struct scheduler *s = (struct scheduler *)arg;
+    struct task_info task = {fiber, NULL, fiber_origin(fiber), NULL, NULL,
+                             0};
+    int th = self < 0 ? 0 : self;
+
+    if(self < 0) {
+        while(!inject_push(&s->inject, &task, SCHED_PRIO_NORMAL)) {
+            sched_yield();
+        }
+        sched_wake(s);
+        return;
+    }
+
+    for(int i = 1; !deque_push(s, th, SCHED_PRIO_NORMAL, &task); ++i) {
+        th = (th + 1) % s->nthreads;
+        if(i % s->nthreads == 0) {
+            sched_yield();
+        }
+    }
+
+    sched_wake(s);
+}
+
+/* Retire la dernière tâche ajoutée au deque du thread target, ou la
+ * première si oldest vaut 1, en prenant la plus haute priorité parmi les
+ * levels premiers niveaux */
+static int
+deque_pop(struct scheduler *s, int target, int levels, int oldest,
+          struct task_info *task)
+{
+    struct worker *w = &s->workers[target];
+    int found = 0;
+
+    pthread_mutex_lock(&w->mutex);
+    for(int p = 0; p < levels && !found; ++p) {
+        struct deque *d = &w->deques[p];
+
+        if(d->top != d->bottom) {
+            found = 1;
+            if(oldest) {
+                *task = d->tasks[d->top];
+                d->top = (d->top + 1) % s->qlen;
+            } else {
+                d->bottom = (d->bottom - 1 + s->qlen) % s->qlen;
+                *task = d->tasks[d->bottom];
+            }
+
+            if(p == SCHED_PRIO_HIGH) {
+                atomic_fetch_sub(&s->nhigh, 1);
+            }
+        }
+    }
+    if(found) {
+        deque_depth(s, w);
+    }
+    pthread_mutex_unlock(&w->mutex);
+
+    return found;
+}
+
+/* Cherche une tâche dans les deques de tous les threads, à partir d'un thread
+ * aléatoire, et range dans victim celui à qui elle a été prise
+ *
+ * En mode travail d'abord, le voleur prend la plus ancienne suite, la plus
+ * proche de la racine, qui contient le plus de travail */
+static int
+deque_steal(struct worker *w, int levels, struct task_info *task, int *victim)
+{
+    struct scheduler *s = w->sched;
+    int nthreads = s->nthreads;
+    int found = 0;
+
+    for(int i = 0, k = rand_r(&w->seed) % (nthreads + 1);
+        i < nthreads && !found; ++i) {
+        *victim = (i + k) % nthreads;
+        found = deque_pop(s, *victim, levels, s->workfirst, task);
+    }
+
+    return found;
+}
+
+/* Prend la plus ancienne tâche de la file d'injection, et jusqu'à
+ * INJECT_BATCH - 1 suivantes qui vont dans le deque du thread, où les autres
+ * peuvent les voler */
+static int
+inject_drain(struct worker *w, struct task_info *task)
+{
+    struct scheduler *s = w->sched;
+    struct task_info tasks[INJECT_BATCH];
+    int prios[INJECT_BATCH];
+    int n, kept = 1, created = 0;
+
+    if(!(n = inject_pop(&s->inject, tasks, prios, INJECT_BATCH))) {
+        return 0;
+    }
+    *task = tasks[0];
+
+    // Les suivantes en une seule prise du mutex
+    pthread_mutex_lock(&w->mutex);
+    for(; kept < n; ++kept) {
+        struct deque *d = &w->deques[prios[kept]];
+        int next = (d->bottom + 1) % s->qlen;
+
+        if(next == d->top) {
+            break;
+        }
+        d->tasks[d->bottom] = tasks[kept];
+        d->bottom = next;
+    }
+    deque_depth(s, w);
+    pthread_mutex_unlock(&w->mutex);
+
+    // Deque plein, le reste retourne dans la file
+    for(int i = kept; i < n; ++i) {
+        while(!inject_push(&s->inject, &tasks[i], prios[i])) {
+            sched_yield();
+        }
+    }
+
+    // Une fiber qui reprend n'est pas une nouvelle tâche
+    for(int i = 0; i < kept; ++i) {
+        created += tasks[i].f != NULL;
+    }
+    w->data.total_tasks += created;
+    w->data.total_injected += created;
+
+    // D'autres threads peuvent venir prendre le reste du lot
+    if(kept > 1) {
+        sched_wake(s);
+    }
+
+    return 1;
+}
+
+/* Renvoie 1 si un des deques ou la file d'injection contient une tâche */
+static int
+work_available(struct scheduler *s)
+{
+    int found = inject_available(&s->inject);
+
+    for(int i = 0; i < s->nthreads && !found; ++i) {
+        pthread_mutex_lock(&s->workers[i].mutex);
+        for(int p = 0; p < SCHED_NPRIO && !found; ++p) {
+            found = s->workers[i].deques[p].top !=
+                    s->workers[i].deques[p].bottom;
+        }
+        pthread_mutex_unlock(&s->workers[i].mutex);
+    }
+
+    return found;
+}
+
+/* Endort le thread jusqu'à ce qu'une tâche soit ajoutée ou que tout soit
+ * terminé */
+static void
+sched_park(struct worker *w, struct scheduler *s)
+{
+    pthread_mutex_lock(&s->mutex);
+    atomic_fetch_add(&s->nthsleep, 1);
+
+    // Une tâche ajoutée avant qu'on soit compté comme endormi n'a réveillé
+    // personne, on revérifie donc avant d'attendre
+    if(!quiescence_done(s->pending) && !work_available(s)) {
+        w->data.total_sleep++;
+        record_add(s->record, w->id, 0, RECORD_SLEEP);
+        pthread_cond_wait(&s->cond, &s->mutex);
+    }
+
+    atomic_fetch_sub(&s->nthsleep, 1);
+    pthread_mutex_unlock(&s->mutex);
+}
+
+/* Exécute la tâche, dans une fiber si elles sont activées
+ *
+ * Renvoie 0 si la tâche attend dans sa fiber : elle reste comptée parmi les
+ * tâches en cours jusqu'à ce qu'elle reprenne et se termine */
+static int
+sched_execute(struct worker *w, struct task_info *task)
+{
+    struct scheduler *s = w->sched;
+    struct fiber *fiber = (struct fiber *)task->closure;
+
+    // Faute de pile pour une nouvelle tâche, elle s'exécute sur celle du
+    // thread
+    if(!s->fibers ||
+       (task->f && !(fiber = fiber_new(s->fibers, w->id, task->f,
+                                       task->cancel, task->closure,
+                                       task->token, s, task->origin)))) {
+        if(!sched_token_run(task->f, task->cancel, task->closure, task->token,
+                            s)) {
+            w->data.total_cancelled++;
+        }
+        return 1;
+    }
+
+    switch(fiber_run(fiber, w->id)) {
+    case FIBER_CANCELLED:
+        w->data.total_cancelled++;
+        break;
+    case FIBER_WAITING:
+        // Sauf si elle a seulement laissé passer sa fille (travail d'abord)
+        if(!w->next.f) {
+            w->data.total_waits++;
+        }
+        return 0;
+    default:
+        break;
+    }
+
+    return 1;
+}
+
+/* Prend une tâche absente des journaux rejoués */
+static int
+replay_stray(struct scheduler *s, struct task_info *task)
+{
+    int found = 0;
+
+    pthread_mutex_lock(&s->strays_mutex);
+    if(s->nstrays > 0) {
+        *task = s->strays[--s->nstrays];
+        found = 1;
+    }
+    pthread_mutex_unlock(&s->strays_mutex);
+
+    return found;
+}
+
+/* Prend la prochaine tâche du journal du thread, à partir de *next, ou une
+ * suivante si le thread attend depuis trop longtemps (lost vaut alors 1)
+ *
+ * Renvoie 1 si la tâche est la prochaine du journal, 2 si c'en est une
+ * suivante, 0 s'il n'y en a aucune de prête */
+static int
+replay_next(struct worker *w, int *next, int lost, struct task_info *task)
+{
+    // Tâches déjà exécutées dans le désordre
+    while(*next < w->replay_len &&
+          atomic_load_explicit(&w->replay_ready[*next],
+                               memory_order_acquire) == 2) {
+        ++*next;
+    }
+
+    for(int i = *next; i < w->replay_len && (i == *next || lost); ++i) {
+        if(atomic_load_explicit(&w->replay_ready[i], memory_order_acquire) ==
+           1) {
+            *task = w->replay_tasks[i];
+            atomic_store_explicit(&w->replay_ready[i], 2,
+                                  memory_order_relaxed);
+            return i == *next ? 1 : 2;
+        }
+    }
 
     return 0;
 }
 
+/* Exécute les tâches du journal du thread, dans l'ordre en attendant que
+ * chacune soit créée, et celles qui ne sont dans aucun journal
+ *
+ * Les threads qui attendent sont comptés dans nthsearching : si tous
+ * attendent, plus personne ne peut créer la tâche attendue */
+static void
+sched_replay(struct worker *w)
+{
+    struct scheduler *s = w->sched;
+    struct timespec since, now;
+    struct task_info task;
+    int next = 0, lost = 0, waiting = 0;
+
+    while(1) {
+        int found;
+
+        perf_phase(w->perf, PERF_STEAL);
+        if(!(found = replay_next(w, &next, lost, &task))) {
+            found = replay_stray(s, &task);
+        }
+
+        if(!found) {
+            if(quiescence_done(s->pending)) {
+                break;
+            }
+
+            // Le programme a changé : la prochaine tâche n'arrivera jamais
+            // et les suivantes l'attendraient
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            if(!waiting) {
+                waiting = 1;
+                atomic_fetch_add(&s->nthsearching, 1);
+                since = now;
+            } else if(atomic_load(&s->nthsearching) < s->nthreads || lost) {
+                since = now;
+            } else if((now.tv_sec - since.tv_sec) * 1000000000L +
+                          now.tv_nsec - since.tv_nsec >
+                      REPLAY_PATIENCE) {
+                fprintf(stderr, "Replay: thread %d lost at task %d/%d\n",
+                        w->id, next, w->replay_len);
+                lost = 1;
+            }
+
+            perf_phase(w->perf, PERF_IDLE);
+            sched_yield();
+            continue;
+        }
+        if(waiting) {
+            waiting = 0;
+            atomic_fetch_sub(&s->nthsearching, 1);
+        }
+        w->data.total_tasks++;
+        if(found == 1) {
+            w->data.total_replayed++;
+        }
+
+        perf_phase(w->perf, PERF_EXECUTE);
+        current_id = task.id;
+        current_children = 0;
+        record_add(s->record, w->id, task.id, w->id);
+        if(!sched_token_run(task.f, task.cancel, task.closure, task.token,
+                            s)) {
+            w->data.total_cancelled++;
+        }
+
+        quiescence_depart(s->pending, task.origin);
+    }
+}
+
 void *
 sched_worker(void *arg)
 {
-    struct scheduler *s = (struct scheduler *)arg;
+    struct worker *w = (struct worker *)arg;
+    struct scheduler *s = w->sched;
+    int curr_th = w->id;
+    int failures = 0;
 
-    // Récupère le processus courant (index tableau)
-    int curr_th;
+    // Tâches exécutées, pour regarder la file d'injection de temps en temps
+    unsigned int ticks = 0;
 
-    pthread_mutex_lock(&s->mutex);
-    while((curr_th = current_thread(s)) < 0);
-    pthread_mutex_unlock(&s->mutex);
+    // Taux d'échec des derniers vols, en moyenne glissante
+    int fail_rate = 0;
+
+    // 1 si le thread est compté parmi ceux qui cherchent une tâche
+    int searching = 0;
+
+    self = curr_th;
+
+    // Les deques sont placés près du thread qui s'en sert le plus, sous le
+    // mutex car d'autres threads peuvent déjà y ajouter des tâches
+    pthread_mutex_lock(&w->mutex);
+    for(int p = 0; p < SCHED_NPRIO; ++p) {
+        huge_touch(w->deques[p].tasks, s->qlen * sizeof(struct task_info));
+    }
+    pthread_mutex_unlock(&w->mutex);
+
+    // Les compteurs suivent le thread, ils sont donc ouverts par lui
+    if(s->perf) {
+        w->perf = perf_open(PERF_STEAL);
+    }
+
+    if(s->replay) {
+        sched_replay(w);
+        perf_stop(w->perf);
+        return NULL;
+    }
 
     struct task_info task;
     int found;
+    // Thread à qui la tâche a été prise, pour le journal
+    int from;
     while(1) {
+        perf_phase(w->perf, PERF_STEAL);
         found = 0;
-        pthread_mutex_lock(&s->workers[curr_th].mutex);
+        from = curr_th;
 
-        if(s->workers[curr_th].top != s->workers[curr_th].bottom) {
+        // Tâche créée en mode travail d'abord, juste avant que sa mère rende
+        // la main
+        if(w->next.f) {
             found = 1;
-            s->workers[curr_th].bottom =
-                (s->workers[curr_th].bottom - 1 + s->qlen) % s->qlen;
-            task = s->workers[curr_th].tasks[s->workers[curr_th].bottom];
+            task = w->next;
+            w->next.f = NULL;
         }
-        pthread_mutex_unlock(&s->workers[curr_th].mutex);
 
+        // Les tâches de haute priorité, où qu'elles soient, passent avant
+        // celles du thread
+        if(!found &&
+           atomic_load_explicit(&s->nhigh, memory_order_relaxed) > 0) {
+            found = deque_steal(w, SCHED_PRIO_HIGH + 1, &task, &from);
+        }
+        // Tâches créées hors de l'ordonnanceur, pour qu'elles n'attendent
+        // pas que ce thread n'ait plus rien, sauf pendant qu'il dépile ses
+        // suites
+        if(!found && !w->unwinding && ++ticks % INJECT_INTERVAL == 0) {
+            found = inject_drain(w, &task);
+            from = RECORD_INJECT;
+        }
         if(!found) {
-            // Vol car aucune tâche trouvée
-            s->workers[curr_th].data.total_steal++;
+            found = deque_pop(s, curr_th, SCHED_NPRIO, 0, &task);
+            from = curr_th;
+        }
+        if(!found) {
+            w->unwinding = 0;
+            found = inject_drain(w, &task);
+            from = RECORD_INJECT;
+        }
 
-            pthread_mutex_lock(&s->mutex);
-            int nthreads = s->nthreads;
-            pthread_mutex_unlock(&s->mutex);
+        if(!found) {
+            // Vol car aucune tâche trouvée
+            w->data.total_steal++;
 
-            for(int i = 0, k = rand() % (nthreads + 1), target; i < nthreads;
-                ++i) {
-                target = (i + k) % nthreads;
+            if(!searching) {
+                searching = 1;
+                atomic_fetch_add(&s->nthsearching, 1);
+            }
 
-                pthread_mutex_lock(&s->workers[target].mutex);
-                if(s->workers[target].top != s->workers[target].bottom) {
-                    // Tâche trouvée
-                    found = 1;
-                    s->workers[target].bottom =
-                        (s->workers[target].bottom - 1 + s->qlen) % s->qlen;
-                    task = s->workers[target].tasks[s->workers[target].bottom];
+            found = deque_steal(w, SCHED_NPRIO, &task, &from);
 
-                    pthread_mutex_unlock(&s->workers[target].mutex);
-                    break;
-                }
-                pthread_mutex_unlock(&s->workers[target].mutex);
-            }
+            fail_rate += ((found ? 0 : FAIL_ONE) - fail_rate) / 8;
 
             // Aucune tâche à faire
             if(!found) {
-                s->workers[curr_th].data.total_failed_steal++;
+                w->data.total_failed_steal++;
 
-                pthread_mutex_lock(&s->mutex);
-                s->nthsleep++;
-
-                // Ne partir que si tout le monde dort
-                if(s->nthsleep >= s->nthreads) {
-                    pthread_cond_broadcast(&s->cond);
-                    pthread_mutex_unlock(&s->mutex);
+                // Plus aucune tâche en cours nulle part, c'est terminé
+                if(quiescence_done(s->pending)) {
                     break;
                 }
 
-                pthread_cond_wait(&s->cond, &s->mutex);
-                s->nthsleep--;
-
-                pthread_mutex_unlock(&s->mutex);
+                // Continue de voler un moment avant de s'endormir, d'autant
+                // moins longtemps que les vols échouent souvent
+                perf_phase(w->perf, PERF_IDLE);
+                if(++failures <
+                   1 + IDLE_ROUNDS * (FAIL_ONE - fail_rate) / FAIL_ONE) {
+                    sched_yield();
+                } else {
+                    searching = 0;
+                    atomic_fetch_sub(&s->nthsearching, 1);
+                    sched_park(w, s);
+                    failures = 0;
+                }
                 continue;
             }
+
+            // Il reste peut-être du travail, on passe le relais à un
+            // thread endormi
+            searching = 0;
+            atomic_fetch_sub(&s->nthsearching, 1);
+            sched_wake(s);
+        }
+        failures = 0;
+
+        // Exécute la tâche, sauf si elle a été annulée entre temps
+        perf_phase(w->perf, PERF_EXECUTE);
+        if(s->record) {
+            current_id = task.id;
+            current_children = 0;
+            record_add(s->record, w->id, task.id, from);
+        }
+        if(!sched_execute(w, &task)) {
+            continue;
         }
-        pthread_cond_signal(&s->cond);
 
-        // Exécute la tâche
-        task.f(task.closure, s);
+        // Dernière tâche, on réveille ceux qui dorment pour qu'ils partent
+        if(quiescence_depart(s->pending, task.origin)) {
+            pthread_mutex_lock(&s->mutex);
+            pthread_cond_broadcast(&s->cond);
+            pthread_mutex_unlock(&s->mutex);
+        }
     }
 
+    perf_stop(w->perf);
+
     return NULL;
 }
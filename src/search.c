@@ -0,0 +1,200 @@
+#include "../includes/search.h"
+#include "../includes/sched.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+/* Nombre de candidats, une puissance de 2 */
+#define CANDIDATES (1L << 26)
+
+/* Candidats examinés par une tâche feuille, une puissance de 2 */
+#define GRAIN 4096
+
+/* Candidats examinés entre deux tests d'annulation */
+#define POLL 1024
+
+/* Position de la réponse */
+#define ANSWER (CANDIDATES / 8 * 3 + 12345)
+
+/* Tours de mélange pour calculer l'empreinte d'un candidat */
+#define ROUNDS 4
+
+/* Empreinte recherchée */
+static uint64_t target;
+
+/* Candidat trouvé, -1 sinon, et date à laquelle il l'a été */
+static atomic_long found;
+static double found_at;
+
+/* Candidats évalués */
+static atomic_long evaluated;
+
+/* Jeton de l'arbre de recherche, annulé à la réponse si cancel vaut 1 */
+static struct sched_token *token;
+static int cancel;
+
+static double
+now(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+static uint64_t
+splitmix64(uint64_t x)
+{
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+static uint64_t
+hash(uint64_t x)
+{
+    for(int i = 0; i < ROUNDS; ++i) {
+        x = splitmix64(x);
+    }
+
+    return x;
+}
+
+/* Ajoute une tâche, en réessayant tant que l'ordonnanceur est plein */
+static void
+spawn(taskfunc f, void *closure, const struct sched_attr *attr,
+      struct scheduler *s)
+{
+    int rc;
+
+    while((rc = sched_spawn_attr(f, closure, attr, s)) < 0) {
+        if(errno != EAGAIN) {
+            break;
+        }
+    }
+    assert(rc >= 0);
+}
+
+/* Examine [lo, lo + n[ en s'arrêtant si la recherche est annulée */
+static void
+scan(long lo, long n)
+{
+    struct sched_token *current = sched_token_current();
+    long done = 0;
+
+    for(long x = lo; x < lo + n; ++x) {
+        if(done % POLL == 0 && sched_token_cancelled(current)) {
+            break;
+        }
+        done++;
+
+        if(hash(x) == target) {
+            long expected = -1;
+
+            if(atomic_compare_exchange_strong(&found, &expected, x)) {
+                found_at = now();
+                if(cancel) {
+                    sched_token_cancel(token);
+                }
+            }
+        }
+    }
+
+    atomic_fetch_add_explicit(&evaluated, done, memory_order_relaxed);
+}
+
+/* Noeud k d'un arbre binaire implicite (racine 1, enfants 2k et 2k + 1),
+ * qui couvre un intervalle de CANDIDATES / 2^profondeur candidats */
+void
+search(void *closure, struct scheduler *s)
+{
+    long k = (uintptr_t)closure;
+    long depth = 0;
+
+    while((k >> depth) > 1) {
+        depth++;
+    }
+
+    long size = CANDIDATES >> depth;
+    long lo = (k - (1L << depth)) * size;
+
+    if(size <= GRAIN) {
+        scan(lo, size);
+        return;
+    }
+
+    // La moitié gauche est ajoutée en dernier pour être examinée en premier
+    spawn(search, (void *)(uintptr_t)(2 * k + 1), NULL, s);
+    spawn(search, (void *)(uintptr_t)(2 * k), NULL, s);
+}
+
+/* Tâche initiale, crée la racine avec le jeton de la recherche */
+void
+search_root(void *closure, struct scheduler *s)
+{
+    struct sched_attr attr = SCHED_ATTR_DEFAULT;
+
+    (void)closure;
+
+    attr.token = token;
+    spawn(search, (void *)(uintptr_t)1, &attr, s);
+}
+
+static double
+run_search(int with_cancel, int nthreads, int qlen)
+{
+    double begin, delay;
+    int rc;
+
+    if(!(token = sched_token_new(NULL))) {
+        return -1;
+    }
+    cancel = with_cancel;
+    atomic_store(&found, -1);
+    atomic_store(&evaluated, 0);
+
+    begin = now();
+    rc = sched_init(nthreads, qlen, search_root, NULL);
+    assert(rc >= 0);
+    delay = now() - begin;
+
+    sched_token_free(token);
+    assert(atomic_load(&found) == ANSWER);
+
+    long n = atomic_load(&evaluated);
+    printf(" %-10s %12.6f %12.6f %11ld (%5.1f %%)\n",
+           with_cancel ? "oui" : "non", found_at - begin, delay, n,
+           100.0 * n / CANDIDATES);
+
+    return delay;
+}
+
+double
+benchmark_search(int nthreads, int qlen)
+{
+    double delay = 0, d;
+
+    // L'arbre entier peut attendre, quel que soit l'ordre d'exécution
+    if(qlen <= 0) {
+        qlen = 2 * CANDIDATES / GRAIN;
+    }
+
+    target = hash(ANSWER);
+
+    printf("search : %ld candidats, réponse en position %ld\n", CANDIDATES,
+           (long)ANSWER);
+    printf(" annulation  réponse (s)    total (s)   candidats évalués\n");
+    for(int with_cancel = 0; with_cancel <= 1; ++with_cancel) {
+        if((d = run_search(with_cancel, nthreads, qlen)) < 0) {
+            return -1;
+        }
+        delay += d;
+    }
+
+    return delay;
+}
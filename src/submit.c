@@ -0,0 +1,180 @@
+#include "../includes/submit.h"
+#include "../includes/sched.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+/* Nombre maximum de producteurs */
+#define PRODUCERS 4
+
+/* Tâches créées par chaque producteur */
+#define JOBS (1 << 15)
+
+/* Tours de calcul d'une tâche */
+#define JOB_ROUNDS 64
+
+/* Nombre maximum de threads dont on compte les tâches */
+#define MAX_THREADS 256
+
+/* Taille d'une ligne de cache */
+#define CACHE_LINE 64
+
+/* Tâches exécutées par un thread, sur sa propre ligne de cache */
+struct count {
+    alignas(CACHE_LINE) long n;
+};
+
+static struct count counts[MAX_THREADS];
+
+/* Ordonnanceur, publié par la tâche initiale pour les producteurs */
+static struct scheduler *_Atomic sched;
+
+/* Garde l'ordonnanceur en vie tant que les producteurs créent des tâches */
+static struct sched_join *producing;
+
+/* Empêche le calcul des tâches d'être supprimé */
+static atomic_uint_fast64_t sink;
+
+static double
+now(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+void
+job(void *closure, struct scheduler *s)
+{
+    uint64_t x = (uintptr_t)closure;
+    int self = sched_self(s);
+
+    for(int i = 0; i < JOB_ROUNDS; ++i) {
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL + 0x9E3779B97F4A7C15ULL;
+    }
+    if(x == 0) {
+        atomic_fetch_add_explicit(&sink, x, memory_order_relaxed);
+    }
+
+    if(self >= 0 && self < MAX_THREADS) {
+        counts[self].n++;
+    }
+}
+
+/* Producteur : attend l'ordonnanceur puis crée ses tâches */
+static void *
+producer(void *arg)
+{
+    uintptr_t id = (uintptr_t)arg;
+    struct scheduler *s;
+
+    while(!(s = atomic_load(&sched))) {
+        sched_yield();
+    }
+
+    for(uintptr_t i = 0; i < JOBS; ++i) {
+        while(sched_spawn(job, (void *)(id * JOBS + i), s) < 0) {
+            assert(errno == EAGAIN);
+            sched_yield();
+        }
+    }
+
+    sched_join_done(producing);
+
+    return NULL;
+}
+
+/* Tâche initiale : publie l'ordonnanceur et attend les producteurs */
+void
+submit_root(void *closure, struct scheduler *s)
+{
+    (void)closure;
+
+    atomic_store(&sched, s);
+    sched_join_wait(producing);
+}
+
+static double
+run_submit(int nproducers, int nthreads, int qlen)
+{
+    pthread_t threads[PRODUCERS];
+    double begin, delay;
+    long ntasks = (long)nproducers * JOBS, max = 0;
+    int rc;
+
+    atomic_store(&sched, NULL);
+    for(int i = 0; i < MAX_THREADS; ++i) {
+        counts[i].n = 0;
+    }
+    if(!(producing = sched_join_new(nproducers))) {
+        return -1;
+    }
+
+    for(int i = 0; i < nproducers; ++i) {
+        if(pthread_create(&threads[i], NULL, producer, (void *)(uintptr_t)i) !=
+           0) {
+            fprintf(stderr, "Can't create producer %d\n", i);
+            return -1;
+        }
+    }
+
+    begin = now();
+    rc = sched_init(nthreads, qlen, submit_root, NULL);
+    assert(rc >= 0);
+    delay = now() - begin;
+
+    for(int i = 0; i < nproducers; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    sched_join_free(producing);
+
+    for(int i = 0; i < MAX_THREADS; ++i) {
+        if(counts[i].n > max) {
+            max = counts[i].n;
+        }
+    }
+
+    printf(" %11d %12.6f %10.2f %13.0f %10.1f %%\n", nproducers, delay,
+           delay * 1e9 / ntasks, ntasks / delay, 100.0 * max / ntasks);
+
+    return delay;
+}
+
+double
+benchmark_submit(int nthreads, int qlen)
+{
+    double delay = 0, d;
+
+    if(nthreads <= 0) {
+        nthreads = sched_default_threads();
+    }
+    // Sans fibers, la tâche initiale bloque un thread
+    if(nthreads < 2) {
+        fprintf(stderr, "submit needs at least 2 threads\n");
+        return -1;
+    }
+
+    // Toutes les tâches peuvent attendre en même temps
+    if(qlen <= 0) {
+        qlen = PRODUCERS * JOBS;
+    }
+
+    printf("submit : %d tâches par producteur, %d threads\n", JOBS, nthreads);
+    printf(" producteurs     secondes   ns/tâche      tâches/s  max/thread\n");
+    for(int p = 1; p <= PRODUCERS; p *= 2) {
+        if((d = run_submit(p, nthreads, qlen)) < 0) {
+            return -1;
+        }
+        delay += d;
+    }
+
+    return delay;
+}
@@ -0,0 +1,113 @@
+#include "../includes/token.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+struct sched_token {
+    /* 1 une fois annulé */
+    atomic_int cancelled;
+
+    /* Jeton dont il dépend */
+    struct sched_token *parent;
+};
+
+/* Jeton de la tâche en cours d'exécution par le thread */
+static _Thread_local struct sched_token *current = NULL;
+
+struct sched_token *
+sched_token_new(struct sched_token *parent)
+{
+    struct sched_token *token;
+
+    if(!(token = malloc(sizeof(struct sched_token)))) {
+        perror("Token");
+        return NULL;
+    }
+
+    atomic_init(&token->cancelled, 0);
+    token->parent = parent;
+
+    return token;
+}
+
+void
+sched_token_cancel(struct sched_token *token)
+{
+    atomic_store_explicit(&token->cancelled, 1, memory_order_release);
+}
+
+int
+sched_token_cancelled(const struct sched_token *token)
+{
+    for(; token; token = token->parent) {
+        if(atomic_load_explicit(&token->cancelled, memory_order_acquire)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+struct sched_token *
+sched_token_current(void)
+{
+    return current;
+}
+
+void
+sched_token_free(struct sched_token *token)
+{
+    free(token);
+}
+
+struct sched_token *
+sched_token_inherit(const struct sched_attr *attr)
+{
+    return attr && attr->token ? attr->token : current;
+}
+
+struct sched_token *
+sched_token_swap(struct sched_token *token)
+{
+    struct sched_token *saved = current;
+
+    current = token;
+
+    return saved;
+}
+
+void
+sched_token_drop(taskfunc cancel, void *closure, struct sched_token *token,
+                 struct scheduler *s)
+{
+    struct sched_token *saved = current;
+
+    if(!cancel) {
+        return;
+    }
+
+    current = token;
+    cancel(closure, s);
+    current = saved;
+}
+
+int
+sched_token_run(taskfunc f, taskfunc cancel, void *closure,
+                struct sched_token *token, struct scheduler *s)
+{
+    struct sched_token *saved = current;
+
+    if(sched_token_cancelled(token)) {
+        sched_token_drop(cancel, closure, token, s);
+        return 0;
+    }
+
+    // Une tâche peut en exécuter une autre sur place, on restaure donc le
+    // jeton précédent
+    current = token;
+    f(closure, s);
+    current = saved;
+
+    return 1;
+}
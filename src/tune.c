@@ -0,0 +1,254 @@
+#include "../includes/tune.h"
+#include "../includes/mandelbrot.h"
+#include "../includes/quicksort.h"
+#include "../includes/sched.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Fichier des réglages par défaut */
+#define TUNE_FILE "ordonnanceur.tune"
+
+/* Essais de chaque valeur, le plus rapide compte */
+#define TUNE_RUNS 3
+
+/* Taille réduite des essais : clés triées par quicksort, lignes du centre de
+ * la vue d'ensemble calculées par mandelbrot */
+#define TUNE_KEYS (1024 * 1024)
+#define TUNE_ROWS 128
+
+/* Avance relative qu'une valeur doit avoir sur la meilleure jusque-là pour
+ * la remplacer, la valeur en cours étant essayée en premier : en dessous,
+ * c'est du bruit */
+#define TUNE_MARGIN 0.03
+
+/* Valeurs essayées au plus par paramètre */
+#define TUNE_MAX 8
+
+struct tuning tuning = {QUICKSORT_CUTOFF, 8, 1, 1};
+
+/* Paramètres cherchés l'un après l'autre, chacun avec les meilleures valeurs
+ * des précédents, et les valeurs essayées (terminées par 0) */
+static const struct {
+    const char *name;
+    int *value;
+
+    /* 1 si le paramètre est mesuré avec mandelbrot, 0 avec quicksort */
+    int mandelbrot;
+
+    int candidates[TUNE_MAX];
+} params[] = {
+    {"cutoff de quicksort", &tuning.cutoff, 0, {32, 64, 128, 256, 512, 1024}},
+    {"diviseur de qlen de quicksort", &tuning.quicksort_qlen, 0, {1, 4, 16}},
+    {"morceaux de mandelbrot", &tuning.chunk, 1, {4, 8, 16, 32}},
+    {"diviseur de qlen de mandelbrot", &tuning.mandelbrot_qlen, 1, {1, 4, 16}},
+};
+
+#define NPARAMS (int)(sizeof(params) / sizeof(params[0]))
+
+/* Renvoie le fichier des réglages */
+static const char *
+tune_file(void)
+{
+    const char *env = getenv("SCHED_TUNE_FILE");
+
+    return env && *env ? env : TUNE_FILE;
+}
+
+/* Range dans key le début des lignes du fichier pour nthreads threads :
+ * modèle de CPU, nombre de cœurs, ordonnanceur et nombre de threads */
+static void
+tune_key(char *key, size_t size, int nthreads)
+{
+    char line[256], model[256] = "inconnu";
+    int cores = sched_default_threads();
+    FILE *f;
+
+    if((f = fopen("/proc/cpuinfo", "r"))) {
+        while(fgets(line, sizeof(line), f)) {
+            char *value = strchr(line, ':');
+
+            if(strncmp(line, "model name", 10) == 0 && value) {
+                value += strspn(value, ": \t");
+                value[strcspn(value, "\n")] = '\0';
+                snprintf(model, sizeof(model), "%s", value);
+                break;
+            }
+        }
+        fclose(f);
+    }
+
+    snprintf(key, size, "%s;%d;%s;%d;", model, cores, sched_name(),
+             nthreads > 0 ? nthreads : cores);
+}
+
+int
+tune_load(int nthreads)
+{
+    char key[512], line[1024];
+    struct tuning t;
+    int found = 0;
+    FILE *f;
+
+    if(!(f = fopen(tune_file(), "r"))) {
+        return 0;
+    }
+
+    tune_key(key, sizeof(key), nthreads);
+    while(!found && fgets(line, sizeof(line), f)) {
+        found = strncmp(line, key, strlen(key)) == 0 &&
+                sscanf(line + strlen(key), "%d;%d;%d;%d", &t.cutoff, &t.chunk,
+                       &t.quicksort_qlen, &t.mandelbrot_qlen) == 4 &&
+                t.cutoff > 0 && t.chunk > 0 && t.quicksort_qlen > 0 &&
+                t.mandelbrot_qlen > 0;
+    }
+    fclose(f);
+
+    if(found) {
+        tuning = t;
+        printf("Réglages de %s : cutoff %d, morceaux %d, qlen / %d et / %d\n",
+               tune_file(), t.cutoff, t.chunk, t.quicksort_qlen,
+               t.mandelbrot_qlen);
+    }
+
+    return found;
+}
+
+/* Renvoie le meilleur temps de TUNE_RUNS essais réduits de quicksort ou
+ * mandelbrot, sans leur affichage (les erreurs restent visibles), -1 si l'un
+ * d'eux échoue */
+static double
+tune_measure(int mandelbrot, int nthreads)
+{
+    struct mandelbrot_options options = {0};
+    double best = -1;
+    int null, out;
+
+    options.rows = TUNE_ROWS;
+
+    fflush(stdout);
+    if((null = open("/dev/null", O_WRONLY)) < 0 || (out = dup(1)) < 0) {
+        perror("Tune");
+        if(null >= 0) {
+            close(null);
+        }
+        return -1;
+    }
+    dup2(null, 1);
+    close(null);
+
+    for(int i = 0; i < TUNE_RUNS; ++i) {
+        double delay = mandelbrot ? benchmark_mandelbrot(0, nthreads, -1,
+                                                         &options)
+                                  : benchmark_quicksort(0, nthreads, -1,
+                                                        SORT_INT32, TUNE_KEYS);
+
+        if(delay < 0) {
+            best = -1;
+            break;
+        }
+        if(best < 0 || delay < best) {
+            best = delay;
+        }
+    }
+
+    fflush(stdout);
+    dup2(out, 1);
+    close(out);
+
+    return best;
+}
+
+/* Remplace ou ajoute la ligne des réglages de nthreads threads dans le
+ * fichier, en passant par un fichier temporaire
+ *
+ * Renvoie -1 en cas d'échec */
+static int
+tune_save(int nthreads)
+{
+    const char *file = tune_file();
+    char key[512], line[1024], tmp[1024];
+    FILE *in, *out;
+
+    tune_key(key, sizeof(key), nthreads);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", file);
+
+    if(!(out = fopen(tmp, "w"))) {
+        perror(tmp);
+        return -1;
+    }
+
+    // Les réglages des autres machines, ordonnanceurs et nombres de threads
+    // sont gardés
+    if((in = fopen(file, "r"))) {
+        while(fgets(line, sizeof(line), in)) {
+            if(strncmp(line, key, strlen(key)) != 0) {
+                fputs(line, out);
+            }
+        }
+        fclose(in);
+    }
+
+    fprintf(out, "%s%d;%d;%d;%d\n", key, tuning.cutoff, tuning.chunk,
+            tuning.quicksort_qlen, tuning.mandelbrot_qlen);
+
+    if(fclose(out) != 0 || rename(tmp, file) < 0) {
+        perror(file);
+        return -1;
+    }
+
+    return 0;
+}
+
+int
+tune_run(int nthreads)
+{
+    printf("Réglage avec %s et %d threads, %d essais réduits par valeur, "
+           "%.0f %% d'avance pour changer\n",
+           sched_name(), nthreads > 0 ? nthreads : sched_default_threads(),
+           TUNE_RUNS, TUNE_MARGIN * 100);
+
+    for(int p = 0; p < NPARAMS; ++p) {
+        int current = *params[p].value, best_value = current;
+        double best = -1;
+
+        // La valeur en cours d'abord, puis les autres
+        for(int i = -1; i < TUNE_MAX && (i < 0 || params[p].candidates[i]);
+            ++i) {
+            int value = i < 0 ? current : params[p].candidates[i];
+            double delay;
+
+            if(i >= 0 && value == current) {
+                continue;
+            }
+
+            *params[p].value = value;
+            if((delay = tune_measure(params[p].mandelbrot, nthreads)) < 0) {
+                fprintf(stderr, "Tune: %s %d: benchmark failed\n",
+                        params[p].name, value);
+                return -1;
+            }
+            printf(" %s %d : %.3f s\n", params[p].name, value, delay);
+
+            if(best < 0 || delay < best * (1 - TUNE_MARGIN)) {
+                best = delay;
+                best_value = value;
+            }
+        }
+
+        *params[p].value = best_value;
+    }
+
+    if(tune_save(nthreads) < 0) {
+        return -1;
+    }
+    printf("Réglages enregistrés dans %s : cutoff %d, morceaux %d, qlen / %d "
+           "et / %d\n",
+           tune_file(), tuning.cutoff, tuning.chunk, tuning.quicksort_qlen,
+           tuning.mandelbrot_qlen);
+
+    return 0;
+}
@@ -0,0 +1,241 @@
+#define _GNU_SOURCE
+
+#include "../includes/wait.h"
+#include "../includes/sched.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Nombre de tâches qui lisent un tube */
+#define READERS 32
+
+/* Intervalle entre deux écritures, en secondes */
+#define WRITE_INTERVAL 0.001
+
+/* Tâches de calcul par thread */
+#define COMPUTE_PER_THREAD 64
+
+/* Durée d'une tâche de calcul, en secondes */
+#define COMPUTE_TASK 0.001
+
+struct reader {
+    /* Tube */
+    int fds[2];
+
+    /* Écriture de la donnée, et sa lecture */
+    double written;
+    double read;
+};
+
+static struct reader readers[READERS];
+
+/* Attendu par la dernière tâche */
+static struct sched_join *join;
+
+/* Début de l'exécution, et fin vue par la dernière tâche */
+static double begin, end;
+
+static double
+now(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+/* Ajoute une tâche, en réessayant tant que l'ordonnanceur est plein */
+static void
+spawn(taskfunc f, void *closure, struct scheduler *s)
+{
+    int rc;
+
+    while((rc = sched_spawn(f, closure, s)) < 0) {
+        if(errno != EAGAIN) {
+            break;
+        }
+    }
+    assert(rc >= 0);
+}
+
+/* Thread qui écrit un octet dans chaque tube, à intervalle régulier */
+static void *
+writer(void *arg)
+{
+    (void)arg;
+
+    for(int i = 0; i < READERS; ++i) {
+        double at = begin + (i + 1) * WRITE_INTERVAL;
+        struct timespec t;
+        double delay;
+
+        if((delay = at - now()) > 0) {
+            t.tv_sec = (time_t)delay;
+            t.tv_nsec = (long)((delay - t.tv_sec) * 1e9);
+            nanosleep(&t, NULL);
+        }
+
+        readers[i].written = now();
+        if(write(readers[i].fds[1], "x", 1) != 1) {
+            perror("Writer");
+        }
+    }
+
+    return NULL;
+}
+
+void
+read_task(void *closure, struct scheduler *s)
+{
+    struct reader *r = (struct reader *)closure;
+    char c;
+    int rc;
+
+    (void)s;
+
+    rc = sched_wait_fd(r->fds[0], POLLIN);
+    assert(rc > 0);
+    rc = read(r->fds[0], &c, 1);
+    assert(rc == 1);
+    r->read = now();
+
+    sched_join_done(join);
+}
+
+void
+compute_task(void *closure, struct scheduler *s)
+{
+    double stop = now() + COMPUTE_TASK;
+
+    (void)closure;
+    (void)s;
+
+    while(now() < stop) {
+    }
+
+    sched_join_done(join);
+}
+
+/* Crée les tâches de calcul, à part pour qu'en travail d'abord, où chacune
+ * s'exécute dès sa création, la tâche initiale n'attende pas la fin du calcul
+ * pour créer les lecteurs */
+void
+compute_root(void *closure, struct scheduler *s)
+{
+    int ncompute = COMPUTE_PER_THREAD * sched_nthreads(s);
+
+    (void)closure;
+
+    for(int i = 0; i < ncompute; ++i) {
+        spawn(compute_task, NULL, s);
+    }
+}
+
+void
+last_task(void *closure, struct scheduler *s)
+{
+    (void)closure;
+    (void)s;
+
+    sched_join_wait(join);
+    end = now();
+}
+
+void
+wait_root(void *closure, struct scheduler *s)
+{
+    (void)closure;
+
+    // Dans l'ordre inverse de leur exécution par le thread : les lecteurs
+    // d'abord, qui attendent, puis le calcul, puis la dernière tâche
+    spawn(last_task, NULL, s);
+    spawn(compute_root, NULL, s);
+    for(int i = 0; i < READERS; ++i) {
+        spawn(read_task, &readers[i], s);
+    }
+}
+
+static int
+compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+double
+benchmark_wait(int nthreads, int qlen)
+{
+    double latencies[READERS];
+    double ideal, delay;
+    pthread_t thread;
+    int rc;
+
+    if(nthreads <= 0) {
+        nthreads = sched_default_threads();
+    }
+    // Sans fibers, la dernière tâche bloque un thread
+    if(nthreads < 2) {
+        fprintf(stderr, "wait needs at least 2 threads\n");
+        return -1;
+    }
+
+    // Toutes les tâches peuvent attendre en même temps
+    if(qlen <= 0) {
+        qlen = READERS + COMPUTE_PER_THREAD * nthreads + 3;
+    }
+
+    for(int i = 0; i < READERS; ++i) {
+        if(pipe2(readers[i].fds, O_CLOEXEC) < 0) {
+            perror("Pipe");
+            return -1;
+        }
+    }
+
+    if(!(join = sched_join_new(READERS + COMPUTE_PER_THREAD * nthreads))) {
+        return -1;
+    }
+
+    begin = now();
+    if(pthread_create(&thread, NULL, writer, NULL) != 0) {
+        fprintf(stderr, "Can't create the writer thread\n");
+        return -1;
+    }
+
+    rc = sched_init(nthreads, qlen, wait_root, NULL);
+    assert(rc >= 0);
+    delay = now() - begin;
+
+    pthread_join(thread, NULL);
+    sched_join_free(join);
+
+    for(int i = 0; i < READERS; ++i) {
+        latencies[i] = readers[i].read - readers[i].written;
+        close(readers[i].fds[0]);
+        close(readers[i].fds[1]);
+    }
+    qsort(latencies, READERS, sizeof(double), compare_double);
+
+    // Sans attente, seul le calcul compte
+    ideal = COMPUTE_PER_THREAD * COMPUTE_TASK;
+    if(READERS * WRITE_INTERVAL > ideal) {
+        ideal = READERS * WRITE_INTERVAL;
+    }
+
+    printf("wait : %d lecteurs (un octet toutes les %.0f µs), "
+           "%d tâches de %.0f µs par thread\n",
+           READERS, WRITE_INTERVAL * 1e6, COMPUTE_PER_THREAD,
+           COMPUTE_TASK * 1e6);
+    printf(" total (ms)   idéal (ms)  lecture médiane (µs)  max (µs)\n");
+    printf(" %10.1f %12.1f %21.1f %9.1f\n", (end - begin) * 1e3, ideal * 1e3,
+           latencies[READERS / 2] * 1e6, latencies[READERS - 1] * 1e6);
+
+    return delay;
+}
@@ -0,0 +1,275 @@
+#include "../includes/wavefront.h"
+#include "../includes/dag.h"
+#include "../includes/sched.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define LENGTH 16384
+#define TILE 256
+#define NTILES ((LENGTH + TILE - 1) / TILE)
+
+#define MATCH 2
+#define MISMATCH -1
+#define GAP 1
+
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+struct wavefront {
+    /* Séquences comparées */
+    char *a, *b;
+
+    /* rows[i] : ligne de la matrice à la fin de la i-ème ligne de blocs,
+     * rows[0] étant la ligne 0, nulle */
+    int *rows[NTILES + 1];
+
+    /* cols[j] : colonne de la matrice à la fin de la j-ème colonne de blocs,
+     * cols[0] étant la colonne 0, nulle */
+    int *cols[NTILES + 1];
+
+    /* Meilleur score de chaque bloc */
+    int best[NTILES][NTILES];
+};
+
+struct wavefront_args {
+    struct wavefront *w;
+    int ti, tj;
+};
+
+/* Calcule le bloc (ti, tj) à partir des bords laissés par les blocs au dessus
+ * et à gauche */
+void
+tile(struct wavefront *w, int ti, int tj)
+{
+    int i0 = ti * TILE + 1, i1 = (ti + 1) * TILE;
+    int j0 = tj * TILE + 1, j1 = (tj + 1) * TILE;
+    int prev[TILE + 1], cur[TILE + 1];
+    int width;
+    int best = 0;
+
+    if(i1 > LENGTH) {
+        i1 = LENGTH;
+    }
+    if(j1 > LENGTH) {
+        j1 = LENGTH;
+    }
+    width = j1 - j0 + 1;
+
+    // Ligne au dessus du bloc, coin compris
+    for(int k = 0; k <= width; k++) {
+        prev[k] = w->rows[ti][j0 - 1 + k];
+    }
+
+    for(int i = i0; i <= i1; i++) {
+        cur[0] = w->cols[tj][i];
+        for(int k = 1; k <= width; k++) {
+            int diag = prev[k - 1] +
+                       (w->a[i - 1] == w->b[j0 + k - 2] ? MATCH : MISMATCH);
+            int h = MAX(0, diag);
+            h = MAX(h, prev[k] - GAP);
+            h = MAX(h, cur[k - 1] - GAP);
+            cur[k] = h;
+            best = MAX(best, h);
+        }
+
+        w->cols[tj + 1][i] = cur[width];
+        for(int k = 0; k <= width; k++) {
+            prev[k] = cur[k];
+        }
+    }
+
+    // Dernière ligne du bloc, pour les blocs en dessous
+    for(int k = 1; k <= width; k++) {
+        w->rows[ti + 1][j0 - 1 + k] = prev[k];
+    }
+
+    w->best[ti][tj] = best;
+}
+
+void
+wavefront_tile(void *closure, struct scheduler *s)
+{
+    struct wavefront_args *args = (struct wavefront_args *)closure;
+
+    (void)s;
+
+    tile(args->w, args->ti, args->tj);
+}
+
+void
+wavefront_serial(struct wavefront *w)
+{
+    for(int ti = 0; ti < NTILES; ti++) {
+        for(int tj = 0; tj < NTILES; tj++) {
+            tile(w, ti, tj);
+        }
+    }
+}
+
+/* Tâche initiale : lance le graphe des blocs */
+void
+wavefront_root(void *closure, struct scheduler *s)
+{
+    struct dag *dag = (struct dag *)closure;
+    int rc = dag_submit(dag, NULL, NULL, s);
+    assert(rc >= 0);
+}
+
+/* Renvoie 1 si les deux calculs ont donné la même matrice : dernière ligne
+ * et dernière colonne de chaque bloc, et meilleurs scores */
+static int
+wavefront_equal(struct wavefront *w, struct wavefront *ref)
+{
+    size_t size = (LENGTH + 1) * sizeof(int);
+
+    for(int i = 0; i <= NTILES; i++) {
+        if(memcmp(w->rows[i], ref->rows[i], size) != 0 ||
+           memcmp(w->cols[i], ref->cols[i], size) != 0) {
+            return 0;
+        }
+    }
+
+    return memcmp(w->best, ref->best, sizeof(w->best)) == 0;
+}
+
+/* Meilleur score de l'alignement */
+int
+wavefront_score(struct wavefront *w)
+{
+    int best = 0;
+
+    for(int ti = 0; ti < NTILES; ti++) {
+        for(int tj = 0; tj < NTILES; tj++) {
+            best = MAX(best, w->best[ti][tj]);
+        }
+    }
+
+    return best;
+}
+
+void
+free_wavefront(struct wavefront *w)
+{
+    for(int i = 0; i <= NTILES; i++) {
+        free(w->rows[i]);
+        free(w->cols[i]);
+    }
+    free(w->a);
+    free(w->b);
+    free(w);
+}
+
+struct wavefront *
+new_wavefront(void)
+{
+    struct wavefront *w;
+
+    if(!(w = calloc(1, sizeof(struct wavefront)))) {
+        perror("Wavefront");
+        return NULL;
+    }
+
+    w->a = malloc(LENGTH);
+    w->b = malloc(LENGTH);
+    for(int i = 0; i <= NTILES; i++) {
+        w->rows[i] = calloc(LENGTH + 1, sizeof(int));
+        w->cols[i] = calloc(LENGTH + 1, sizeof(int));
+        if(!w->rows[i] || !w->cols[i]) {
+            perror("Wavefront borders");
+            free_wavefront(w);
+            return NULL;
+        }
+    }
+    if(!w->a || !w->b) {
+        perror("Sequences");
+        free_wavefront(w);
+        return NULL;
+    }
+
+    unsigned long long s = 0;
+    for(int i = 0; i < LENGTH; i++) {
+        s = s * 6364136223846793005ULL + 1442695040888963407;
+        w->a[i] = "ACGT"[(s >> 33) & 3];
+        s = s * 6364136223846793005ULL + 1442695040888963407;
+        w->b[i] = "ACGT"[(s >> 33) & 3];
+    }
+
+    return w;
+}
+
+double
+benchmark_wavefront(int serial, int nthreads, int qlen)
+{
+    struct wavefront *w, *ref;
+    struct wavefront_args args[NTILES][NTILES];
+    struct dag_node *nodes[NTILES][NTILES];
+    struct dag *dag = NULL;
+    struct timespec begin, end;
+    double delay;
+    int score;
+    int rc;
+
+    if(qlen <= 0) {
+        qlen = NTILES * NTILES;
+    }
+
+    if(!(w = new_wavefront())) {
+        return -1;
+    }
+
+    if(!serial) {
+        if(!(dag = dag_new())) {
+            return -1;
+        }
+
+        for(int ti = 0; ti < NTILES; ti++) {
+            for(int tj = 0; tj < NTILES; tj++) {
+                args[ti][tj] = (struct wavefront_args){w, ti, tj};
+                nodes[ti][tj] = dag_add(dag, wavefront_tile, &args[ti][tj]);
+                assert(nodes[ti][tj]);
+
+                if(ti > 0) {
+                    rc = dag_edge(nodes[ti - 1][tj], nodes[ti][tj]);
+                    assert(rc >= 0);
+                }
+                if(tj > 0) {
+                    rc = dag_edge(nodes[ti][tj - 1], nodes[ti][tj]);
+                    assert(rc >= 0);
+                }
+            }
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    if(serial) {
+        wavefront_serial(w);
+    } else {
+        rc = sched_init(nthreads, qlen, wavefront_root, dag);
+        assert(rc >= 0);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    delay = end.tv_sec + end.tv_nsec / 1000000000.0 -
+            (begin.tv_sec + begin.tv_nsec / 1000000000.0);
+
+    // Vérifie le résultat avec un calcul en série
+    score = wavefront_score(w);
+    if(!serial) {
+        if(!(ref = new_wavefront())) {
+            return -1;
+        }
+        wavefront_serial(ref);
+        rc = wavefront_equal(w, ref);
+        assert(rc);
+        free_wavefront(ref);
+        dag_free(dag);
+    }
+    printf("Score: %d\n", score);
+
+    free_wavefront(w);
+    return delay;
+}